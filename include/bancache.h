@@ -59,9 +59,19 @@ class CoreExport BanCacheManager
 	typedef TR1NS::unordered_map<std::string, BanCacheHit*, TR1NS::hash<std::string> > BanCacheHash;
 
 	BanCacheHash BanHash;
+
+	/** The number of negative hits in BanHash. */
+	size_t NegativeHits;
+
 	bool RemoveIfExpired(BanCacheHash::iterator& it);
 
+	/** Removes a hit from the cache.
+	 * @param it The hit to remove. Will be updated to point to the next hit.
+	 */
+	void RemoveHit(BanCacheHash::iterator& it);
+
  public:
+	BanCacheManager();
 
 	/** Creates and adds a Ban Cache item.
 	 * @param ip The IP the item is for.
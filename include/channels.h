@@ -25,6 +25,7 @@
 
 #pragma once
 
+#include "hashcomp.h"
 #include "membership.h"
 #include "mode.h"
 #include "parammode.h"
@@ -64,6 +65,105 @@ class CoreExport Channel : public Extensible
 	 */
 	void DelUser(const MemberMap::iterator& membiter);
 
+	/** Memberships of the local users on this channel. Members who have at least one
+	 * prefix mode are kept at the front so messages sent to a status prefix only have
+	 * to look at those members.
+	 */
+	std::vector<Membership*> localmembers;
+
+	/** Number of members at the front of localmembers who have a prefix mode.
+	 */
+	size_t localprefixed;
+
+	/** Swap two entries of the local member list.
+	 * @param first Position of the first entry.
+	 * @param second Position of the second entry.
+	 */
+	void SwapLocalMembers(size_t first, size_t second);
+
+	/** Move a local member between the prefixed and unprefixed parts of the local
+	 * member list after their prefix modes have changed.
+	 * @param memb The local member whose prefix modes have changed.
+	 */
+	void UpdateLocalMember(Membership* memb);
+
+	/** An entry of the ban list which has been split up so that users can be matched against it quickly.
+	 */
+	struct CompiledBan
+	{
+		/** The ban mask as it was set.
+		 */
+		std::string mask;
+
+		/** The extban type of the mask or 0 if it is not an extban.
+		 */
+		char type;
+
+		/** The part of the mask after the extban type if it is an extban.
+		 */
+		std::string value;
+
+		/** Whether the nickident and host fields are set. This is true if the mask, or the
+		 * value of an extban, is in the nick!ident\@host form.
+		 */
+		bool hostmask;
+
+		/** The nick!ident part of the mask.
+		 */
+		irc::wildcard_mask nickident;
+
+		/** The host part of the mask.
+		 */
+		irc::wildcard_mask host;
+
+		/** Whether the host part of the mask is an IP address range in CIDR form.
+		 */
+		bool cidr;
+
+		/** Splits up a ban mask.
+		 * @param banmask The ban mask to split up.
+		 */
+		CompiledBan(const std::string& banmask);
+	};
+
+	/** The entries of the ban list in compiled form.
+	 * This is only up to date if compiledserial is the same as banserial.
+	 */
+	std::vector<CompiledBan> compiledbans;
+
+	/** The value of banserial when compiledbans was last rebuilt.
+	 */
+	unsigned long compiledserial;
+
+	/** Changes whenever something which can change the result of a ban check other than a
+	 * change to an individual user happens. Ban check results cached in Memberships are
+	 * only valid as long as this stays the same.
+	 */
+	unsigned long banserial;
+
+	/** Retrieves the ban list in compiled form, compiling it first if it has changed.
+	 */
+	const std::vector<CompiledBan>& GetCompiledBans();
+
+	/** Check a compiled ban for a match.
+	 * @param user The user to check.
+	 * @param ban The ban to check against.
+	 * @param extban If true then the value of the extban is checked instead of the whole mask.
+	 * @param nickident Buffer for the nick!ident of the user, filled in when it is first needed.
+	 * @return True if the user matches the ban; otherwise, false.
+	 */
+	bool CheckBan(User* user, const CompiledBan& ban, bool extban, std::string& nickident);
+
+	/** Check the ban list for a match, using the result cached in the membership of the
+	 * user if there is one.
+	 * @param user The user to check.
+	 * @param type The extban type to check for or 0 to check for a normal ban.
+	 * @return True if the user matches an entry in the ban list; otherwise, false.
+	 */
+	bool MatchBanList(User* user, char type);
+
+	friend class Membership;
+
  public:
 	/** Creates a channel record and initialises it with default values
 	 * @param name The name of the channel
@@ -283,6 +383,13 @@ class CoreExport Channel : public Extensible
 	 */
 	ModResult GetExtBanStatus(User *u, char type);
 
+	/** Forget the cached results of checking the members of this channel against the ban list.
+	 * This is called by the core when a list mode of the channel changes. Modules which change
+	 * anything that affects whether bans match, other than something about a single user (see
+	 * User::InvalidateBanCache()), must call it for every channel.
+	 */
+	void InvalidateBanCache() { banserial++; }
+
 	/** Write a NOTICE to all local users on the channel
 	 * @param text Text to send
 	 * @param status The minimum status rank to send this message to.
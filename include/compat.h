@@ -29,12 +29,14 @@
 # include <array>
 # include <functional>
 # include <unordered_map>
+# include <unordered_set>
 # include <type_traits>
 #else
 # define TR1NS std::tr1
 # include <tr1/array>
 # include <tr1/functional>
 # include <tr1/unordered_map>
+# include <tr1/unordered_set>
 # include <tr1/type_traits>
 #endif
 
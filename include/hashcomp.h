@@ -288,4 +288,43 @@ namespace irc
 		 */
 		long GetToken();
 	};
+
+	/** A glob pattern which has been preprocessed so that it can be matched against lots of
+	 * strings quickly. Matching a string against it gives the same result as InspIRCd::Match().
+	 */
+	class CoreExport wildcard_mask
+	{
+	 private:
+		/** The glob pattern.
+		 */
+		std::string mask;
+
+		/** The length of the part of the pattern before the first '*' or std::string::npos if it has none.
+		 */
+		std::string::size_type prefixlen;
+
+		/** The length of the part of the pattern after the last '*'.
+		 */
+		std::string::size_type suffixlen;
+
+		/** Whether the pattern has more than one '*' in it.
+		 */
+		bool backtrack;
+
+	 public:
+		/** Create a wildcard_mask from a glob pattern.
+		 * @param pattern The glob pattern to match against.
+		 */
+		wildcard_mask(const std::string& pattern = std::string());
+
+		/** Match a string against the pattern.
+		 * @param str The string to match.
+		 * @param map The character map to use when matching or NULL for the national case map.
+		 * @return True if the string matches the pattern; otherwise, false.
+		 */
+		bool Match(const std::string& str, unsigned const char* map = NULL) const;
+
+		/** Retrieves the glob pattern. */
+		const std::string& str() const { return mask; }
+	};
 }
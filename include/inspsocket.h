@@ -119,9 +119,65 @@ class CoreExport StreamSocket : public EventHandler
 	class SendQueue
 	{
 	 public:
-		/** One element of the queue, a continuous buffer
+		/** One element of the queue, a continuous buffer. Elements are immutable and
+		 * reference counted so the same data can be queued on many sockets without
+		 * being copied for each of them.
 		 */
-		typedef std::string Element;
+		class Element
+		{
+			/** Reference counted storage which is shared between copies of an element.
+			 */
+			class Buffer : public refcountbase
+			{
+			 public:
+				/** The data contained in this buffer. */
+				const std::string data;
+
+				Buffer(const std::string& str) : data(str) { }
+				Buffer(const char* str, size_t len) : data(str, len) { }
+			};
+
+			/** The storage this element refers to or NULL if the element is empty. */
+			reference<Buffer> buffer;
+
+			/** Number of bytes at the beginning of the storage which are not part of this element. */
+			size_t offset;
+
+		 public:
+			typedef std::string::size_type size_type;
+			typedef const char* const_iterator;
+
+			Element() : offset(0) { }
+			Element(const std::string& str) : buffer(str.empty() ? NULL : new Buffer(str)), offset(0) { }
+			Element(const char* str, size_type len) : buffer(len ? new Buffer(str, len) : NULL), offset(0) { }
+
+			/** Get a pointer to the data in this element. The data is not null terminated.
+			 * @return The data in this element.
+			 */
+			const char* data() const { return buffer ? buffer->data.data() + offset : ""; }
+
+			/** Get the length of this element.
+			 * @return The number of bytes in this element.
+			 */
+			size_type length() const { return buffer ? buffer->data.length() - offset : 0; }
+			size_type size() const { return length(); }
+			bool empty() const { return length() == 0; }
+
+			const_iterator begin() const { return data(); }
+			const_iterator end() const { return data() + length(); }
+			char operator[](size_type pos) const { return data()[pos]; }
+
+			/** Get a copy of the data in this element as a string.
+			 * @return The data in this element.
+			 */
+			std::string str() const { return std::string(data(), length()); }
+
+			/** Remove bytes from the beginning of this element. Other elements which
+			 * share the same storage are not affected.
+			 * @param n Number of bytes to remove
+			 */
+			void erase_front(size_type n) { offset += n; }
+		};
 
 		/** Sequence container of buffers in the queue
 		 */
@@ -179,7 +235,7 @@ class CoreExport StreamSocket : public EventHandler
 		void erase_front(Element::size_type n)
 		{
 			nbytes -= n;
-			data.front().erase(0, n);
+			data.front().erase_front(n);
 		}
 
 		/** Insert a new buffer at the beginning of the queue
@@ -216,7 +272,7 @@ class CoreExport StreamSocket : public EventHandler
 		}
 
 	 private:
-		/** Private send queue. Note that individual strings may be shared.
+		/** Private send queue. Note that individual elements may be shared.
 		 */
 		Container data;
 
@@ -340,6 +396,11 @@ class CoreExport StreamSocket : public EventHandler
 	/** Send the given data out the socket, either now or when writes unblock
 	 */
 	void WriteData(const std::string& data);
+
+	/** Send the given send queue element out the socket, either now or when writes unblock.
+	 * The element is queued without copying the data it refers to.
+	 */
+	void WriteData(const SendQueue::Element& data);
 	/** Convenience function: read a line from the socket
 	 * @param line The line read
 	 * @param delim The line delimiter
@@ -443,5 +504,13 @@ class CoreExport BufferedSocket : public StreamSocket
 	BufferedSocketError BeginConnect(const irc::sockets::sockaddrs& dest, const irc::sockets::sockaddrs& bind, unsigned int timeout);
 };
 
+namespace ClientProtocol
+{
+	/** A message serialized for sending to a client. This is a send queue element so one
+	 * serialization of a message can be queued for any number of users without copying it.
+	 */
+	typedef StreamSocket::SendQueue::Element SerializedMessage;
+}
+
 inline IOHook* StreamSocket::GetIOHook() const { return iohook; }
 inline void StreamSocket::DelIOHook() { iohook = NULL; }
@@ -34,6 +34,27 @@
  */
 class CoreExport Membership : public Extensible, public insp::intrusive_list_node<Membership>
 {
+	/** Position of this membership in the local member list of the channel.
+	 * Only meaningful if the user is local, maintained by the Channel class.
+	 */
+	size_t localpos;
+
+	/** The ban list serial of the channel which the cached ban check results are valid for.
+	 */
+	unsigned long banserial;
+
+	/** Bitmask of the ban checks which have a cached result. Bit 0 is for normal bans and
+	 * the other bits are for the extban types from 'A' to 'z'.
+	 */
+	uint64_t bancached;
+
+	/** Bitmask of the cached ban checks which matched this member.
+	 */
+	uint64_t banmatched;
+
+	friend class Channel;
+	friend class User;
+
  public:
 	/** Type of the Membership id
 	 */
@@ -71,7 +92,15 @@ class CoreExport Membership : public Extensible, public insp::intrusive_list_nod
 	 * Call Channel::JoinUser() or ForceJoin() to make a user join a channel instead of constructing
 	 * Membership objects directly.
 	 */
-	Membership(User* u, Channel* c) : user(u), chan(c) {}
+	Membership(User* u, Channel* c)
+		: localpos(0)
+		, banserial(0)
+		, bancached(0)
+		, banmatched(0)
+		, user(u)
+		, chan(c)
+	{
+	}
 
 	/** Check if this member has a given prefix mode set
 	 * @param pm Prefix mode to check
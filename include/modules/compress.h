@@ -0,0 +1,108 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "iohook.h"
+
+/** I/O hook provider for stream compression modules. */
+class CompressionIOHookProvider : public IOHookProvider
+{
+ public:
+	CompressionIOHookProvider(Module* mod, const std::string& Name)
+		: IOHookProvider(mod, "compress/" + Name, IOHookProvider::IOH_UNKNOWN, true)
+	{
+	}
+};
+
+/** Base class for I/O hooks which compress the data sent over a line based connection.
+ *
+ * Compression is started separately for each direction. Until then the hook passes data
+ * through unchanged and looks at the start of each line. When it sees the line returned by
+ * GetStartLine() it starts (de)compressing everything after that line. If it sees a line
+ * which has a prefix or tags first then compression will never be used in that direction
+ * and it stops looking.
+ */
+class CompressionIOHook : public IOHookMiddle
+{
+ public:
+	/** Keeps track of the amount of data which has gone through the hook in one direction. */
+	struct Counter
+	{
+		/** The number of bytes before being compressed or after being decompressed. */
+		unsigned long long plain;
+
+		/** The number of bytes of compressed data sent or received. */
+		unsigned long long compressed;
+
+		Counter()
+			: plain(0)
+			, compressed(0)
+		{
+		}
+	};
+
+	/** The data sent through this hook. */
+	Counter sent;
+
+	/** The data received through this hook. */
+	Counter received;
+
+	CompressionIOHook(IOHookProvider* hookprov)
+		: IOHookMiddle(hookprov)
+	{
+	}
+
+	/** Retrieves the line which starts compression of the data that follows it.
+	 * @param algorithm The name of the compression algorithm.
+	 * @return The line, without the line terminator.
+	 */
+	static std::string GetStartLine(const std::string& algorithm)
+	{
+		return "COMPRESS " + algorithm;
+	}
+
+	/** Find the compression hook of a socket.
+	 * @param sock The socket to find the hook of.
+	 * @return The compression hook of the socket or NULL if it does not have one.
+	 */
+	static CompressionIOHook* Find(StreamSocket* sock)
+	{
+		IOHook* hook = sock->GetIOHook();
+		while (hook)
+		{
+			if (!hook->prov->name.compare(0, 9, "compress/"))
+				return static_cast<CompressionIOHook*>(hook);
+
+			IOHookMiddle* middle = IOHookMiddle::ToMiddleHook(hook);
+			hook = middle ? middle->GetNextHook() : NULL;
+		}
+		return NULL;
+	}
+
+	/** Retrieves the name of the compression algorithm used by this hook. */
+	std::string GetAlgorithm() const
+	{
+		return prov->name.substr(9);
+	}
+
+	/** Determines whether data sent through this hook is being compressed. */
+	virtual bool IsCompressing() const = 0;
+
+	/** Determines whether data received through this hook is being decompressed. */
+	virtual bool IsDecompressing() const = 0;
+};
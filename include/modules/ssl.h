@@ -151,6 +151,212 @@ class ssl_cert : public refcountbase
 	}
 };
 
+/** Keeps the TLS (SSL) sessions which a profile has established so that clients can
+ * resume them instead of doing a full handshake when they reconnect. TLS (SSL) modules
+ * keep these outside of their profiles so that the sessions survive a rehash.
+ */
+class SSLSessionCache : public refcountbase
+{
+	typedef std::list<std::string> ExpiryList;
+
+	/** A session which can be resumed. */
+	struct Entry
+	{
+		/** The serialized session. */
+		std::string data;
+
+		/** The time at which the session expires. */
+		time_t expires;
+
+		/** The position of the session in the expiry list. */
+		ExpiryList::iterator position;
+	};
+
+	typedef std::map<std::string, Entry> EntryMap;
+
+	/** The sessions which can be resumed, by session id. */
+	EntryMap entries;
+
+	/** The id of each session in the order they were stored, oldest first. */
+	ExpiryList expirylist;
+
+	/** The maximum number of sessions to keep. */
+	size_t maxentries;
+
+	/** The number of seconds a session can be resumed for. */
+	unsigned long lifetime;
+
+	/** The number of handshakes which resumed a session. */
+	unsigned long hits;
+
+	/** The number of handshakes which did not resume a session. */
+	unsigned long misses;
+
+	/** Remove a session from the cache.
+	 * @param it The session to remove.
+	 */
+	void RemoveEntry(EntryMap::iterator it)
+	{
+		expirylist.erase(it->second.position);
+		entries.erase(it);
+	}
+
+	/** Remove the oldest session from the cache. */
+	void RemoveOldest()
+	{
+		RemoveEntry(entries.find(expirylist.front()));
+	}
+
+	/** Remove sessions which have expired and then the oldest sessions until there are at most the given number left.
+	 * @param max The maximum number of sessions to leave in the cache.
+	 */
+	void Prune(size_t max)
+	{
+		while ((!expirylist.empty()) && (entries.find(expirylist.front())->second.expires <= ServerInstance->Time()))
+			RemoveOldest();
+
+		while ((!expirylist.empty()) && (entries.size() > max))
+			RemoveOldest();
+	}
+
+ public:
+	SSLSessionCache()
+		: maxentries(0)
+		, lifetime(0)
+		, hits(0)
+		, misses(0)
+	{
+	}
+
+	/** Change the limits of the cache, removing sessions if there are more than it can now hold.
+	 * @param max The maximum number of sessions to keep. If 0 then no sessions are kept.
+	 * @param life The number of seconds a session can be resumed for.
+	 */
+	void SetLimits(size_t max, unsigned long life)
+	{
+		maxentries = max;
+		lifetime = life;
+		Prune(maxentries);
+	}
+
+	/** Retrieves the number of seconds a session can be resumed for. */
+	unsigned long GetLifetime() const { return lifetime; }
+
+	/** Retrieves the number of sessions which are being kept. */
+	size_t GetSize() const { return entries.size(); }
+
+	/** Retrieves the number of handshakes which resumed a session. */
+	unsigned long GetHits() const { return hits; }
+
+	/** Retrieves the number of handshakes which did not resume a session. */
+	unsigned long GetMisses() const { return misses; }
+
+	/** Record the outcome of a handshake.
+	 * @param resumed True if the handshake resumed a session; otherwise, false.
+	 */
+	void CountHandshake(bool resumed)
+	{
+		if (resumed)
+			hits++;
+		else
+			misses++;
+	}
+
+	/** Store a session which can be resumed.
+	 * @param id The id of the session.
+	 * @param data The serialized session.
+	 */
+	void Store(const std::string& id, const std::string& data)
+	{
+		if (!maxentries || !lifetime)
+			return;
+
+		// A session which is stored again moves to the back of the expiry list.
+		EntryMap::iterator it = entries.find(id);
+		if (it != entries.end())
+			RemoveEntry(it);
+
+		Prune(maxentries - 1);
+
+		Entry& entry = entries[id];
+		entry.data = data;
+		entry.expires = ServerInstance->Time() + lifetime;
+		entry.position = expirylist.insert(expirylist.end(), id);
+	}
+
+	/** Retrieve a session which can be resumed.
+	 * @param id The id of the session.
+	 * @param data The location to store the serialized session in.
+	 * @return True if the session was found; otherwise, false.
+	 */
+	bool Retrieve(const std::string& id, std::string& data) const
+	{
+		EntryMap::const_iterator it = entries.find(id);
+		if ((it == entries.end()) || (it->second.expires <= ServerInstance->Time()))
+			return false;
+
+		data = it->second.data;
+		return true;
+	}
+
+	/** Remove a session so that it can no longer be resumed.
+	 * @param id The id of the session.
+	 */
+	void Remove(const std::string& id)
+	{
+		EntryMap::iterator it = entries.find(id);
+		if (it != entries.end())
+			RemoveEntry(it);
+	}
+
+	/** Reads the settings of a TLS (SSL) profile which decide whether a peer certificate is
+	 * trusted along with the contents of the files they refer to. Resumed sessions keep the
+	 * result of verifying the peer certificate of the original handshake so TLS (SSL) modules
+	 * compare a digest of this to find out whether their cached sessions are still valid.
+	 * @param tag The tag which configures the profile.
+	 * @return The settings and file contents.
+	 */
+	static std::string ReadTrustSettings(ConfigTag* tag)
+	{
+		static const char* const keys[] = { "certfile", "keyfile", "cafile", "crlfile", "crlpath", "crlmode", "hash", "requestclientcert" };
+		std::string settings;
+		for (size_t i = 0; i < sizeof(keys) / sizeof(*keys); ++i)
+			settings.append(keys[i]).append("=").append(tag->getString(keys[i])).push_back('\n');
+
+		std::vector<std::string> files;
+		files.push_back(tag->getString("certfile", "cert.pem", 1));
+		files.push_back(tag->getString("keyfile", "key.pem", 1));
+		files.push_back(tag->getString("cafile", "ca.pem", 1));
+		files.push_back(tag->getString("crlfile"));
+
+		const std::string crlpath = tag->getString("crlpath");
+		std::vector<std::string> crlfiles;
+		if (!crlpath.empty() && FileSystem::GetFileList(crlpath, crlfiles))
+		{
+			std::sort(crlfiles.begin(), crlfiles.end());
+			for (std::vector<std::string>::const_iterator i = crlfiles.begin(); i != crlfiles.end(); ++i)
+				files.push_back(crlpath + "/" + *i);
+		}
+
+		for (std::vector<std::string>::const_iterator i = files.begin(); i != files.end(); ++i)
+		{
+			if (i->empty())
+				continue;
+
+			// Files which are missing are reported by the module when it loads them.
+			try
+			{
+				FileReader reader(*i);
+				settings.append(*i).append("\n").append(reader.GetString()).push_back('\n');
+			}
+			catch (CoreException&)
+			{
+			}
+		}
+		return settings;
+	}
+};
+
 /** I/O hook provider for SSL modules. */
 class SSLIOHookProvider : public IOHookProvider
 {
@@ -186,7 +392,8 @@ class SSLIOHook : public IOHook
 		tmp.reserve(std::min(targetsize, sendq.bytes())+1);
 		do
 		{
-			tmp.append(sendq.front());
+			const StreamSocket::SendQueue::Element& elem = sendq.front();
+			tmp.append(elem.data(), elem.length());
 			sendq.pop_front();
 		}
 		while (!sendq.empty() && tmp.length() < targetsize);
@@ -41,6 +41,50 @@ class CoreExport ProtocolInterface
  public:
 	typedef ProtocolServer Server;
 
+	/** Statistics about the lines of one command on a server link. */
+	class CommandStats
+	{
+	 public:
+		/** The number of buckets in the handling time histogram. */
+		static const size_t HISTOGRAM_BUCKETS = 6;
+
+		/** The number of lines which were received. */
+		unsigned long received;
+
+		/** The number of bytes which were received. */
+		unsigned long long bytesin;
+
+		/** The number of lines which were sent. */
+		unsigned long sent;
+
+		/** The number of bytes which were sent. */
+		unsigned long long bytesout;
+
+		/** The total time spent handling received lines in microseconds. */
+		unsigned long long handletime;
+
+		/** The longest time spent handling a received line in microseconds. */
+		unsigned long maxhandletime;
+
+		/** The number of received lines which took less than 10, 100, 1000, 10000 and 100000
+		 * microseconds to handle and which took longer than that, respectively.
+		 */
+		unsigned long histogram[HISTOGRAM_BUCKETS];
+
+		CommandStats()
+			: received(0)
+			, bytesin(0)
+			, sent(0)
+			, bytesout(0)
+			, handletime(0)
+			, maxhandletime(0)
+		{
+			std::fill(histogram, histogram + HISTOGRAM_BUCKETS, 0);
+		}
+	};
+
+	typedef std::map<std::string, CommandStats> CommandStatsMap;
+
 	class ServerInfo
 	{
 	 public:
@@ -50,6 +94,24 @@ class CoreExport ProtocolInterface
 		unsigned int usercount;
 		unsigned int opercount;
 		unsigned int latencyms;
+
+		/** The number of lines sent to the server in the last second, or 0 if it is not directly linked. */
+		unsigned long linespersec;
+
+		/** The average number of bytes written to the server at once, or 0 if it is not directly linked. */
+		unsigned long bytesperflush;
+
+		/** The largest amount of data which has been queued for the server, or 0 if it is not directly linked. */
+		unsigned long sendqpeak;
+
+		/** How long the last burst we sent to the server took in milliseconds, or 0 if it is not directly linked. */
+		unsigned long burstsendtime;
+
+		/** How long the last burst received from the server took in milliseconds, or 0 if none has finished. */
+		unsigned long burstrecvtime;
+
+		/** Statistics about each command sent to and received from the server, empty if it is not directly linked. */
+		CommandStatsMap commands;
 	};
 
 	typedef std::vector<ServerInfo> ServerList;
@@ -38,12 +38,16 @@ class Module;
  * your object (which you have to override) will be called
  * at the given time.
  */
-class CoreExport Timer
+class CoreExport Timer : public insp::intrusive_list_node<Timer>
 {
 	/** The triggering time
 	 */
 	time_t trigger;
 
+	/** The list in the TimerManager this timer is currently in or NULL if it is not scheduled.
+	 */
+	insp::intrusive_list_tail<Timer>* bucket;
+
 	/** Number of seconds between triggers
 	 */
 	unsigned int secs;
@@ -114,21 +118,76 @@ class CoreExport Timer
 	{
 		repeat = false;
 	}
+
+	friend class TimerManager;
 };
 
 /** This class manages sets of Timers, and triggers them at their defined times.
  * This will ensure timers are not missed, as well as removing timers that have
  * expired and allowing the addition of new ones.
+ *
+ * Timers are kept in a hierarchical timing wheel. The first level has a bucket
+ * for every second in the near future and each further level has buckets which
+ * cover exponentially longer periods of time. Timers in the higher levels are
+ * moved down a level whenever the level below wraps around. Adding and removing
+ * a timer takes constant time regardless of how many timers are pending.
  */
 class CoreExport TimerManager
 {
-	typedef std::multimap<time_t, Timer*> TimerMap;
+	typedef insp::intrusive_list_tail<Timer> TimerList;
+
+	/** The number of bits of the trigger time used to select a bucket in the first level.
+	 */
+	static const unsigned int ROOT_BITS = 8;
+
+	/** The number of bits of the trigger time used to select a bucket in the other levels.
+	 */
+	static const unsigned int LEVEL_BITS = 6;
+
+	/** The number of levels after the first one.
+	 */
+	static const unsigned int LEVEL_COUNT = 4;
+
+	static const size_t ROOT_SIZE = 1 << ROOT_BITS;
+	static const size_t LEVEL_SIZE = 1 << LEVEL_BITS;
+
+	/** Buckets for timers which trigger within the next ROOT_SIZE seconds, one per second.
+	 */
+	TimerList root[ROOT_SIZE];
+
+	/** Buckets for timers which trigger further in the future.
+	 */
+	TimerList levels[LEVEL_COUNT][LEVEL_SIZE];
+
+	/** Timers which are due in the second currently being processed.
+	 */
+	TimerList expired;
+
+	/** The next second to be processed. Timers which trigger before this time are
+	 * treated as if they trigger at this time.
+	 */
+	time_t nexttick;
+
+	/** Put a timer into the bucket which matches its trigger time.
+	 * @param t The timer to schedule.
+	 */
+	void Schedule(Timer* t);
 
-	/** A list of all pending timers
+	/** Move all timers in a bucket to the bucket which matches their trigger time.
+	 * @param bucket The bucket to empty.
 	 */
-	TimerMap Timers;
+	void Cascade(TimerList& bucket);
+
+	/** Reschedule all pending timers relative to a new time. This is used when
+	 * the clock has gone backwards or has jumped too far forwards to process
+	 * every second in between.
+	 * @param TIME The new time.
+	 */
+	void Rebuild(time_t TIME);
 
  public:
+	TimerManager();
+
 	/** Tick all pending Timers
 	 * @param TIME the current system time
 	 */
@@ -63,7 +63,6 @@ namespace ClientProtocol
 
 	typedef std::vector<Message*> MessageList;
 	typedef std::vector<std::string> ParamList;
-	typedef std::string SerializedMessage;
 
 	struct MessageTagData
 	{
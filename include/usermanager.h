@@ -66,11 +66,28 @@ class CoreExport UserManager : public fakederef<UserManager>
 	 */
 	LocalList local_users;
 
+	/** The next local user to be checked by DoBackgroundUserStuff() or NULL if every user has been checked in the current pass
+	 */
+	LocalUser* bgnext;
+
+	/** The number of local users which should have been checked in the current pass so far
+	 */
+	size_t bgchecked;
+
+	/** The time at which the current pass of DoBackgroundUserStuff() started
+	 */
+	time_t bgpass;
+
 	/** Last used already sent id, used when sending messages to neighbors to help determine whether the message has
 	 * been sent to a particular user or not. See User::ForEachNeighbor() for more info.
 	 */
 	already_sent_t already_sent_id;
 
+	/** Perform background checks on the next users in the current pass of DoBackgroundUserStuff().
+	 * @param count The maximum number of users to check.
+	 */
+	void CheckNextUsers(size_t count);
+
  public:
 	/** Constructor, initializes variables
 	 */
@@ -102,6 +119,7 @@ class CoreExport UserManager : public fakederef<UserManager>
 
 	/** Perform background user events for all local users such as PING checks, registration timeouts,
 	 * penalty management and recvq processing for users who have data in their recvq due to throttling.
+	 * This should be called on every iteration of the mainloop, each user is checked once a second.
 	 */
 	void DoBackgroundUserStuff();
 
@@ -692,6 +692,13 @@ class CoreExport User : public Extensible
 	 */
 	bool ChangeNick(const std::string& newnick, time_t newts = 0);
 
+	/** Forget the cached results of checking this user against the ban lists of the
+	 * channels they are on. This must be called whenever something which a ban or an
+	 * extban can match against changes. The core does this itself for changes to the
+	 * nick, ident, hosts, IP address, real name, oper status and channel memberships.
+	 */
+	void InvalidateBanCache();
+
 	/** Remove this user from all channels they are on, and delete any that are now empty.
 	 * This is used by QUIT, and will not send part messages!
 	 */
@@ -730,7 +737,7 @@ class CoreExport UserIOHandler : public StreamSocket
 	 * sendq value, the user will be removed, and further buffer adds will be dropped.
 	 * @param data The data to add to the write buffer
 	 */
-	void AddWriteBuf(const std::string &data);
+	void AddWriteBuf(const SendQueue::Element& data);
 
 	/** Swaps the internals of this UserIOHandler with another one.
 	 * @param other A UserIOHandler to swap internals with.
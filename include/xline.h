@@ -402,6 +402,65 @@ class CoreExport XLineFactory
 	virtual ~XLineFactory() { }
 };
 
+/** Indexes the host and IP masks of G-lines, K-lines, E-lines and Z-lines so that the
+ * lines which might match a user can be found without checking every line. Lines with
+ * a literal mask are kept in a hash map, lines with a CIDR mask are kept in a map keyed
+ * by the range they cover and only lines with a wildcard mask have to be checked one by
+ * one. The lines found still have to be checked against the user with XLine::Matches().
+ */
+class CoreExport XLineIndex
+{
+ public:
+	/** A list of lines which might match a user. */
+	typedef std::vector<XLine*> LineList;
+
+ private:
+	typedef TR1NS::unordered_map<std::string, LineList, irc::insensitive, irc::StrHashComp> ExactMap;
+	typedef std::map<irc::sockets::cidr_mask, LineList> CIDRMap;
+	typedef std::map<std::pair<unsigned char, unsigned char>, size_t> CIDRLengthMap;
+
+	/** Lines with a literal mask, indexed by their mask. */
+	ExactMap exact;
+
+	/** Lines with a CIDR mask, indexed by the range they cover. */
+	CIDRMap cidr;
+
+	/** The number of lines in cidr for each address family and range length. */
+	CIDRLengthMap cidrlengths;
+
+	/** Lines with a mask which can only be checked by wildcard matching. */
+	LineList wild;
+
+	/** Find the lines with a CIDR mask which covers an address.
+	 * @param sa The address to look up.
+	 * @param out The list to append the lines to.
+	 */
+	void FindCIDR(const irc::sockets::sockaddrs& sa, LineList& out) const;
+
+ public:
+	/** Retrieves the mask of a line which is indexed by this class.
+	 * @param line The line to retrieve the mask of.
+	 * @return The host or IP mask of the line or NULL if lines of this type can not be indexed.
+	 */
+	static const std::string* GetMask(XLine* line);
+
+	/** Adds a line to the index.
+	 * @param line The line to add. GetMask() must return a mask for this line.
+	 */
+	void Add(XLine* line);
+
+	/** Removes a line from the index.
+	 * @param line The line to remove.
+	 */
+	void Remove(XLine* line);
+
+	/** Finds the lines which might match a user.
+	 * @param user The user to look up.
+	 * @param out The list to append the lines to.
+	 */
+	void Find(User* user, LineList& out) const;
+};
+
 /** XLineManager is a class used to manage G-lines, K-lines, E-lines, Z-lines and Q-lines,
  * or any other line created by a module. It also manages XLineFactory classes which
  * can generate a specialized XLine for use by another module.
@@ -424,6 +483,15 @@ class CoreExport XLineManager
 	 */
 	XLineContainer lookup_lines;
 
+	/** Indexes of the lines of each type which can be indexed, see XLineIndex.
+	 */
+	std::map<std::string, XLineIndex> line_index;
+
+	/** Remove a line from line_index if it is indexed.
+	 * @param line The line to remove.
+	 */
+	void RemoveFromIndex(XLine* line);
+
  public:
 
 	/** Constructor
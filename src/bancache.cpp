@@ -31,6 +31,11 @@ BanCacheHit::BanCacheHit(const std::string& type, const std::string& reason, tim
 {
 }
 
+BanCacheManager::BanCacheManager()
+	: NegativeHits(0)
+{
+}
+
 BanCacheHit *BanCacheManager::AddHit(const std::string &ip, const std::string &type, const std::string &reason, time_t seconds)
 {
 	BanCacheHit*& b = BanHash[ip];
@@ -38,6 +43,8 @@ BanCacheHit *BanCacheManager::AddHit(const std::string &ip, const std::string &t
 		return NULL;
 
 	b = new BanCacheHit(type, reason, (seconds ? seconds : 86400));
+	if (!b->IsPositive())
+		NegativeHits++;
 	return b;
 }
 
@@ -60,13 +67,25 @@ bool BanCacheManager::RemoveIfExpired(BanCacheHash::iterator& it)
 		return false;
 
 	ServerInstance->Logs->Log("BANCACHE", LOG_DEBUG, "Hit on " + it->first + " is out of date, removing!");
+	RemoveHit(it);
+	return true;
+}
+
+void BanCacheManager::RemoveHit(BanCacheHash::iterator& it)
+{
+	if (!it->second->IsPositive())
+		NegativeHits--;
+
 	delete it->second;
 	it = BanHash.erase(it);
-	return true;
 }
 
 void BanCacheManager::RemoveEntries(const std::string& type, bool positive)
 {
+	// Lines are often added in bulk so avoid walking the cache when there is nothing to remove.
+	if (!positive && !NegativeHits)
+		return;
+
 	if (positive)
 		ServerInstance->Logs->Log("BANCACHE", LOG_DEBUG, "BanCacheManager::RemoveEntries(): Removing positive hits for " + type);
 	else
@@ -95,8 +114,7 @@ void BanCacheManager::RemoveEntries(const std::string& type, bool positive)
 		{
 			/* we need to remove this one. */
 			ServerInstance->Logs->Log("BANCACHE", LOG_DEBUG, "BanCacheManager::RemoveEntries(): Removing a hit on " + i->first);
-			delete b;
-			i = BanHash.erase(i);
+			RemoveHit(i);
 		}
 		else
 			++i;
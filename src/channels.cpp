@@ -34,7 +34,7 @@ namespace
 }
 
 Channel::Channel(const std::string &cname, time_t ts)
-	: name(cname), age(ts), topicset(0)
+	: localprefixed(0), compiledserial(0), banserial(1), name(cname), age(ts), topicset(0)
 {
 	if (!ServerInstance->chanlist.insert(std::make_pair(cname, this)).second)
 		throw CoreException("Cannot create duplicate channel " + cname);
@@ -72,6 +72,12 @@ Membership* Channel::AddUser(User* user)
 		return NULL;
 
 	Membership* memb = new(ret.first->second) Membership(user, this);
+	if (IS_LOCAL(user))
+	{
+		// New members have no prefix modes so they go at the end of the list.
+		memb->localpos = localmembers.size();
+		localmembers.push_back(memb);
+	}
 	return memb;
 }
 
@@ -105,6 +111,25 @@ void Channel::CheckDestroy()
 void Channel::DelUser(const MemberMap::iterator& membiter)
 {
 	Membership* memb = membiter->second;
+
+	// Bans can match the other channels a user is on
+	if (!memb->user->quitting)
+		memb->user->InvalidateBanCache();
+
+	if (IS_LOCAL(memb->user))
+	{
+		// Move the member to the end of the prefixed part of the list (if they are in it)
+		// and from there to the end of the list so that they can be removed in constant time.
+		size_t pos = memb->localpos;
+		if (pos < localprefixed)
+		{
+			SwapLocalMembers(pos, --localprefixed);
+			pos = localprefixed;
+		}
+		SwapLocalMembers(pos, localmembers.size() - 1);
+		localmembers.pop_back();
+	}
+
 	memb->cull();
 	memb->~Membership();
 	userlist.erase(membiter);
@@ -113,6 +138,25 @@ void Channel::DelUser(const MemberMap::iterator& membiter)
 	CheckDestroy();
 }
 
+void Channel::SwapLocalMembers(size_t first, size_t second)
+{
+	std::swap(localmembers[first], localmembers[second]);
+	localmembers[first]->localpos = first;
+	localmembers[second]->localpos = second;
+}
+
+void Channel::UpdateLocalMember(Membership* memb)
+{
+	const bool prefixed = (memb->localpos < localprefixed);
+	if (prefixed == !memb->modes.empty())
+		return;
+
+	if (prefixed)
+		SwapLocalMembers(memb->localpos, --localprefixed);
+	else
+		SwapLocalMembers(memb->localpos, localprefixed++);
+}
+
 Membership* Channel::GetUser(User* user)
 {
 	MemberMap::iterator i = userlist.find(user);
@@ -273,6 +317,9 @@ Membership* Channel::ForceJoin(User* user, const std::string* privs, bool bursti
 
 	user->chans.push_front(memb);
 
+	// Bans can match the other channels a user is on
+	user->InvalidateBanCache();
+
 	if (privs)
 	{
 		// If the user was granted prefix modes (in the OnUserPreJoin hook, or they're a
@@ -300,56 +347,141 @@ Membership* Channel::ForceJoin(User* user, const std::string* privs, bool bursti
 	return memb;
 }
 
-bool Channel::IsBanned(User* user)
+Channel::CompiledBan::CompiledBan(const std::string& banmask)
+	: mask(banmask)
+	, type(0)
+	, hostmask(false)
+	, cidr(false)
 {
-	ModResult result;
-	FIRST_MOD_RESULT(OnCheckChannelBan, result, (user, this));
+	if ((mask.length() > 2) && (mask[1] == ':'))
+	{
+		type = mask[0];
+		value.assign(mask, 2, std::string::npos);
+	}
 
-	if (result != MOD_RES_PASSTHRU)
-		return (result == MOD_RES_DENY);
+	// Extbans can only match in the core if they have a nick!ident@host value
+	const std::string& matchmask = type ? value : mask;
+	if ((matchmask.length() <= 2) || (matchmask[1] == ':'))
+		return;
 
-	ListModeBase* banlm = static_cast<ListModeBase*>(*ban);
-	if (!banlm)
-		return false;
+	std::string::size_type at = matchmask.find('@');
+	if (at == std::string::npos)
+		return;
+
+	hostmask = true;
+	nickident = irc::wildcard_mask(matchmask.substr(0, at));
+	host = irc::wildcard_mask(matchmask.substr(at + 1));
+	cidr = (host.str().find('/') != std::string::npos);
+}
+
+const std::vector<Channel::CompiledBan>& Channel::GetCompiledBans()
+{
+	if (compiledserial == banserial)
+		return compiledbans;
+
+	compiledbans.clear();
+	compiledserial = banserial;
 
-	const ListModeBase::ModeList* bans = banlm->GetList(this);
+	ListModeBase* banlm = static_cast<ListModeBase*>(*ban);
+	const ListModeBase::ModeList* bans = banlm ? banlm->GetList(this) : NULL;
 	if (bans)
 	{
-		for (ListModeBase::ModeList::const_iterator it = bans->begin(); it != bans->end(); it++)
+		compiledbans.reserve(bans->size());
+		for (ListModeBase::ModeList::const_iterator it = bans->begin(); it != bans->end(); ++it)
+			compiledbans.push_back(CompiledBan(it->mask));
+	}
+	return compiledbans;
+}
+
+bool Channel::MatchBanList(User* user, char type)
+{
+	// Bit 0 is for normal bans and each extban type from 'A' to 'z' has its own bit
+	// after that. Any other extban type is too unusual to be worth caching.
+	uint64_t bit = 0;
+	if (!type)
+		bit = 1;
+	else if ((type >= 'A') && (type <= 'z'))
+		bit = uint64_t(1) << (type - 'A' + 1);
+
+	Membership* memb = bit ? GetUser(user) : NULL;
+	if (memb)
+	{
+		if (memb->banserial != banserial)
 		{
-			if (CheckBan(user, it->mask))
-				return true;
+			memb->banserial = banserial;
+			memb->bancached = 0;
 		}
+
+		if (memb->bancached & bit)
+			return (memb->banmatched & bit);
 	}
-	return false;
+
+	bool matched = false;
+	std::string nickident;
+	const std::vector<CompiledBan>& bans = GetCompiledBans();
+	for (std::vector<CompiledBan>::const_iterator it = bans.begin(); it != bans.end(); ++it)
+	{
+		if (type && it->type != type)
+			continue;
+
+		if (CheckBan(user, *it, (type != 0), nickident))
+		{
+			matched = true;
+			break;
+		}
+	}
+
+	if (memb)
+	{
+		memb->bancached |= bit;
+		if (matched)
+			memb->banmatched |= bit;
+		else
+			memb->banmatched &= ~bit;
+	}
+	return matched;
+}
+
+bool Channel::IsBanned(User* user)
+{
+	ModResult result;
+	FIRST_MOD_RESULT(OnCheckChannelBan, result, (user, this));
+
+	if (result != MOD_RES_PASSTHRU)
+		return (result == MOD_RES_DENY);
+
+	return MatchBanList(user, 0);
 }
 
 bool Channel::CheckBan(User* user, const std::string& mask)
+{
+	std::string nickident;
+	return CheckBan(user, CompiledBan(mask), false, nickident);
+}
+
+bool Channel::CheckBan(User* user, const CompiledBan& ban, bool extban, std::string& nickident)
 {
 	ModResult result;
-	FIRST_MOD_RESULT(OnCheckBan, result, (user, this, mask));
+	FIRST_MOD_RESULT(OnCheckBan, result, (user, this, (extban ? ban.value : ban.mask)));
 	if (result != MOD_RES_PASSTHRU)
 		return (result == MOD_RES_DENY);
 
 	// extbans were handled above, if this is one it obviously didn't match
-	if ((mask.length() <= 2) || (mask[1] == ':'))
+	if (!ban.hostmask || (ban.type && !extban))
 		return false;
 
-	std::string::size_type at = mask.find('@');
-	if (at == std::string::npos)
+	if (nickident.empty())
+		nickident = user->nick + "!" + user->ident;
+
+	if (!ban.nickident.Match(nickident))
 		return false;
 
-	const std::string nickIdent = user->nick + "!" + user->ident;
-	std::string prefix(mask, 0, at);
-	if (InspIRCd::Match(nickIdent, prefix, NULL))
-	{
-		std::string suffix(mask, at + 1);
-		if (InspIRCd::Match(user->GetRealHost(), suffix, NULL) ||
-			InspIRCd::Match(user->GetDisplayedHost(), suffix, NULL) ||
-			InspIRCd::MatchCIDR(user->GetIPString(), suffix, NULL))
-			return true;
-	}
-	return false;
+	if (ban.host.Match(user->GetRealHost()) || ban.host.Match(user->GetDisplayedHost()))
+		return true;
+
+	if (ban.cidr)
+		return irc::sockets::MatchCIDR(user->GetIPString(), ban.host.str(), true);
+	return ban.host.Match(user->GetIPString());
 }
 
 ModResult Channel::GetExtBanStatus(User *user, char type)
@@ -359,23 +491,7 @@ ModResult Channel::GetExtBanStatus(User *user, char type)
 	if (rv != MOD_RES_PASSTHRU)
 		return rv;
 
-	ListModeBase* banlm = static_cast<ListModeBase*>(*ban);
-	if (!banlm)
-		return MOD_RES_PASSTHRU;
-
-	const ListModeBase::ModeList* bans = banlm->GetList(this);
-	if (bans)
-	{
-		for (ListModeBase::ModeList::const_iterator it = bans->begin(); it != bans->end(); ++it)
-		{
-			if (it->mask.length() <= 2 || it->mask[0] != type || it->mask[1] != ':')
-				continue;
-
-			if (CheckBan(user, it->mask.substr(2)))
-				return MOD_RES_DENY;
-		}
-	}
-	return MOD_RES_PASSTHRU;
+	return MatchBanList(user, type) ? MOD_RES_DENY : MOD_RES_PASSTHRU;
 }
 
 /* Channel::PartUser
@@ -426,17 +542,22 @@ void Channel::Write(ClientProtocol::Event& protoev, char status, const CUList& e
 		if (mh)
 			minrank = mh->GetPrefixRank();
 	}
-	for (MemberMap::iterator i = userlist.begin(); i != userlist.end(); i++)
+
+	// Members without a prefix mode can never have the status we're after so only
+	// look at the prefixed part of the local member list if a status was given.
+	const size_t count = (minrank ? localprefixed : localmembers.size());
+	for (size_t i = 0; i < count; ++i)
 	{
-		LocalUser* user = IS_LOCAL(i->first);
-		if ((user) && (!except_list.count(user)))
-		{
-			/* User doesn't have the status we're after */
-			if (minrank && i->second->getRank() < minrank)
-				continue;
+		Membership* memb = localmembers[i];
+		LocalUser* user = static_cast<LocalUser*>(memb->user);
+		if (except_list.count(user))
+			continue;
 
-			user->Send(protoev);
-		}
+		/* User doesn't have the status we're after */
+		if (minrank && memb->getRank() < minrank)
+			continue;
+
+		user->Send(protoev);
 	}
 }
 
@@ -545,6 +666,8 @@ unsigned int Channel::GetPrefixValue(User* user)
 bool Membership::SetPrefix(PrefixMode* delta_mh, bool adding)
 {
 	char prefix = delta_mh->GetModeChar();
+	bool changed = adding;
+	bool found = false;
 	for (unsigned int i = 0; i < modes.length(); i++)
 	{
 		char mchar = modes[i];
@@ -554,12 +677,22 @@ bool Membership::SetPrefix(PrefixMode* delta_mh, bool adding)
 			modes = modes.substr(0,i) +
 				(adding ? std::string(1, prefix) : "") +
 				modes.substr(mchar == prefix ? i+1 : i);
-			return adding != (mchar == prefix);
+			changed = adding != (mchar == prefix);
+			found = true;
+			break;
 		}
 	}
-	if (adding)
+	if (!found && adding)
 		modes.push_back(prefix);
-	return adding;
+
+	if (changed)
+	{
+		// Bans can match the prefix modes a user has on other channels
+		user->InvalidateBanCache();
+		if (IS_LOCAL(user))
+			chan->UpdateLocalMember(this);
+	}
+	return changed;
 }
 
 
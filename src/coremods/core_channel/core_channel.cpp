@@ -124,6 +124,15 @@ class CoreModChannel : public Module, public CheckExemption::EventListener
 		return MOD_RES_PASSTHRU;
 	}
 
+	static void InvalidateBanCaches()
+	{
+		// Modules can match bans against anything so when they or their config change
+		// every cached ban check result might be wrong.
+		const chan_hash& chans = ServerInstance->GetChans();
+		for (chan_hash::const_iterator i = chans.begin(); i != chans.end(); ++i)
+			i->second->InvalidateBanCache();
+	}
+
  public:
 	CoreModChannel()
 		: CheckExemption::EventListener(this, UINT_MAX)
@@ -203,6 +212,18 @@ class CoreModChannel : public Module, public CheckExemption::EventListener
 			for (unsigned int i = 0; i < sizeof(events)/sizeof(Implementation); i++)
 				ServerInstance->Modules.Detach(events[i], this);
 		}
+
+		InvalidateBanCaches();
+	}
+
+	void OnLoadModule(Module* mod) CXX11_OVERRIDE
+	{
+		InvalidateBanCaches();
+	}
+
+	void OnUnloadModule(Module* mod) CXX11_OVERRIDE
+	{
+		InvalidateBanCaches();
 	}
 
 	void On005Numeric(std::map<std::string, std::string>& tokens) CXX11_OVERRIDE
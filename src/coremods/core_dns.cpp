@@ -21,6 +21,7 @@
 
 #include "inspircd.h"
 #include "modules/dns.h"
+#include "modules/stats.h"
 #include <iostream>
 #include <fstream>
 
@@ -197,6 +198,17 @@ class Packet : public Query
 
 				break;
 			}
+			case QUERY_SOA:
+			{
+				// Only the minimum TTL at the end is needed. It limits how long a negative answer can be cached (RFC 2308 section 5).
+				if (pos + rdlength > input_size || rdlength < 22)
+					throw Exception("Unable to unpack soa resource record");
+
+				pos += rdlength;
+				const unsigned int minimum = (input[pos - 4] << 24) | (input[pos - 3] << 16) | (input[pos - 2] << 8) | input[pos - 1];
+				record.ttl = std::min(record.ttl, minimum);
+				break;
+			}
 			case QUERY_TXT:
 			{
 				if (pos + rdlength > input_size)
@@ -235,8 +247,10 @@ class Packet : public Query
 	RequestId id;
 	/* Flags on the packet */
 	unsigned short flags;
+	/* How long a negative answer can be cached for or 0 if there was no SOA record in the authority section */
+	unsigned int negativettl;
 
-	Packet() : id(0), flags(0)
+	Packet() : id(0), flags(0), negativettl(0)
 	{
 	}
 
@@ -274,6 +288,22 @@ class Packet : public Query
 
 		for (unsigned i = 0; i < ancount; ++i)
 			this->answers.push_back(this->UnpackResourceRecord(input, len, packet_pos));
+
+		// The authority section is only used for negative caching so a broken one is not fatal.
+		try
+		{
+			for (unsigned i = 0; i < nscount; ++i)
+			{
+				const ResourceRecord record = this->UnpackResourceRecord(input, len, packet_pos);
+				if (record.type == QUERY_SOA)
+					this->negativettl = record.ttl;
+			}
+		}
+		catch (Exception& ex)
+		{
+			ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "Ignoring authority section: " + ex.GetReason());
+			this->negativettl = 0;
+		}
 	}
 
 	unsigned short Pack(unsigned char* output, unsigned short output_size)
@@ -348,22 +378,382 @@ class Packet : public Query
 	}
 };
 
-class MyManager : public Manager, public Timer, public EventHandler
+class MyManager;
+
+/** A nameserver which queries are sent to. Each nameserver has its own socket and its own table of request ids.
+ */
+class Nameserver : public EventHandler
+{
+	MyManager* const manager;
+
+ public:
+	/** The number of failures in a row after which a nameserver is only asked if no other nameserver can be. */
+	static const unsigned int MAX_FAILURES = 3;
+
+	/** How long a nameserver which has failed too many times is avoided for. */
+	static const time_t DOWN_TIME = 30;
+
+	/** How long to wait for the answer to a query which another nameserver answered first in milliseconds. */
+	static const unsigned long STRAGGLER_TIME = 5000;
+
+	/** The address of the nameserver. */
+	const irc::sockets::sockaddrs address;
+
+	/** The requests which are waiting for an answer from this nameserver, by the id they were sent with. */
+	DNS::Request* requests[MAX_REQUEST_ID+1];
+
+	/** Queries which another nameserver answered first, by id, with the time they were sent in milliseconds.
+	 * Their answers are still waited for so that the round trip time is measured and a nameserver which
+	 * never answers is noticed.
+	 */
+	typedef std::map<RequestId, uint64_t> straggler_map;
+	straggler_map stragglers;
+
+	/** The smoothed round trip time in milliseconds or 0 if the nameserver has not answered yet. */
+	unsigned long rtt;
+
+	/** The number of times in a row the nameserver has failed to answer. */
+	unsigned int failures;
+
+	/** The time at which the nameserver last failed to answer. */
+	time_t lastfailure;
+
+	/** The number of queries which have been sent to the nameserver. */
+	unsigned long queries;
+
+	/** The number of answers which have been received from the nameserver. */
+	unsigned long answers;
+
+	/** The number of times the nameserver has failed to answer. */
+	unsigned long totalfailures;
+
+	Nameserver(MyManager* mgr, const irc::sockets::sockaddrs& addr)
+		: manager(mgr)
+		, address(addr)
+		, rtt(0)
+		, failures(0)
+		, lastfailure(0)
+		, queries(0)
+		, answers(0)
+		, totalfailures(0)
+	{
+		for (unsigned int i = 0; i <= MAX_REQUEST_ID; ++i)
+			requests[i] = NULL;
+	}
+
+	~Nameserver()
+	{
+		if (HasFd())
+		{
+			SocketEngine::Shutdown(this, 2);
+			SocketEngine::Close(this);
+		}
+	}
+
+	/** Create the socket which queries are sent from.
+	 * @param sourceaddr The address to send queries from or an empty string to let the system choose.
+	 * @param sourceport The port to send queries from or 0 to let the system choose.
+	 * @return True if the socket was created, false otherwise.
+	 */
+	bool Open(std::string sourceaddr, unsigned int sourceport)
+	{
+		int s = socket(address.family(), SOCK_DGRAM, 0);
+		this->SetFd(s);
+
+		/* Have we got a socket? */
+		if (!this->HasFd())
+		{
+			ServerInstance->Logs->Log(MODNAME, LOG_SPARSE, "Error creating DNS socket for %s", address.str().c_str());
+			return false;
+		}
+
+		SocketEngine::SetReuse(s);
+		SocketEngine::NonBlocking(s);
+
+#ifdef SO_REUSEPORT
+		// The BSDs only allow several sockets to be bound to the same port with this.
+		if (sourceport)
+		{
+			int on = 1;
+			setsockopt(s, SOL_SOCKET, SO_REUSEPORT, reinterpret_cast<char*>(&on), sizeof(on));
+		}
+#endif
+
+		irc::sockets::sockaddrs bindto;
+		if (sourceaddr.empty())
+		{
+			// set a sourceaddr for irc::sockets::aptosa() based on the servers af type
+			if (address.family() == AF_INET)
+				sourceaddr = "0.0.0.0";
+			else if (address.family() == AF_INET6)
+				sourceaddr = "::";
+		}
+		irc::sockets::aptosa(sourceaddr, sourceport, bindto);
+
+		if (bindto.family() != address.family())
+			ServerInstance->Logs->Log(MODNAME, LOG_SPARSE, "Nameserver %s address family differs from source address family - hostnames might not resolve", address.str().c_str());
+
+		// The socket is connected so that when several nameservers share a source port each answer is read from the right socket.
+		if (SocketEngine::Bind(this->GetFd(), bindto) < 0 || SocketEngine::Connect(this, address) < 0)
+		{
+			/* Failed to bind */
+			ServerInstance->Logs->Log(MODNAME, LOG_SPARSE, "Error binding dns socket for %s", address.str().c_str());
+			SocketEngine::Close(this->GetFd());
+			this->SetFd(-1);
+			return false;
+		}
+
+		if (!SocketEngine::AddFd(this, FD_WANT_POLL_READ | FD_WANT_NO_WRITE))
+		{
+			ServerInstance->Logs->Log(MODNAME, LOG_SPARSE, "Internal error starting DNS for %s", address.str().c_str());
+			SocketEngine::Close(this->GetFd());
+			this->SetFd(-1);
+			return false;
+		}
+
+		return true;
+	}
+
+	/** Find an id which is not being used by another request sent to this nameserver.
+	 * @return The id or -1 if all ids are in use.
+	 */
+	int AllocateId()
+	{
+		unsigned int tries = 0;
+		int id;
+		do
+		{
+			id = ServerInstance->GenRandomInt(DNS::MAX_REQUEST_ID+1);
+
+			if (++tries == DNS::MAX_REQUEST_ID*5)
+			{
+				// If we couldn't find an empty slot this many times, do a sequential scan as a last
+				// resort. If an empty slot is found that way, go on, otherwise give up
+				for (unsigned int i = 0; i <= DNS::MAX_REQUEST_ID; i++)
+				{
+					if (!this->requests[i] && !this->stragglers.count(i))
+						return i;
+				}
+
+				return -1;
+			}
+		}
+		while (this->requests[id] || this->stragglers.count(id));
+
+		return id;
+	}
+
+	/** Determines whether the nameserver has failed so often recently that it should be avoided. */
+	bool IsDown() const
+	{
+		return failures >= MAX_FAILURES && lastfailure + DOWN_TIME > ServerInstance->Time();
+	}
+
+	/** Update the round trip time with the time it took to receive an answer.
+	 * @param sample The round trip time of the answer in milliseconds.
+	 */
+	void AddSample(unsigned long sample)
+	{
+		// This is the same smoothing as TCP uses (RFC 6298 section 2).
+		if (!answers)
+			rtt = sample;
+		else
+			rtt = (7 * rtt + sample) / 8;
+	}
+
+	/** Update the round trip time with the time which an answer is known to take at least.
+	 * @param sample The time in milliseconds which has passed without an answer.
+	 */
+	void AddLateSample(unsigned long sample)
+	{
+		if (sample > rtt)
+			rtt = (7 * rtt + sample) / 8;
+	}
+
+	/** Stop waiting for the answers to queries which another nameserver answered first and which have taken too long.
+	 * @param now The current time in milliseconds.
+	 */
+	void ExpireStragglers(uint64_t now)
+	{
+		for (straggler_map::iterator i = stragglers.begin(); i != stragglers.end(); )
+		{
+			const unsigned long elapsed = now - i->second;
+			if (elapsed >= STRAGGLER_TIME)
+			{
+				OnFailure();
+				AddLateSample(elapsed);
+				stragglers.erase(i++);
+			}
+			else
+				++i;
+		}
+	}
+
+	/** Called when the nameserver fails to answer a query. */
+	void OnFailure()
+	{
+		failures++;
+		totalfailures++;
+		lastfailure = ServerInstance->Time();
+	}
+
+	void OnEventHandlerError(int errcode) CXX11_OVERRIDE
+	{
+		ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "UDP socket for %s got an error event", address.str().c_str());
+	}
+
+	void OnEventHandlerRead() CXX11_OVERRIDE;
+};
+
+/** Asks another nameserver when a query has not been answered in time.
+ */
+class RetryTimer : public Timer
+{
+	MyManager& manager;
+
+ public:
+	RetryTimer(MyManager& mgr)
+		: Timer(1, true)
+		, manager(mgr)
+	{
+		ServerInstance->Timers.AddTimer(this);
+	}
+
+	bool Tick(time_t now) CXX11_OVERRIDE;
+};
+
+class MyManager : public Manager, public Timer
 {
-	typedef TR1NS::unordered_map<Question, Query, Question::hash> cache_map;
+ public:
+	/** Statistics about the DNS cache. */
+	struct CacheStats
+	{
+		/** The number of requests which were answered from the cache. */
+		unsigned long hits;
+
+		/** The number of requests which could not be answered from the cache. */
+		unsigned long misses;
+
+		/** The number of entries which were removed to make room for new ones. */
+		unsigned long evictions;
+
+		/** The number of requests which waited for the answer to a question that was already being asked. */
+		unsigned long shared;
+
+		CacheStats() : hits(0), misses(0), evictions(0), shared(0) { }
+	};
+
+	typedef std::vector<Nameserver*> server_list;
+
+ private:
+	/** Questions in the cache, most recently used first. */
+	typedef std::list<Question> cache_list;
+
+	/** A cached answer to a question. */
+	struct CacheEntry
+	{
+		/** The answer, which has an error set if the question is known to have no answer. */
+		Query query;
+
+		/** The time at which the answer expires. */
+		time_t expires;
+
+		/** The position of the question in the usage list. */
+		cache_list::iterator position;
+	};
+
+	typedef TR1NS::unordered_map<Question, CacheEntry, Question::hash> cache_map;
 	cache_map cache;
+	cache_list cacheusage;
+
+	/** A query which is waiting for an answer from a nameserver. */
+	struct PendingQuery
+	{
+		/** The nameserver the query was sent to. */
+		Nameserver* server;
+
+		/** The id the query was sent with. */
+		RequestId id;
+
+		/** The time at which the query was sent in milliseconds. */
+		uint64_t sent;
+
+		/** Whether the nameserver has already been blamed for not answering in time. */
+		bool late;
+	};
+
+	/** A request which has been sent to one or more nameservers. */
+	struct Attempt
+	{
+		/** The packed query, which gets the id used with each nameserver written to it. */
+		std::string packet;
+
+		/** The nameservers which have been asked and have not answered yet. */
+		std::vector<PendingQuery> pending;
+
+		/** Every nameserver which has been asked. */
+		server_list tried;
+
+		/** The time at which another nameserver is asked if none of them have answered. */
+		time_t retry;
+
+		Attempt() : retry(0) { }
+	};
+
+	/** Requests which have been sent to nameservers. */
+	typedef TR1NS::unordered_map<DNS::Request*, Attempt> attempt_map;
+	attempt_map attempts;
+
+	/** Requests whose question other requests can wait for the answer to. */
+	typedef TR1NS::unordered_map<Question, DNS::Request*, Question::hash> inflight_map;
+	inflight_map inflight;
+
+	/** Requests which are waiting for the answer to a question which has already been asked, by the question. */
+	typedef TR1NS::unordered_map<Question, std::vector<DNS::Request*>, Question::hash> waiting_map;
+	waiting_map waiting;
 
-	irc::sockets::sockaddrs myserver;
+	/** The nameservers which queries can be sent to. */
+	server_list servers;
+
+	/** The number of nameservers which each query is sent to at once. */
+	size_t parallel;
+
+	RetryTimer retrytimer;
 	bool unloading;
 
 	/** Maximum number of entries in cache
 	 */
-	static const unsigned int MAX_CACHE_SIZE = 1000;
+	size_t maxcachesize;
+
+	/** Maximum time to cache an answer for
+	 */
+	static const unsigned int MAX_CACHE_TTL = 5*60;
+
+	/** How long to wait for an answer before asking another nameserver
+	 */
+	static const time_t RETRY_INTERVAL = 1;
+
+	CacheStats cachestats;
 
-	static bool IsExpired(const Query& record, time_t now = ServerInstance->Time())
+	/** Retrieves the current time in milliseconds. */
+	static uint64_t GetTimeMS()
 	{
-		const ResourceRecord& req = record.answers[0];
-		return (req.created + static_cast<time_t>(req.ttl) < now);
+		return static_cast<uint64_t>(ServerInstance->Time()) * 1000 + ServerInstance->Time_ns() / 1000000;
+	}
+
+	/** Orders nameservers which have not been failing before those which have, then by round trip time. */
+	static bool CompareServers(const Nameserver* one, const Nameserver* two)
+	{
+		const bool onedown = one->IsDown();
+		if (onedown != two->IsDown())
+			return !onedown;
+		return one->rtt < two->rtt;
+	}
+
+	void RemoveCache(cache_map::iterator it)
+	{
+		cacheusage.erase(it->second.position);
+		cache.erase(it);
 	}
 
 	/** Check the DNS cache to see if request can be handled by a cached result
@@ -375,29 +765,80 @@ class MyManager : public Manager, public Timer, public EventHandler
 
 		cache_map::iterator it = this->cache.find(question);
 		if (it == this->cache.end())
+		{
+			cachestats.misses++;
 			return false;
+		}
 
-		Query& record = it->second;
-		if (IsExpired(record))
+		CacheEntry& entry = it->second;
+		if (entry.expires < ServerInstance->Time())
 		{
-			this->cache.erase(it);
+			RemoveCache(it);
+			cachestats.misses++;
 			return false;
 		}
 
+		// Move the question to the front of the usage list.
+		cacheusage.splice(cacheusage.begin(), cacheusage, entry.position);
+		cachestats.hits++;
+
 		ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "cache: Using cached result for " + question.name);
+		Query& record = entry.query;
 		record.cached = true;
-		req->OnLookupComplete(&record);
+		if (record.error != ERROR_NONE)
+			req->OnError(&record);
+		else
+			req->OnLookupComplete(&record);
 		return true;
 	}
 
-	/** Add a record to the dns cache
-	 * @param r The record
+	/** Add an answer to the dns cache, removing the least recently used answer if the cache is full
+	 * @param r The answer
+	 * @param ttl How long to cache the answer for
 	 */
-	void AddCache(Query& r)
+	void AddCache(const Query& r, unsigned int ttl)
 	{
-		if (cache.size() >= MAX_CACHE_SIZE)
-			cache.clear();
+		if (!maxcachesize)
+			return;
+
+		if (ttl > MAX_CACHE_TTL)
+			ttl = MAX_CACHE_TTL;
+
+		cache_map::iterator it = this->cache.find(r.question);
+		if (it != this->cache.end())
+			RemoveCache(it);
+
+		while (cache.size() >= maxcachesize)
+		{
+			// Expired answers are removed when they are looked up and by Tick() so this is usually one which is still valid.
+			RemoveCache(this->cache.find(cacheusage.back()));
+			cachestats.evictions++;
+		}
+
+		cacheusage.push_front(r.question);
+		CacheEntry& entry = this->cache[r.question];
+		entry.query = r;
+		entry.expires = ServerInstance->Time() + ttl;
+		entry.position = cacheusage.begin();
+
+		if (!entry.query.answers.empty())
+		{
+			ResourceRecord& rr = entry.query.answers.front();
+			// Set TTL to what we've determined to be the lowest
+			rr.ttl = ttl;
+			ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "cache: added cache for " + rr.name + " -> " + rr.rdata + " ttl: " + ConvToStr(rr.ttl));
+		}
+		else
+		{
+			ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "cache: added negative cache for " + r.question.name + " ttl: " + ConvToStr(ttl));
+		}
+	}
 
+	/** Add a successful answer to the dns cache
+	 * @param r The answer
+	 */
+	void AddCache(const Query& r)
+	{
 		// Determine the lowest TTL value and use that as the TTL of the cache entry
 		unsigned int cachettl = UINT_MAX;
 		for (std::vector<ResourceRecord>::const_iterator i = r.answers.begin(); i != r.answers.end(); ++i)
@@ -407,22 +848,129 @@ class MyManager : public Manager, public Timer, public EventHandler
 				cachettl = rr.ttl;
 		}
 
-		cachettl = std::min(cachettl, (unsigned int)5*60);
-		ResourceRecord& rr = r.answers.front();
-		// Set TTL to what we've determined to be the lowest
-		rr.ttl = cachettl;
-		ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "cache: added cache for " + rr.name + " -> " + rr.rdata + " ttl: " + ConvToStr(rr.ttl));
-		this->cache[r.question] = r;
+		AddCache(r, cachettl);
 	}
 
- public:
-	DNS::Request* requests[MAX_REQUEST_ID+1];
+	/** Send a request to nameservers which have not been asked yet, fastest first.
+	 * @param req The request to send.
+	 * @param attempt The nameservers the request has already been sent to.
+	 * @param count The number of nameservers to send the request to.
+	 * @return The number of nameservers the request was sent to.
+	 */
+	size_t Send(DNS::Request* req, Attempt& attempt, size_t count)
+	{
+		server_list candidates;
+		for (server_list::const_iterator i = servers.begin(); i != servers.end(); ++i)
+		{
+			if (!stdalgo::isin(attempt.tried, *i))
+				candidates.push_back(*i);
+		}
+		std::stable_sort(candidates.begin(), candidates.end(), CompareServers);
+
+		size_t sent = 0;
+		for (server_list::const_iterator i = candidates.begin(); i != candidates.end() && sent < count; ++i)
+		{
+			Nameserver* server = *i;
+			attempt.tried.push_back(server);
+
+			int id = server->AllocateId();
+			if (id == -1)
+			{
+				ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "All ids are in use for nameserver %s", server->address.str().c_str());
+				continue;
+			}
+
+			attempt.packet[0] = id >> 8;
+			attempt.packet[1] = id & 0xFF;
+			// The socket is connected so the address must not be given again (this fails with EISCONN on the BSDs).
+			if (SocketEngine::Send(server, attempt.packet.data(), attempt.packet.length(), 0) != static_cast<int>(attempt.packet.length()))
+			{
+				ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "Unable to send query to nameserver %s", server->address.str().c_str());
+				server->OnFailure();
+				continue;
+			}
+
+			ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "Sent request to lookup " + req->question.name + " to " + server->address.str() + " with id " + ConvToStr(id));
+
+			req->id = id;
+			server->requests[id] = req;
+			server->queries++;
+
+			PendingQuery query;
+			query.server = server;
+			query.id = id;
+			query.sent = GetTimeMS();
+			query.late = false;
+			attempt.pending.push_back(query);
+			sent++;
+		}
+
+		attempt.retry = ServerInstance->Time() + RETRY_INTERVAL;
+		return sent;
+	}
+
+	/** Works out the error which an answer gives.
+	 * @param packet The answer.
+	 * @param valid Whether the answer could be parsed.
+	 * @return The error or ERROR_NONE if the answer was successful.
+	 */
+	static Error GetError(const Packet& packet, bool valid)
+	{
+		if (!valid)
+			return ERROR_MALFORMED;
+
+		if (packet.flags & QUERYFLAGS_OPCODE)
+		{
+			ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "Received a nonstandard query");
+			return ERROR_NONSTANDARD_QUERY;
+		}
+
+		if (!(packet.flags & QUERYFLAGS_QR) || (packet.flags & QUERYFLAGS_RCODE))
+		{
+			switch (packet.flags & QUERYFLAGS_RCODE)
+			{
+				case 1:
+					ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "format error");
+					return ERROR_FORMAT_ERROR;
+				case 2:
+					ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "server error");
+					return ERROR_SERVER_FAILURE;
+				case 3:
+					ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "domain not found");
+					return ERROR_DOMAIN_NOT_FOUND;
+				case 4:
+					ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "not implemented");
+					return ERROR_NOT_IMPLEMENTED;
+				case 5:
+					ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "refused");
+					return ERROR_REFUSED;
+				default:
+					return ERROR_UNKNOWN;
+			}
+		}
+
+		if (packet.answers.empty())
+		{
+			ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "No resource records returned");
+			return ERROR_NO_RECORDS;
+		}
+
+		return ERROR_NONE;
+	}
+
+	/** Determines whether an error means that another nameserver might be able to answer the question. */
+	static bool IsNameserverFailure(Error error)
+	{
+		return error != ERROR_NONE && error != ERROR_DOMAIN_NOT_FOUND && error != ERROR_NO_RECORDS;
+	}
 
+ public:
 	MyManager(Module* c) : Manager(c), Timer(5*60, true)
+		, parallel(2)
+		, retrytimer(*this)
 		, unloading(false)
+		, maxcachesize(1000)
 	{
-		for (unsigned int i = 0; i <= MAX_REQUEST_ID; ++i)
-			requests[i] = NULL;
 		ServerInstance->Timers.AddTimer(this);
 	}
 
@@ -432,14 +980,39 @@ class MyManager : public Manager, public Timer, public EventHandler
 		Close();
 		unloading = true;
 
-		for (unsigned int i = 0; i <= MAX_REQUEST_ID; ++i)
+		FailRequests(NULL, ERROR_UNKNOWN);
+	}
+
+	/** Fail the requests which were made by a module.
+	 * @param mod The module to fail the requests of or NULL to fail every request.
+	 * @param error The error to fail the requests with.
+	 */
+	void FailRequests(Module* mod, Error error)
+	{
+		std::vector<DNS::Request*> failed;
+		for (attempt_map::const_iterator i = attempts.begin(); i != attempts.end(); ++i)
 		{
-			DNS::Request* request = requests[i];
-			if (!request)
-				continue;
+			DNS::Request* request = i->first;
+			if (!mod || request->creator == mod)
+				failed.push_back(request);
+		}
+
+		for (waiting_map::const_iterator i = waiting.begin(); i != waiting.end(); ++i)
+		{
+			for (std::vector<DNS::Request*>::const_iterator j = i->second.begin(); j != i->second.end(); ++j)
+			{
+				DNS::Request* request = *j;
+				if (!mod || request->creator == mod)
+					failed.push_back(request);
+			}
+		}
+
+		for (std::vector<DNS::Request*>::const_iterator i = failed.begin(); i != failed.end(); ++i)
+		{
+			DNS::Request* request = *i;
 
 			Query rr(request->question);
-			rr.error = ERROR_UNKNOWN;
+			rr.error = error;
 			request->OnError(&rr);
 
 			delete request;
@@ -448,23 +1021,53 @@ class MyManager : public Manager, public Timer, public EventHandler
 
 	void Close()
 	{
-		// Shutdown the socket if it exists.
-		if (HasFd())
+		// Requests which were sent to the nameservers being removed are sent to the new ones by Retry().
+		for (attempt_map::iterator i = attempts.begin(); i != attempts.end(); ++i)
 		{
-			SocketEngine::Shutdown(this, 2);
-			SocketEngine::Close(this);
+			Attempt& attempt = i->second;
+			attempt.pending.clear();
+			attempt.tried.clear();
+			attempt.retry = 0;
 		}
 
+		stdalgo::delete_all(servers);
+		servers.clear();
+
 		// Remove all entries from the cache.
 		cache.clear();
+		cacheusage.clear();
 	}
 
+	/** Set the maximum number of entries in the cache, removing the least recently used ones if there are more.
+	 * @param max The maximum number of entries or 0 to disable the cache.
+	 */
+	void SetCacheSize(size_t max)
+	{
+		maxcachesize = max;
+		while (cache.size() > maxcachesize)
+			RemoveCache(this->cache.find(cacheusage.back()));
+	}
+
+	/** Set the number of nameservers which each query is sent to at once.
+	 * @param count The number of nameservers.
+	 */
+	void SetParallel(size_t count) { parallel = count; }
+
+	/** Retrieves the number of entries in the cache. */
+	size_t GetCacheSize() const { return cache.size(); }
+
+	/** Retrieves statistics about the cache. */
+	const CacheStats& GetCacheStats() const { return cachestats; }
+
+	/** Retrieves the nameservers which queries can be sent to. */
+	const server_list& GetServers() const { return servers; }
+
 	void Process(DNS::Request* req) CXX11_OVERRIDE
 	{
 		if ((unloading) || (req->creator->dying))
 			throw Exception("Module is being unloaded");
 
-		if (!HasFd())
+		if (servers.empty())
 		{
 			Query rr(req->question);
 			rr.error = ERROR_DISABLED;
@@ -472,43 +1075,11 @@ class MyManager : public Manager, public Timer, public EventHandler
 			return;
 		}
 
-		ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "Processing request to lookup " + req->question.name + " of type " + ConvToStr(req->question.type) + " to " + this->myserver.addr());
-
-		/* Create an id */
-		unsigned int tries = 0;
-		int id;
-		do
-		{
-			id = ServerInstance->GenRandomInt(DNS::MAX_REQUEST_ID+1);
-
-			if (++tries == DNS::MAX_REQUEST_ID*5)
-			{
-				// If we couldn't find an empty slot this many times, do a sequential scan as a last
-				// resort. If an empty slot is found that way, go on, otherwise throw an exception
-				id = -1;
-				for (unsigned int i = 0; i <= DNS::MAX_REQUEST_ID; i++)
-				{
-					if (!this->requests[i])
-					{
-						id = i;
-						break;
-					}
-				}
-
-				if (id == -1)
-					throw Exception("DNS: All ids are in use");
-
-				break;
-			}
-		}
-		while (this->requests[id]);
-
-		req->id = id;
-		this->requests[req->id] = req;
+		ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "Processing request to lookup " + req->question.name + " of type " + ConvToStr(req->question.type));
 
+		// The id is filled in for each nameserver the query is sent to.
 		Packet p;
 		p.flags = QUERYFLAGS_RD;
-		p.id = req->id;
 		p.question = req->question;
 
 		unsigned char buffer[524];
@@ -527,8 +1098,29 @@ class MyManager : public Manager, public Timer, public EventHandler
 		// Update name in the original request so question checking works for PTR queries
 		req->question.name = p.question.name;
 
-		if (SocketEngine::SendTo(this, buffer, len, 0, this->myserver) != len)
+		if (req->use_cache)
+		{
+			if (inflight.find(p.question) != inflight.end())
+			{
+				// The same question has already been asked so wait for its answer instead of asking again.
+				ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "Waiting for the answer to an earlier request for " + p.question.name);
+				waiting[p.question].push_back(req);
+				cachestats.shared++;
+				ServerInstance->Timers.AddTimer(req);
+				return;
+			}
+		}
+
+		Attempt& attempt = attempts[req];
+		attempt.packet.assign(reinterpret_cast<const char*>(buffer), len);
+		if (!Send(req, attempt, parallel))
+		{
+			attempts.erase(req);
 			throw Exception("DNS: Unable to send query");
+		}
+
+		if (req->use_cache)
+			inflight[p.question] = req;
 
 		// Add timer for timeout
 		ServerInstance->Timers.AddTimer(req);
@@ -536,8 +1128,53 @@ class MyManager : public Manager, public Timer, public EventHandler
 
 	void RemoveRequest(DNS::Request* req) CXX11_OVERRIDE
 	{
-		if (requests[req->id] == req)
-			requests[req->id] = NULL;
+		attempt_map::iterator it = attempts.find(req);
+		if (it == attempts.end())
+		{
+			// The request may have been waiting for the answer to another request.
+			waiting_map::iterator wit = waiting.find(req->question);
+			if (wit != waiting.end())
+			{
+				stdalgo::erase(wit->second, req);
+				if (wit->second.empty())
+					waiting.erase(wit);
+			}
+			return;
+		}
+
+		Attempt& attempt = it->second;
+		inflight_map::iterator iit = inflight.find(req->question);
+		if (iit != inflight.end() && iit->second == req)
+		{
+			waiting_map::iterator wit = waiting.find(req->question);
+			if (wit != waiting.end())
+			{
+				// Let a request which is waiting for the same answer take over.
+				DNS::Request* next = wit->second.front();
+				wit->second.erase(wit->second.begin());
+				if (wit->second.empty())
+					waiting.erase(wit);
+
+				for (std::vector<PendingQuery>::const_iterator i = attempt.pending.begin(); i != attempt.pending.end(); ++i)
+					i->server->requests[i->id] = next;
+
+				iit->second = next;
+				attempts[next] = attempt;
+				attempts.erase(req);
+				return;
+			}
+
+			inflight.erase(iit);
+		}
+
+		// Nameservers which have not answered yet are still listened to unless they have already been blamed for being late.
+		for (std::vector<PendingQuery>::const_iterator i = attempt.pending.begin(); i != attempt.pending.end(); ++i)
+		{
+			i->server->requests[i->id] = NULL;
+			if (!i->late)
+				i->server->stragglers[i->id] = i->sent;
+		}
+		attempts.erase(it);
 	}
 
 	std::string GetErrorStr(Error e) CXX11_OVERRIDE
@@ -589,26 +1226,24 @@ class MyManager : public Manager, public Timer, public EventHandler
 		}
 	}
 
-	void OnEventHandlerError(int errcode) CXX11_OVERRIDE
-	{
-		ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "UDP socket got an error event");
-	}
-
-	void OnEventHandlerRead() CXX11_OVERRIDE
+	/** Called when a nameserver has sent us something.
+	 * @param server The nameserver which is readable.
+	 */
+	void OnAnswer(Nameserver* server)
 	{
 		unsigned char buffer[524];
 		irc::sockets::sockaddrs from;
 		socklen_t x = sizeof(from);
 
-		int length = SocketEngine::RecvFrom(this, buffer, sizeof(buffer), 0, &from.sa, &x);
+		int length = SocketEngine::RecvFrom(server, buffer, sizeof(buffer), 0, &from.sa, &x);
 
 		if (length < Packet::HEADER_LENGTH)
 			return;
 
-		if (myserver != from)
+		if (server->address != from)
 		{
 			std::string server1 = from.str();
-			std::string server2 = myserver.str();
+			std::string server2 = server->address.str();
 			ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "Got a result from the wrong server! Bad NAT or DNS forging attempt? '%s' != '%s'",
 				server1.c_str(), server2.c_str());
 			return;
@@ -628,9 +1263,23 @@ class MyManager : public Manager, public Timer, public EventHandler
 		}
 
 		// recv_packet.id must be filled in here
-		DNS::Request* request = this->requests[recv_packet.id];
+		DNS::Request* request = server->requests[recv_packet.id];
 		if (request == NULL)
 		{
+			Nameserver::straggler_map::iterator it = server->stragglers.find(recv_packet.id);
+			if (it != server->stragglers.end())
+			{
+				ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "Received a late answer from nameserver %s", server->address.str().c_str());
+				server->AddSample(GetTimeMS() - it->second);
+				server->answers++;
+				if (IsNameserverFailure(GetError(recv_packet, valid)))
+					server->OnFailure();
+				else
+					server->failures = 0;
+				server->stragglers.erase(it);
+				return;
+			}
+
 			ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "Received an answer for something we didn't request");
 			return;
 		}
@@ -642,72 +1291,113 @@ class MyManager : public Manager, public Timer, public EventHandler
 			return;
 		}
 
-		if (!valid)
+		// The nameserver has answered so the request is no longer waiting for it.
+		server->requests[recv_packet.id] = NULL;
+		attempt_map::iterator ait = attempts.find(request);
+		if (ait == attempts.end())
+			return;
+
+		Attempt& attempt = ait->second;
+		const uint64_t now = GetTimeMS();
+		for (std::vector<PendingQuery>::iterator i = attempt.pending.begin(); i != attempt.pending.end(); ++i)
 		{
-			ServerInstance->stats.DnsBad++;
-			recv_packet.error = ERROR_MALFORMED;
-			request->OnError(&recv_packet);
+			if (i->server == server)
+			{
+				server->AddSample(now - i->sent);
+				attempt.pending.erase(i);
+				break;
+			}
 		}
-		else if (recv_packet.flags & QUERYFLAGS_OPCODE)
+		server->answers++;
+
+		recv_packet.error = GetError(recv_packet, valid);
+		if (!IsNameserverFailure(recv_packet.error))
 		{
-			ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "Received a nonstandard query");
-			ServerInstance->stats.DnsBad++;
-			recv_packet.error = ERROR_NONSTANDARD_QUERY;
-			request->OnError(&recv_packet);
+			server->failures = 0;
 		}
-		else if (!(recv_packet.flags & QUERYFLAGS_QR) || (recv_packet.flags & QUERYFLAGS_RCODE))
+		else
 		{
-			Error error = ERROR_UNKNOWN;
-
-			switch (recv_packet.flags & QUERYFLAGS_RCODE)
+			// Another nameserver may be able to answer instead.
+			server->OnFailure();
+			if (!attempt.pending.empty() || Send(request, attempt, 1))
 			{
-				case 1:
-					ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "format error");
-					error = ERROR_FORMAT_ERROR;
-					break;
-				case 2:
-					ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "server error");
-					error = ERROR_SERVER_FAILURE;
-					break;
-				case 3:
-					ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "domain not found");
-					error = ERROR_DOMAIN_NOT_FOUND;
-					break;
-				case 4:
-					ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "not implemented");
-					error = ERROR_NOT_IMPLEMENTED;
-					break;
-				case 5:
-					ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "refused");
-					error = ERROR_REFUSED;
-					break;
-				default:
-					break;
+				ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "Nameserver %s failed to answer the request to lookup %s, waiting for another nameserver",
+					server->address.str().c_str(), request->question.name.c_str());
+				return;
 			}
-
-			ServerInstance->stats.DnsBad++;
-			recv_packet.error = error;
-			request->OnError(&recv_packet);
-		}
-		else if (recv_packet.answers.empty())
-		{
-			ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "No resource records returned");
-			ServerInstance->stats.DnsBad++;
-			recv_packet.error = ERROR_NO_RECORDS;
-			request->OnError(&recv_packet);
 		}
-		else
+
+		if (recv_packet.error == ERROR_NONE)
 		{
 			ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "Lookup complete for " + request->question.name);
 			ServerInstance->stats.DnsGood++;
-			request->OnLookupComplete(&recv_packet);
-			this->AddCache(recv_packet);
 		}
+		else
+			ServerInstance->stats.DnsBad++;
 
 		ServerInstance->stats.Dns++;
 
+		// Requests which asked the same question get the same answer.
+		std::vector<DNS::Request*> answered;
+		inflight_map::iterator iit = inflight.find(request->question);
+		if (iit != inflight.end() && iit->second == request)
+		{
+			inflight.erase(iit);
+			waiting_map::iterator wit = waiting.find(request->question);
+			if (wit != waiting.end())
+			{
+				answered.swap(wit->second);
+				waiting.erase(wit);
+			}
+		}
+		answered.insert(answered.begin(), request);
+
+		// The answer is cached before anyone sees it so questions asked from the handlers below are answered from the cache.
+		if (recv_packet.error == ERROR_NONE)
+			this->AddCache(recv_packet);
+		else if ((recv_packet.error == ERROR_DOMAIN_NOT_FOUND || recv_packet.error == ERROR_NO_RECORDS) && recv_packet.negativettl)
+			this->AddCache(recv_packet, recv_packet.negativettl);
+
+		for (std::vector<DNS::Request*>::const_iterator i = answered.begin(); i != answered.end(); ++i)
+		{
+			if (recv_packet.error == ERROR_NONE)
+				(*i)->OnLookupComplete(&recv_packet);
+			else
+				(*i)->OnError(&recv_packet);
+		}
+
 		/* Request's destructor removes it from the request map */
-		delete request;
+		stdalgo::delete_all(answered);
+	}
+
+	/** Ask another nameserver for the answer to requests which have not been answered in time. */
+	void Retry(time_t now)
+	{
+		for (server_list::const_iterator i = servers.begin(); i != servers.end(); ++i)
+			(*i)->ExpireStragglers(GetTimeMS());
+
+		for (attempt_map::iterator i = attempts.begin(); i != attempts.end(); ++i)
+		{
+			Attempt& attempt = i->second;
+			if (attempt.retry > now)
+				continue;
+
+			const uint64_t ms = GetTimeMS();
+			for (std::vector<PendingQuery>::iterator j = attempt.pending.begin(); j != attempt.pending.end(); ++j)
+			{
+				if (!j->late)
+				{
+					j->late = true;
+					j->server->OnFailure();
+					j->server->AddLateSample(ms - j->sent);
+				}
+			}
+
+			// Requests which were detached from their nameservers by a rehash are sent to as many as they were before.
+			const size_t count = attempt.tried.empty() ? parallel : 1;
+			if (Send(i->first, attempt, count))
+				ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "No answer to the request to lookup " + i->first->question.name + " yet, asking another nameserver");
+		}
 	}
 
 	bool Tick(time_t now) CXX11_OVERRIDE
@@ -715,11 +1405,11 @@ class MyManager : public Manager, public Timer, public EventHandler
 		unsigned long expired = 0;
 		for (cache_map::iterator it = this->cache.begin(); it != this->cache.end(); )
 		{
-			const Query& query = it->second;
-			if (IsExpired(query, now))
+			const CacheEntry& entry = it->second;
+			if (entry.expires < now)
 			{
 				expired++;
-				this->cache.erase(it++);
+				RemoveCache(it++);
 			}
 			else
 				++it;
@@ -731,57 +1421,48 @@ class MyManager : public Manager, public Timer, public EventHandler
 		return true;
 	}
 
-	void Rehash(const std::string& dnsserver, std::string sourceaddr, unsigned int sourceport)
+	void Rehash(const std::string& dnsservers, const std::string& sourceaddr, unsigned int sourceport)
 	{
-		irc::sockets::aptosa(dnsserver, DNS::PORT, myserver);
-
-		/* Initialize mastersocket */
 		Close();
-		int s = socket(myserver.family(), SOCK_DGRAM, 0);
-		this->SetFd(s);
 
-		/* Have we got a socket? */
-		if (this->HasFd())
+		irc::spacesepstream serverstream(dnsservers);
+		for (std::string dnsserver; serverstream.GetToken(dnsserver); )
 		{
-			SocketEngine::SetReuse(s);
-			SocketEngine::NonBlocking(s);
-
-			irc::sockets::sockaddrs bindto;
-			if (sourceaddr.empty())
+			irc::sockets::sockaddrs address;
+			if (!irc::sockets::aptosa(dnsserver, DNS::PORT, address))
 			{
-				// set a sourceaddr for irc::sockets::aptosa() based on the servers af type
-				if (myserver.family() == AF_INET)
-					sourceaddr = "0.0.0.0";
-				else if (myserver.family() == AF_INET6)
-					sourceaddr = "::";
+				ServerInstance->Logs->Log(MODNAME, LOG_SPARSE, "Nameserver '%s' is not an IP address, ignoring it", dnsserver.c_str());
+				continue;
 			}
-			irc::sockets::aptosa(sourceaddr, sourceport, bindto);
 
-			if (SocketEngine::Bind(this->GetFd(), bindto) < 0)
+			Nameserver* server = new Nameserver(this, address);
+			if (!server->Open(sourceaddr, sourceport))
 			{
-				/* Failed to bind */
-				ServerInstance->Logs->Log(MODNAME, LOG_SPARSE, "Error binding dns socket - hostnames will NOT resolve");
-				SocketEngine::Close(this->GetFd());
-				this->SetFd(-1);
-			}
-			else if (!SocketEngine::AddFd(this, FD_WANT_POLL_READ | FD_WANT_NO_WRITE))
-			{
-				ServerInstance->Logs->Log(MODNAME, LOG_SPARSE, "Internal error starting DNS - hostnames will NOT resolve.");
-				SocketEngine::Close(this->GetFd());
-				this->SetFd(-1);
+				delete server;
+				continue;
 			}
-
-			if (bindto.family() != myserver.family())
-				ServerInstance->Logs->Log(MODNAME, LOG_SPARSE, "Nameserver address family differs from source address family - hostnames might not resolve");
-		}
-		else
-		{
-			ServerInstance->Logs->Log(MODNAME, LOG_SPARSE, "Error creating DNS socket - hostnames will NOT resolve");
+			servers.push_back(server);
 		}
+
+		if (servers.empty())
+			ServerInstance->Logs->Log(MODNAME, LOG_SPARSE, "No usable nameservers - hostnames will NOT resolve");
 	}
 };
 
-class ModuleDNS : public Module
+void Nameserver::OnEventHandlerRead()
+{
+	manager->OnAnswer(this);
+}
+
+bool RetryTimer::Tick(time_t now)
+{
+	manager.Retry(now);
+	return true;
+}
+
+class ModuleDNS
+	: public Module
+	, public Stats::EventListener
 {
 	MyManager manager;
 	std::string DNSServer;
@@ -809,14 +1490,21 @@ class ModuleDNS : public Module
 			if (pFixedInfo)
 			{
 				if (GetNetworkParams(pFixedInfo, &dwBufferSize) == NO_ERROR)
-					DNSServer = pFixedInfo->DnsServerList.IpAddress.String;
+				{
+					for (PIP_ADDR_STRING dnsserver = &pFixedInfo->DnsServerList; dnsserver; dnsserver = dnsserver->Next)
+					{
+						if (!DNSServer.empty())
+							DNSServer.push_back(' ');
+						DNSServer.append(dnsserver->IpAddress.String);
+					}
+				}
 
 				HeapFree(GetProcessHeap(), 0, pFixedInfo);
 			}
 
 			if (!DNSServer.empty())
 			{
-				ServerInstance->Logs->Log(MODNAME, LOG_DEFAULT, "<dns:server> set to '%s' as first active resolver in the system settings.", DNSServer.c_str());
+				ServerInstance->Logs->Log(MODNAME, LOG_DEFAULT, "<dns:server> set to '%s' from the active resolvers in the system settings.", DNSServer.c_str());
 				return;
 			}
 		}
@@ -828,26 +1516,36 @@ class ModuleDNS : public Module
 
 		std::ifstream resolv("/etc/resolv.conf");
 
-		while (resolv >> DNSServer)
+		std::string token;
+		while (resolv >> token)
 		{
-			if (DNSServer == "nameserver")
+			if (token == "nameserver")
 			{
-				resolv >> DNSServer;
-				if (DNSServer.find_first_not_of("0123456789.") == std::string::npos || DNSServer.find_first_not_of("0123456789ABCDEFabcdef:") == std::string::npos)
+				resolv >> token;
+				if (token.find_first_not_of("0123456789.") == std::string::npos || token.find_first_not_of("0123456789ABCDEFabcdef:") == std::string::npos)
 				{
-					ServerInstance->Logs->Log(MODNAME, LOG_DEFAULT, "<dns:server> set to '%s' as first resolver in /etc/resolv.conf.",DNSServer.c_str());
-					return;
+					if (!DNSServer.empty())
+						DNSServer.push_back(' ');
+					DNSServer.append(token);
 				}
 			}
 		}
 
+		if (!DNSServer.empty())
+		{
+			ServerInstance->Logs->Log(MODNAME, LOG_DEFAULT, "<dns:server> set to '%s' from the resolvers in /etc/resolv.conf.", DNSServer.c_str());
+			return;
+		}
+
 		ServerInstance->Logs->Log(MODNAME, LOG_DEFAULT, "/etc/resolv.conf contains no viable nameserver entries! Defaulting to nameserver '127.0.0.1'!");
 #endif
 		DNSServer = "127.0.0.1";
 	}
 
  public:
-	ModuleDNS() : manager(this)
+	ModuleDNS()
+		: Stats::EventListener(this)
+		, manager(this)
 		, SourcePort(0)
 	{
 	}
@@ -855,6 +1553,8 @@ class ModuleDNS : public Module
 	void ReadConfig(ConfigStatus& status) CXX11_OVERRIDE
 	{
 		ConfigTag* tag = ServerInstance->Config->ConfValue("dns");
+		this->manager.SetCacheSize(tag->getUInt("cachesize", 1000, 0, 1000000));
+		this->manager.SetParallel(tag->getUInt("parallel", 2, 1, 16));
 		if (!tag->getBool("enabled", true))
 		{
 			// Clear these so they get reset if DNS is enabled again.
@@ -884,21 +1584,26 @@ class ModuleDNS : public Module
 
 	void OnUnloadModule(Module* mod) CXX11_OVERRIDE
 	{
-		for (unsigned int i = 0; i <= MAX_REQUEST_ID; ++i)
-		{
-			DNS::Request* req = this->manager.requests[i];
-			if (!req)
-				continue;
+		this->manager.FailRequests(mod, ERROR_UNLOADED);
+	}
 
-			if (req->creator == mod)
-			{
-				Query rr(req->question);
-				rr.error = ERROR_UNLOADED;
-				req->OnError(&rr);
+	ModResult OnStats(Stats::Context& stats) CXX11_OVERRIDE
+	{
+		if (stats.GetSymbol() != 'T')
+			return MOD_RES_PASSTHRU;
 
-				delete req;
-			}
+		const MyManager::CacheStats& cachestats = this->manager.GetCacheStats();
+		stats.AddRow(249, "dns cache entries "+ConvToStr(this->manager.GetCacheSize())+" hits "+ConvToStr(cachestats.hits)+" misses "+ConvToStr(cachestats.misses)
+			+" evictions "+ConvToStr(cachestats.evictions)+" shared "+ConvToStr(cachestats.shared));
+
+		const MyManager::server_list& servers = this->manager.GetServers();
+		for (MyManager::server_list::const_iterator i = servers.begin(); i != servers.end(); ++i)
+		{
+			const Nameserver* server = *i;
+			stats.AddRow(249, "dns server "+server->address.str()+" rtt "+ConvToStr(server->rtt)+"ms queries "+ConvToStr(server->queries)
+				+" answers "+ConvToStr(server->answers)+" failures "+ConvToStr(server->totalfailures)+(server->IsDown() ? " down" : ""));
 		}
+		return MOD_RES_PASSTHRU;
 	}
 
 	Version GetVersion() CXX11_OVERRIDE
@@ -908,4 +1613,3 @@ class ModuleDNS : public Module
 };
 
 MODULE_INIT(ModuleDNS)
-
@@ -36,9 +36,9 @@ class DummySerializer : public ClientProtocol::Serializer
 		return false;
 	}
 
-	ClientProtocol::SerializedMessage Serialize(const ClientProtocol::Message& msg, const ClientProtocol::TagSelection& tagwl) const CXX11_OVERRIDE
+	std::string Serialize(const ClientProtocol::Message& msg, const ClientProtocol::TagSelection& tagwl) const CXX11_OVERRIDE
 	{
-		return ClientProtocol::SerializedMessage();
+		return std::string();
 	}
 
  public:
@@ -678,7 +678,6 @@ void InspIRCd::Run()
 				FOREACH_MOD(OnGarbageCollect, ());
 
 			Timers.TickTimers(TIME.tv_sec);
-			Users->DoBackgroundUserStuff();
 
 			if ((TIME.tv_sec % 5) == 0)
 			{
@@ -687,6 +686,8 @@ void InspIRCd::Run()
 			}
 		}
 
+		Users->DoBackgroundUserStuff();
+
 		/* Call the socket engine to wait on the active
 		 * file descriptors. The socket engine has everything's
 		 * descriptors in its list... dns, modules, users,
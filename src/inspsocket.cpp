@@ -384,6 +384,21 @@ void StreamSocket::WriteData(const std::string &data)
 	SocketEngine::ChangeEventMask(this, FD_ADD_TRIAL_WRITE);
 }
 
+void StreamSocket::WriteData(const SendQueue::Element& data)
+{
+	if (!HasFd())
+	{
+		ServerInstance->Logs->Log("SOCKET", LOG_DEBUG, "Attempt to write data to dead socket: %.*s",
+			(int)data.length(), data.data());
+		return;
+	}
+
+	/* Append the element to the back of the queue, sharing its data */
+	sendq.push_back(data);
+
+	SocketEngine::ChangeEventMask(this, FD_ADD_TRIAL_WRITE);
+}
+
 bool SocketTimeout::Tick(time_t)
 {
 	ServerInstance->Logs->Log("SOCKET", LOG_DEBUG, "SocketTimeout::Tick");
@@ -421,7 +436,11 @@ void BufferedSocket::OnEventHandlerWrite()
 	{
 		state = I_CONNECTED;
 		this->OnConnected();
-		if (!GetIOHook())
+
+		// Hooks which talk to the socket themselves (e.g. SSL) change the event mask
+		// when they are ready but middle hooks leave that to us.
+		IOHook* const lasthook = GetLastHook();
+		if (!lasthook || IOHookMiddle::ToMiddleHook(lasthook))
 			SocketEngine::ChangeEventMask(this, FD_WANT_FAST_READ | FD_WANT_EDGE_WRITE);
 	}
 	this->StreamSocket::OnEventHandlerWrite();
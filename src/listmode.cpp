@@ -205,6 +205,7 @@ ModeAction ListModeBase::OnModeChange(User* source, User*, Channel* channel, std
 		{
 			// And now add the mask onto the list...
 			cd->list.push_back(ListItem(parameter, source->nick, ServerInstance->Time()));
+			channel->InvalidateBanCache();
 			return MODEACTION_ALLOW;
 		}
 		else
@@ -223,6 +224,7 @@ ModeAction ListModeBase::OnModeChange(User* source, User*, Channel* channel, std
 				if (parameter == it->mask)
 				{
 					stdalgo::vector::swaperase(cd->list, it);
+					channel->InvalidateBanCache();
 					return MODEACTION_ALLOW;
 				}
 			}
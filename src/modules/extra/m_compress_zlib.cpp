@@ -0,0 +1,341 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/// $CompilerFlags: find_compiler_flags("zlib" "")
+/// $LinkerFlags: find_linker_flags("zlib" "-lz")
+
+/// $PackageInfo: require_system("arch") pkgconf zlib
+/// $PackageInfo: require_system("centos") pkgconfig zlib-devel
+/// $PackageInfo: require_system("darwin") pkg-config zlib
+/// $PackageInfo: require_system("debian") pkg-config zlib1g-dev
+/// $PackageInfo: require_system("ubuntu") pkg-config zlib1g-dev
+
+
+#include "inspircd.h"
+#include "modules/compress.h"
+
+#include <zlib.h>
+
+#ifdef _WIN32
+# pragma comment(lib, "zlib.lib")
+#endif
+
+enum CompressState
+{
+	// Looking at the start of each line for the start line.
+	STATE_NEGOTIATING,
+
+	// Compression will not be used, data is passed through unchanged.
+	STATE_PLAIN,
+
+	// Data is being (de)compressed.
+	STATE_COMPRESSED
+};
+
+class ZlibHookProvider : public CompressionIOHookProvider
+{
+ public:
+	// The compression level to use for new connections.
+	int level;
+
+	ZlibHookProvider(Module* mod)
+		: CompressionIOHookProvider(mod, "zlib")
+		, level(Z_DEFAULT_COMPRESSION)
+	{
+	}
+
+	void OnAccept(StreamSocket* sock, irc::sockets::sockaddrs* client, irc::sockets::sockaddrs* server) CXX11_OVERRIDE;
+	void OnConnect(StreamSocket* sock) CXX11_OVERRIDE;
+};
+
+class ZlibHook : public CompressionIOHook
+{
+	// The size of the buffer used to hold (de)compressed data.
+	static const size_t BUFFER_SIZE = 16384;
+
+	z_stream deflater;
+	z_stream inflater;
+	CompressState sendstate;
+	CompressState recvstate;
+
+	// The line which starts compression.
+	const std::string startline;
+
+	// Data sent whilst negotiating which does not end in a complete line yet.
+	std::string sendline;
+
+	/** Look at each complete line in a buffer until the one which decides whether compression
+	 * will be used.
+	 * @param data The buffer to look at.
+	 * @param state The negotiation state, updated if a deciding line is found.
+	 * @param linestart Set to the start of the deciding line or the first incomplete line.
+	 * @param lineend Set to the end of the start line if compression was started or std::string::npos otherwise.
+	 */
+	void Negotiate(const std::string& data, CompressState& state, std::string::size_type& linestart, std::string::size_type& lineend)
+	{
+		linestart = 0;
+		lineend = std::string::npos;
+		for (std::string::size_type eol; (eol = data.find('\n', linestart)) != std::string::npos; linestart = eol + 1)
+		{
+			std::string::size_type length = eol - linestart;
+			if (length && data[eol - 1] == '\r')
+				length--;
+
+			if (!data.compare(linestart, length, startline))
+			{
+				state = STATE_COMPRESSED;
+				lineend = eol + 1;
+				return;
+			}
+
+			// Anything with a prefix or tags is only sent once the other side will have
+			// started compressing if it is going to.
+			if (length && (data[linestart] == ':' || data[linestart] == '@'))
+			{
+				state = STATE_PLAIN;
+				return;
+			}
+		}
+	}
+
+	bool Deflate(const char* data, size_t length, int flush)
+	{
+		deflater.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+		deflater.avail_in = length;
+		sent.plain += length;
+
+		std::string compressed;
+		char buffer[BUFFER_SIZE];
+		do
+		{
+			deflater.next_out = reinterpret_cast<Bytef*>(buffer);
+			deflater.avail_out = sizeof(buffer);
+			if (deflate(&deflater, flush) == Z_STREAM_ERROR)
+				return false;
+
+			compressed.append(buffer, sizeof(buffer) - deflater.avail_out);
+		}
+		while (deflater.avail_out == 0);
+
+		if (!compressed.empty())
+		{
+			sent.compressed += compressed.length();
+			GetSendQ().push_back(StreamSocket::SendQueue::Element(compressed));
+		}
+		return true;
+	}
+
+	bool Inflate(StreamSocket* sock, const char* data, size_t length, std::string& destrecvq)
+	{
+		inflater.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+		inflater.avail_in = length;
+		received.compressed += length;
+
+		const std::string::size_type oldsize = destrecvq.size();
+		char buffer[BUFFER_SIZE];
+		do
+		{
+			inflater.next_out = reinterpret_cast<Bytef*>(buffer);
+			inflater.avail_out = sizeof(buffer);
+			int ret = inflate(&inflater, Z_SYNC_FLUSH);
+			if (ret == Z_STREAM_END)
+			{
+				sock->SetError("Compressed stream ended unexpectedly");
+				return false;
+			}
+			if (ret != Z_OK && ret != Z_BUF_ERROR)
+			{
+				sock->SetError(std::string("Decompression error: ") + (inflater.msg ? inflater.msg : "unknown error"));
+				return false;
+			}
+
+			destrecvq.append(buffer, sizeof(buffer) - inflater.avail_out);
+		}
+		while (inflater.avail_out == 0);
+
+		received.plain += destrecvq.size() - oldsize;
+		return true;
+	}
+
+ public:
+	ZlibHook(ZlibHookProvider* hookprov, StreamSocket* sock)
+		: CompressionIOHook(hookprov)
+		, sendstate(STATE_NEGOTIATING)
+		, recvstate(STATE_NEGOTIATING)
+		, startline(GetStartLine(GetAlgorithm()))
+	{
+		memset(&deflater, 0, sizeof(deflater));
+		memset(&inflater, 0, sizeof(inflater));
+		if (deflateInit(&deflater, hookprov->level) != Z_OK || inflateInit(&inflater) != Z_OK)
+			sock->SetError("Unable to initialise zlib");
+		sock->AddIOHook(this);
+	}
+
+	~ZlibHook()
+	{
+		deflateEnd(&deflater);
+		inflateEnd(&inflater);
+	}
+
+	bool IsCompressing() const CXX11_OVERRIDE
+	{
+		return sendstate == STATE_COMPRESSED;
+	}
+
+	bool IsDecompressing() const CXX11_OVERRIDE
+	{
+		return recvstate == STATE_COMPRESSED;
+	}
+
+	int OnStreamSocketWrite(StreamSocket* sock, StreamSocket::SendQueue& uppersendq) CXX11_OVERRIDE
+	{
+		if (sendstate == STATE_PLAIN)
+		{
+			GetSendQ().moveall(uppersendq);
+			return 1;
+		}
+
+		if (sendstate == STATE_NEGOTIATING)
+		{
+			for (StreamSocket::SendQueue::const_iterator elem = uppersendq.begin(); elem != uppersendq.end(); ++elem)
+				sendline.append(elem->data(), elem->length());
+			uppersendq.clear();
+
+			std::string::size_type linestart;
+			std::string::size_type lineend;
+			Negotiate(sendline, sendstate, linestart, lineend);
+			switch (sendstate)
+			{
+				case STATE_NEGOTIATING:
+					// Hold back any incomplete line until we know what it is.
+					if (linestart)
+					{
+						GetSendQ().push_back(StreamSocket::SendQueue::Element(sendline.substr(0, linestart)));
+						sendline.erase(0, linestart);
+					}
+					return 1;
+
+				case STATE_PLAIN:
+					GetSendQ().push_back(StreamSocket::SendQueue::Element(sendline));
+					std::string().swap(sendline);
+					return 1;
+
+				case STATE_COMPRESSED:
+					// The start line itself has to be sent uncompressed.
+					GetSendQ().push_back(StreamSocket::SendQueue::Element(sendline.substr(0, lineend)));
+					sendline.erase(0, lineend);
+					if (!sendline.empty())
+						uppersendq.push_back(sendline);
+					std::string().swap(sendline);
+					break;
+			}
+		}
+
+		for (StreamSocket::SendQueue::const_iterator elem = uppersendq.begin(); elem != uppersendq.end(); ++elem)
+		{
+			if (!Deflate(elem->data(), elem->length(), Z_NO_FLUSH))
+			{
+				sock->SetError("Compression error");
+				return -1;
+			}
+		}
+		uppersendq.clear();
+
+		// Flush at the end of each batch so the other side can process everything we have sent.
+		if (!Deflate(NULL, 0, Z_SYNC_FLUSH))
+		{
+			sock->SetError("Compression error");
+			return -1;
+		}
+		return 1;
+	}
+
+	int OnStreamSocketRead(StreamSocket* sock, std::string& destrecvq) CXX11_OVERRIDE
+	{
+		std::string& recvq = GetRecvQ();
+		if (recvq.empty())
+			return 0;
+
+		if (recvstate == STATE_NEGOTIATING)
+		{
+			std::string::size_type linestart;
+			std::string::size_type lineend;
+			Negotiate(recvq, recvstate, linestart, lineend);
+			if (recvstate == STATE_NEGOTIATING)
+			{
+				destrecvq.append(recvq, 0, linestart);
+				recvq.erase(0, linestart);
+				return 1;
+			}
+
+			if (recvstate == STATE_COMPRESSED)
+			{
+				// The start line is only meaningful to us so don't pass it on.
+				destrecvq.append(recvq, 0, linestart);
+				recvq.erase(0, lineend);
+			}
+		}
+
+		if (recvstate == STATE_PLAIN)
+		{
+			destrecvq.append(recvq);
+			recvq.clear();
+			return 1;
+		}
+
+		const bool ok = Inflate(sock, recvq.data(), recvq.length(), destrecvq);
+		recvq.clear();
+		return ok ? 1 : -1;
+	}
+
+	void OnStreamSocketClose(StreamSocket* sock) CXX11_OVERRIDE
+	{
+	}
+};
+
+void ZlibHookProvider::OnAccept(StreamSocket* sock, irc::sockets::sockaddrs* client, irc::sockets::sockaddrs* server)
+{
+	new ZlibHook(this, sock);
+}
+
+void ZlibHookProvider::OnConnect(StreamSocket* sock)
+{
+	new ZlibHook(this, sock);
+}
+
+class ModuleCompressZlib : public Module
+{
+	reference<ZlibHookProvider> hookprov;
+
+ public:
+	ModuleCompressZlib()
+		: hookprov(new ZlibHookProvider(this))
+	{
+	}
+
+	void ReadConfig(ConfigStatus& status) CXX11_OVERRIDE
+	{
+		ConfigTag* tag = ServerInstance->Config->ConfValue("zlib");
+		hookprov->level = tag->getInt("level", Z_DEFAULT_COMPRESSION, Z_DEFAULT_COMPRESSION, Z_BEST_COMPRESSION);
+	}
+
+	Version GetVersion() CXX11_OVERRIDE
+	{
+		return Version("Allows server links to be compressed using zlib.", VF_VENDOR);
+	}
+};
+
+MODULE_INIT(ModuleCompressZlib)
@@ -44,6 +44,7 @@
 
 #include "inspircd.h"
 #include "modules/ssl.h"
+#include "modules/stats.h"
 #include <memory>
 
 #ifdef __GNUC__
@@ -125,6 +126,15 @@ typedef gnutls_connection_end_t inspircd_gnutls_session_init_flags_t;
 #define INSPIRCD_GNUTLS_HAS_CORK
 #endif
 
+#if INSPIRCD_GNUTLS_HAS_VERSION(2, 10, 0)
+#define INSPIRCD_GNUTLS_HAS_TICKETS
+#endif
+
+#if INSPIRCD_GNUTLS_HAS_VERSION(3, 6, 5)
+// GnuTLS derives the keys it encrypts session tickets with from the key it is given and rotates them itself.
+#define INSPIRCD_GNUTLS_HAS_TICKET_ROTATION
+#endif
+
 static Module* thismod;
 
 class RandGen
@@ -439,6 +449,99 @@ namespace GnuTLS
 	};
 #endif
 
+	/** Session resumption state for a profile which is kept across rehashes. */
+	class SessionState : public SSLSessionCache
+	{
+#ifdef INSPIRCD_GNUTLS_HAS_TICKETS
+		/** The key which session tickets are encrypted with. */
+		gnutls_datum_t ticketkey;
+
+		/** The time at which the ticket key was created. */
+		time_t ticketkeycreated;
+#endif
+
+		static std::string ToString(const gnutls_datum_t& datum)
+		{
+			return std::string(reinterpret_cast<const char*>(datum.data), datum.size);
+		}
+
+	 public:
+		SessionState()
+#ifdef INSPIRCD_GNUTLS_HAS_TICKETS
+			: ticketkeycreated(0)
+#endif
+		{
+#ifdef INSPIRCD_GNUTLS_HAS_TICKETS
+			ticketkey.data = NULL;
+			ticketkey.size = 0;
+#endif
+		}
+
+		~SessionState()
+		{
+#ifdef INSPIRCD_GNUTLS_HAS_TICKETS
+			gnutls_free(ticketkey.data);
+#endif
+		}
+
+#ifdef INSPIRCD_GNUTLS_HAS_TICKETS
+		/** Retrieves the key which session tickets are encrypted with, creating a new one if needed.
+		 * @return The key to encrypt tickets with or NULL if a key could not be created.
+		 */
+		const gnutls_datum_t* GetTicketKey()
+		{
+#ifndef INSPIRCD_GNUTLS_HAS_TICKET_ROTATION
+			// Older versions of GnuTLS encrypt every ticket with the key they are given so we replace it ourselves.
+			if ((ticketkey.data) && (ticketkeycreated + time_t(GetLifetime()) <= ServerInstance->Time()))
+			{
+				gnutls_free(ticketkey.data);
+				ticketkey.data = NULL;
+			}
+#endif
+
+			if (!ticketkey.data)
+			{
+				if (gnutls_session_ticket_key_generate(&ticketkey) < 0)
+				{
+					ticketkey.data = NULL;
+					return NULL;
+				}
+				ticketkeycreated = ServerInstance->Time();
+			}
+			return &ticketkey;
+		}
+#endif
+
+		static int StoreSession(void* ptr, gnutls_datum_t key, gnutls_datum_t data)
+		{
+			static_cast<SessionState*>(ptr)->Store(ToString(key), ToString(data));
+			return 0;
+		}
+
+		static gnutls_datum_t RetrieveSession(void* ptr, gnutls_datum_t key)
+		{
+			gnutls_datum_t ret = { NULL, 0 };
+			std::string data;
+			if (!static_cast<SessionState*>(ptr)->Retrieve(ToString(key), data))
+				return ret;
+
+			// GnuTLS frees the data it is given itself.
+			ret.data = static_cast<unsigned char*>(gnutls_malloc(data.length()));
+			if (!ret.data)
+				return ret;
+
+			memcpy(ret.data, data.data(), data.length());
+			ret.size = data.length();
+			return ret;
+		}
+
+		static int RemoveSession(void* ptr, gnutls_datum_t key)
+		{
+			static_cast<SessionState*>(ptr)->Remove(ToString(key));
+			return 0;
+		}
+	};
+
 	class CertCredentials
 	{
 		/** DH parameters associated with these credentials
@@ -609,6 +712,14 @@ namespace GnuTLS
 		 */
 		const bool requestclientcert;
 
+		/** True to issue session tickets to clients as a server
+		 */
+		const bool tickets;
+
+		/** Sessions which clients can resume
+		 */
+		reference<SessionState> sessions;
+
 		static std::string ReadFile(const std::string& filename)
 		{
 			FileReader reader(filename);
@@ -662,6 +773,10 @@ namespace GnuTLS
 			unsigned int outrecsize;
 			bool requestclientcert;
 
+			unsigned long sessioncachesize;
+			unsigned long sessionlifetime;
+			bool tickets;
+
 			Config(const std::string& profilename, ConfigTag* tag)
 				: name(profilename)
 				, certstr(ReadFile(tag->getString("certfile", "cert.pem", 1)))
@@ -671,6 +786,9 @@ namespace GnuTLS
 				, mindh(tag->getUInt("mindhbits", 1024))
 				, hashstr(tag->getString("hash", "md5", 1))
 				, requestclientcert(tag->getBool("requestclientcert", true))
+				, sessioncachesize(tag->getUInt("sessioncachesize", 1000))
+				, sessionlifetime(tag->getDuration("sessionlifetime", 3600, 60, 604800))
+				, tickets(tag->getBool("tickets", true))
 			{
 				// Load trusted CA and revocation list, if set
 				std::string filename = tag->getString("cafile");
@@ -692,7 +810,7 @@ namespace GnuTLS
 			}
 		};
 
-		Profile(Config& config)
+		Profile(Config& config, SessionState* sessionstate)
 			: name(config.name)
 			, x509cred(config.certstr, config.keystr)
 			, min_dh_bits(config.mindh)
@@ -700,9 +818,12 @@ namespace GnuTLS
 			, priority(config.priostr)
 			, outrecsize(config.outrecsize)
 			, requestclientcert(config.requestclientcert)
+			, tickets(config.tickets)
+			, sessions(sessionstate)
 		{
 			x509cred.SetDH(config.dh);
 			x509cred.SetCA(config.ca, config.crl);
+			sessions->SetLimits(config.sessioncachesize, config.sessionlifetime);
 		}
 		/** Set up the given session with the settings in this profile
 		 */
@@ -717,10 +838,28 @@ namespace GnuTLS
 				gnutls_certificate_server_set_request(sess, GNUTLS_CERT_REQUEST);
 		}
 
+		/** Allow a client to resume a previous session with the given server session instead of doing a full handshake
+		 */
+		void SetupResumption(gnutls_session_t sess)
+		{
+			gnutls_db_set_ptr(sess, sessions);
+			gnutls_db_set_cache_expiration(sess, sessions->GetLifetime());
+			gnutls_db_set_store_function(sess, SessionState::StoreSession);
+			gnutls_db_set_retrieve_function(sess, SessionState::RetrieveSession);
+			gnutls_db_set_remove_function(sess, SessionState::RemoveSession);
+
+#ifdef INSPIRCD_GNUTLS_HAS_TICKETS
+			const gnutls_datum_t* ticketkey = tickets ? sessions->GetTicketKey() : NULL;
+			if (ticketkey)
+				gnutls_session_ticket_enable_server(sess, ticketkey);
+#endif
+		}
+
 		const std::string& GetName() const { return name; }
 		X509Credentials& GetX509Credentials() { return x509cred; }
 		gnutls_digest_algorithm_t GetHash() const { return hash.get(); }
 		unsigned int GetOutgoingRecordSize() const { return outrecsize; }
+		SessionState& GetSessions() { return *sessions; }
 	};
 }
 
@@ -782,6 +921,10 @@ class GnuTLSIOHook : public SSLIOHook
 			// Change the session state
 			this->status = ISSL_HANDSHAKEN;
 
+			// Only server sessions use the session cache.
+			if (gnutls_db_get_ptr(this->sess))
+				GetProfile().GetSessions().CountHandshake(gnutls_session_is_resumed(this->sess));
+
 			VerifyCertificate();
 
 			// Finish writing, if any left
@@ -1064,6 +1207,8 @@ info_done_dealloc:
 #endif
 		gnutls_transport_set_pull_function(sess, gnutls_pull_wrapper);
 		GetProfile().SetupSession(sess);
+		if (flags == GNUTLS_SERVER)
+			GetProfile().SetupResumption(sess);
 
 		sock->AddIOHook(this);
 		Handshake(sock);
@@ -1232,9 +1377,9 @@ class GnuTLSIOHookProvider : public SSLIOHookProvider
 	GnuTLS::Profile profile;
 
  public:
-	GnuTLSIOHookProvider(Module* mod, GnuTLS::Profile::Config& config)
+	GnuTLSIOHookProvider(Module* mod, GnuTLS::Profile::Config& config, GnuTLS::SessionState* sessions)
 		: SSLIOHookProvider(mod, config.name)
-		, profile(config)
+		, profile(config, sessions)
 	{
 		ServerInstance->Modules->AddService(*this);
 	}
@@ -1263,14 +1408,28 @@ GnuTLS::Profile& GnuTLSIOHook::GetProfile()
 	return static_cast<GnuTLSIOHookProvider*>(hookprov)->GetProfile();
 }
 
-class ModuleSSLGnuTLS : public Module
+class ModuleSSLGnuTLS
+	: public Module
+	, public Stats::EventListener
 {
 	typedef std::vector<reference<GnuTLSIOHookProvider> > ProfileList;
+	typedef std::map<std::string, reference<GnuTLS::SessionState> > SessionStateMap;
 
 	// First member of the class, gets constructed first and destructed last
 	GnuTLS::Init libinit;
 	ProfileList profiles;
 
+	/** Session resumption state for each profile, by name. This is kept here so that it survives a rehash. */
+	SessionStateMap sessionstates;
+
+	GnuTLS::SessionState* GetSessionState(const std::string& name)
+	{
+		reference<GnuTLS::SessionState>& state = sessionstates[name];
+		if (!state)
+			state = new GnuTLS::SessionState;
+		return state;
+	}
+
 	void ReadProfiles()
 	{
 		// First, store all profiles in a new, temporary container. If no problems occur, swap the two
@@ -1289,7 +1448,8 @@ class ModuleSSLGnuTLS : public Module
 			try
 			{
 				GnuTLS::Profile::Config profileconfig(defname, tag);
-				newprofiles.push_back(new GnuTLSIOHookProvider(this, profileconfig));
+				GnuTLS::SessionState* sessions = GetSessionState(defname);
+				newprofiles.push_back(new GnuTLSIOHookProvider(this, profileconfig, sessions));
 			}
 			catch (CoreException& ex)
 			{
@@ -1315,18 +1475,19 @@ class ModuleSSLGnuTLS : public Module
 					continue;
 				}
 
-				reference<GnuTLSIOHookProvider> prov;
+				reference<GnuTLSIOHookProvider> provider;
 				try
 				{
 					GnuTLS::Profile::Config profileconfig(name, tag);
-					prov = new GnuTLSIOHookProvider(this, profileconfig);
+					GnuTLS::SessionState* sessions = GetSessionState(name);
+					provider = new GnuTLSIOHookProvider(this, profileconfig, sessions);
 				}
 				catch (CoreException& ex)
 				{
 					throw ModuleException("Error while initializing TLS (SSL) profile \"" + name + "\" at " + tag->getTagLocation() + " - " + ex.GetReason());
 				}
 
-				newprofiles.push_back(prov);
+				newprofiles.push_back(provider);
 			}
 		}
 
@@ -1334,15 +1495,35 @@ class ModuleSSLGnuTLS : public Module
 		// Old profiles are deleted when their refcount drops to zero
 		for (ProfileList::iterator i = profiles.begin(); i != profiles.end(); ++i)
 		{
-			GnuTLSIOHookProvider& prov = **i;
-			ServerInstance->Modules.DelService(prov);
+			GnuTLSIOHookProvider& provider = **i;
+			ServerInstance->Modules.DelService(provider);
 		}
 
 		profiles.swap(newprofiles);
+
+		// Forget the sessions of profiles which no longer exist.
+		for (SessionStateMap::iterator i = sessionstates.begin(); i != sessionstates.end(); )
+		{
+			bool found = false;
+			for (ProfileList::const_iterator j = profiles.begin(); j != profiles.end(); ++j)
+			{
+				if ((*j)->GetProfile().GetName() == i->first)
+				{
+					found = true;
+					break;
+				}
+			}
+
+			if (found)
+				++i;
+			else
+				sessionstates.erase(i++);
+		}
 	}
 
  public:
 	ModuleSSLGnuTLS()
+		: Stats::EventListener(this)
 	{
 #ifndef GNUTLS_HAS_RND
 		gcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
@@ -1411,6 +1592,23 @@ class ModuleSSLGnuTLS : public Module
 			return MOD_RES_DENY;
 		return MOD_RES_PASSTHRU;
 	}
+
+	ModResult OnStats(Stats::Context& stats) CXX11_OVERRIDE
+	{
+		if (stats.GetSymbol() != 't')
+			return MOD_RES_PASSTHRU;
+
+		for (ProfileList::const_iterator i = profiles.begin(); i != profiles.end(); ++i)
+		{
+			GnuTLS::Profile& profile = (*i)->GetProfile();
+			const GnuTLS::SessionState& sessions = profile.GetSessions();
+			stats.AddRow(249, InspIRCd::Format("TLSSESSIONS \"%s\" (GnuTLS) had %lu hits and %lu misses and has %lu cached sessions",
+				profile.GetName().c_str(), sessions.GetHits(), sessions.GetMisses(), (unsigned long)sessions.GetSize()));
+		}
+
+		// Other TLS (SSL) modules may have profiles too.
+		return MOD_RES_PASSTHRU;
+	}
 };
 
 MODULE_INIT(ModuleSSLGnuTLS)
@@ -28,6 +28,7 @@
 
 #include "inspircd.h"
 #include "modules/ssl.h"
+#include "modules/stats.h"
 
 // Fix warnings about the use of commas at end of enumerator lists on C++03.
 #if defined __clang__
@@ -54,6 +55,20 @@
 #include <mbedtls/x509_crt.h>
 #include <mbedtls/x509_crl.h>
 
+#ifdef MBEDTLS_SSL_CACHE_C
+#include <mbedtls/ssl_cache.h>
+
+// The entries of the session cache can only be walked before mbedTLS 3 made them private.
+# if MBEDTLS_VERSION_NUMBER < 0x03000000
+#  define INSPIRCD_MBEDTLS_CAN_COUNT_SESSIONS
+# endif
+#endif
+
+#if defined MBEDTLS_SSL_TICKET_C && defined MBEDTLS_SSL_SESSION_TICKETS
+#include <mbedtls/ssl_ticket.h>
+#define INSPIRCD_MBEDTLS_HAS_TICKETS
+#endif
+
 #ifdef INSPIRCD_MBEDTLS_LIBRARY_DEBUG
 #include <mbedtls/debug.h>
 #endif
@@ -118,6 +133,163 @@ namespace mbedTLS
 		{
 			mbedtls_ssl_conf_rng(conf, mbedtls_ctr_drbg_random, get());
 		}
+
+#ifdef INSPIRCD_MBEDTLS_HAS_TICKETS
+		bool SetupTickets(mbedtls_ssl_ticket_context* ticket, uint32_t lifetime)
+		{
+			return (mbedtls_ssl_ticket_setup(ticket, mbedtls_ctr_drbg_random, get(), MBEDTLS_CIPHER_AES_256_GCM, lifetime) == 0);
+		}
+#endif
+	};
+
+	/** Session resumption state for a profile which is kept across rehashes. */
+	class SessionState : public refcountbase
+	{
+#ifdef MBEDTLS_SSL_CACHE_C
+		/** Sessions which clients can resume by their id. */
+		mbedtls_ssl_cache_context cache;
+#endif
+
+#ifdef INSPIRCD_MBEDTLS_HAS_TICKETS
+		/** The keys which session tickets are encrypted with. These are rotated by mbedTLS. */
+		mbedtls_ssl_ticket_context ticket;
+
+		/** The lifetime the ticket keys were set up with or 0 if they have not been set up. */
+		unsigned long ticketlifetime;
+#endif
+
+		/** The number of server handshakes which have completed. */
+		unsigned long handshakes;
+
+		/** The number of server handshakes which resumed a session. */
+		unsigned long hits;
+
+		/** A digest of the settings which decided whether peer certificates were trusted when the sessions were established. */
+		const std::string trust;
+
+#ifdef MBEDTLS_SSL_CACHE_C
+		static int GetCachedSession(void* ptr, mbedtls_ssl_session* session)
+		{
+			SessionState* state = static_cast<SessionState*>(ptr);
+			int ret = mbedtls_ssl_cache_get(&state->cache, session);
+			if (ret == 0)
+				state->hits++;
+			return ret;
+		}
+
+		static int SetCachedSession(void* ptr, const mbedtls_ssl_session* session)
+		{
+			return mbedtls_ssl_cache_set(&static_cast<SessionState*>(ptr)->cache, session);
+		}
+#endif
+
+#ifdef INSPIRCD_MBEDTLS_HAS_TICKETS
+		static int WriteTicket(void* ptr, const mbedtls_ssl_session* session, unsigned char* start, const unsigned char* end, size_t* len, uint32_t* lifetime)
+		{
+			return mbedtls_ssl_ticket_write(&static_cast<SessionState*>(ptr)->ticket, session, start, end, len, lifetime);
+		}
+
+		static int ParseTicket(void* ptr, mbedtls_ssl_session* session, unsigned char* buf, size_t len)
+		{
+			SessionState* state = static_cast<SessionState*>(ptr);
+			int ret = mbedtls_ssl_ticket_parse(&state->ticket, session, buf, len);
+			if (ret == 0)
+				state->hits++;
+			return ret;
+		}
+#endif
+
+	 public:
+		SessionState(const std::string& trustdigest)
+			: handshakes(0)
+			, hits(0)
+			, trust(trustdigest)
+		{
+#ifdef MBEDTLS_SSL_CACHE_C
+			mbedtls_ssl_cache_init(&cache);
+#endif
+#ifdef INSPIRCD_MBEDTLS_HAS_TICKETS
+			mbedtls_ssl_ticket_init(&ticket);
+			ticketlifetime = 0;
+#endif
+		}
+
+		~SessionState()
+		{
+#ifdef MBEDTLS_SSL_CACHE_C
+			mbedtls_ssl_cache_free(&cache);
+#endif
+#ifdef INSPIRCD_MBEDTLS_HAS_TICKETS
+			mbedtls_ssl_ticket_free(&ticket);
+#endif
+		}
+
+		/** Change the limits of the session cache and session tickets.
+		 * @param ctrdrbg The random number generator to create ticket keys with.
+		 * @param max The maximum number of sessions to keep. If 0 then no sessions are kept.
+		 * @param lifetime The number of seconds a session can be resumed for.
+		 */
+		void SetLimits(CTRDRBG& ctrdrbg, unsigned long max, unsigned long lifetime)
+		{
+#ifdef MBEDTLS_SSL_CACHE_C
+			mbedtls_ssl_cache_set_max_entries(&cache, max);
+			mbedtls_ssl_cache_set_timeout(&cache, lifetime);
+#endif
+
+#ifdef INSPIRCD_MBEDTLS_HAS_TICKETS
+			// The keys can only be set up once so they have to be replaced if the lifetime changes.
+			if (ticketlifetime == lifetime)
+				return;
+
+			if (ticketlifetime)
+			{
+				mbedtls_ssl_ticket_free(&ticket);
+				mbedtls_ssl_ticket_init(&ticket);
+			}
+
+			if (!ctrdrbg.SetupTickets(&ticket, lifetime))
+				throw Exception("Unable to set up session ticket keys");
+			ticketlifetime = lifetime;
+#endif
+		}
+
+		/** Allow clients to resume sessions with servers using the given config.
+		 * @param conf The config to use the session cache with.
+		 * @param tickets True if session tickets should be issued; otherwise, false.
+		 */
+		void SetupConf(mbedtls_ssl_config* conf, bool tickets)
+		{
+#ifdef MBEDTLS_SSL_CACHE_C
+			mbedtls_ssl_conf_session_cache(conf, this, GetCachedSession, SetCachedSession);
+#endif
+#ifdef INSPIRCD_MBEDTLS_HAS_TICKETS
+			if (tickets)
+				mbedtls_ssl_conf_session_tickets_cb(conf, WriteTicket, ParseTicket, this);
+#endif
+		}
+
+		/** Record that a server handshake has completed. */
+		void CountHandshake() { handshakes++; }
+
+		/** Retrieves the digest of the settings which decided whether peer certificates were trusted. */
+		const std::string& GetTrust() const { return trust; }
+
+		/** Retrieves the number of server handshakes which resumed a session. */
+		unsigned long GetHits() const { return hits; }
+
+		/** Retrieves the number of server handshakes which did not resume a session. */
+		unsigned long GetMisses() const { return handshakes - std::min(hits, handshakes); }
+
+#ifdef INSPIRCD_MBEDTLS_CAN_COUNT_SESSIONS
+		/** Retrieves the number of sessions which are being kept. */
+		size_t GetSize() const
+		{
+			size_t size = 0;
+			for (const mbedtls_ssl_cache_entry* entry = cache.chain; entry; entry = entry->next)
+				size++;
+			return size;
+		}
+#endif
 	};
 
 	class DHParams : public RAIIObj<mbedtls_dhm_context, mbedtls_dhm_init, mbedtls_dhm_free>
@@ -330,6 +502,11 @@ namespace mbedTLS
 			mbedtls_ssl_conf_authmode(&conf, MBEDTLS_SSL_VERIFY_OPTIONAL);
 		}
 
+		void SetSessionState(SessionState& sessions, bool tickets)
+		{
+			sessions.SetupConf(&conf, tickets);
+		}
+
 		const mbedtls_ssl_config* GetConf() const { return &conf; }
 	};
 
@@ -392,6 +569,10 @@ namespace mbedTLS
 		 */
 		const unsigned int outrecsize;
 
+		/** Sessions which clients can resume
+		 */
+		reference<SessionState> sessions;
+
 	 public:
 		struct Config
 		{
@@ -416,6 +597,10 @@ namespace mbedTLS
 			const unsigned int outrecsize;
 			const bool requestclientcert;
 
+			const unsigned long sessioncachesize;
+			const unsigned long sessionlifetime;
+			const bool tickets;
+
 			Config(const std::string& profilename, ConfigTag* tag, CTRDRBG& ctr_drbg)
 				: name(profilename)
 				, ctrdrbg(ctr_drbg)
@@ -431,6 +616,9 @@ namespace mbedTLS
 				, maxver(tag->getUInt("maxver", 0))
 				, outrecsize(tag->getUInt("outrecsize", 2048, 512, 16384))
 				, requestclientcert(tag->getBool("requestclientcert", true))
+				, sessioncachesize(tag->getUInt("sessioncachesize", 1000))
+				, sessionlifetime(tag->getDuration("sessionlifetime", 3600, 60, 604800))
+				, tickets(tag->getBool("tickets", true))
 			{
 				if (!castr.empty())
 				{
@@ -442,7 +630,7 @@ namespace mbedTLS
 			}
 		};
 
-		Profile(Config& config)
+		Profile(Config& config, SessionState* sessionstate)
 			: name(config.name)
 			, x509cred(config.certstr, config.keystr)
 			, ciphersuites(config.ciphersuitestr)
@@ -453,6 +641,7 @@ namespace mbedTLS
 			, crl(config.crlstr)
 			, hash(config.hashstr)
 			, outrecsize(config.outrecsize)
+			, sessions(sessionstate)
 		{
 			serverctx.SetX509CertAndKey(x509cred);
 			clientctx.SetX509CertAndKey(x509cred);
@@ -487,6 +676,10 @@ namespace mbedTLS
 				serverctx.SetOptionalVerifyCert();
 				serverctx.SetCA(cacerts, crl);
 			}
+
+			// Allow clients to resume their sessions instead of doing a full handshake every time they connect.
+			sessions->SetLimits(config.ctrdrbg, config.sessioncachesize, config.sessionlifetime);
+			serverctx.SetSessionState(*sessions, config.tickets);
 		}
 
 		static std::string ReadFile(const std::string& filename)
@@ -514,6 +707,7 @@ namespace mbedTLS
 		X509Credentials& GetX509Credentials() { return x509cred; }
 		unsigned int GetOutgoingRecordSize() const { return outrecsize; }
 		const Hash& GetHash() const { return hash; }
+		SessionState& GetSessions() { return *sessions; }
 	};
 }
 
@@ -549,6 +743,9 @@ class mbedTLSIOHook : public SSLIOHook
 			// Change the session state
 			this->status = ISSL_HANDSHAKEN;
 
+			if (sess.conf->endpoint == MBEDTLS_SSL_IS_SERVER)
+				GetProfile().GetSessions().CountHandshake();
+
 			VerifyCertificate();
 
 			// Finish writing, if any left
@@ -822,9 +1019,9 @@ class mbedTLSIOHookProvider : public SSLIOHookProvider
 	mbedTLS::Profile profile;
 
  public:
-	mbedTLSIOHookProvider(Module* mod, mbedTLS::Profile::Config& config)
+	mbedTLSIOHookProvider(Module* mod, mbedTLS::Profile::Config& config, mbedTLS::SessionState* sessions)
 		: SSLIOHookProvider(mod, config.name)
-		, profile(config)
+		, profile(config, sessions)
 	{
 		ServerInstance->Modules->AddService(*this);
 	}
@@ -853,14 +1050,36 @@ mbedTLS::Profile& mbedTLSIOHook::GetProfile()
 	return static_cast<mbedTLSIOHookProvider*>(hookprov)->GetProfile();
 }
 
-class ModuleSSLmbedTLS : public Module
+class ModuleSSLmbedTLS
+	: public Module
+	, public Stats::EventListener
 {
 	typedef std::vector<reference<mbedTLSIOHookProvider> > ProfileList;
+	typedef std::map<std::string, reference<mbedTLS::SessionState> > SessionStateMap;
 
 	mbedTLS::Entropy entropy;
 	mbedTLS::CTRDRBG ctr_drbg;
 	ProfileList profiles;
 
+	/** Session resumption state for each profile, by name. This is kept here so that it survives a rehash. */
+	SessionStateMap sessionstates;
+
+	mbedTLS::SessionState* GetSessionState(const std::string& name, ConfigTag* tag)
+	{
+		// Sessions and the keys their tickets were encrypted with are forgotten when the settings which decide
+		// whether a peer certificate is trusted change as resuming a session skips verifying the certificate.
+		const std::string settings = SSLSessionCache::ReadTrustSettings(tag);
+		unsigned char md[MBEDTLS_MD_MAX_SIZE];
+		const mbedtls_md_info_t* mdinfo = mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
+		mbedtls_md(mdinfo, reinterpret_cast<const unsigned char*>(settings.data()), settings.length(), md);
+		const std::string trust(reinterpret_cast<const char*>(md), mbedtls_md_get_size(mdinfo));
+
+		reference<mbedTLS::SessionState>& state = sessionstates[name];
+		if (!state || state->GetTrust() != trust)
+			state = new mbedTLS::SessionState(trust);
+		return state;
+	}
+
 	void ReadProfiles()
 	{
 		// First, store all profiles in a new, temporary container. If no problems occur, swap the two
@@ -879,7 +1098,8 @@ class ModuleSSLmbedTLS : public Module
 			try
 			{
 				mbedTLS::Profile::Config profileconfig(defname, tag, ctr_drbg);
-				newprofiles.push_back(new mbedTLSIOHookProvider(this, profileconfig));
+				mbedTLS::SessionState* sessions = GetSessionState(defname, tag);
+				newprofiles.push_back(new mbedTLSIOHookProvider(this, profileconfig, sessions));
 			}
 			catch (CoreException& ex)
 			{
@@ -905,18 +1125,19 @@ class ModuleSSLmbedTLS : public Module
 					continue;
 				}
 
-				reference<mbedTLSIOHookProvider> prov;
+				reference<mbedTLSIOHookProvider> provider;
 				try
 				{
 					mbedTLS::Profile::Config profileconfig(name, tag, ctr_drbg);
-					prov = new mbedTLSIOHookProvider(this, profileconfig);
+					mbedTLS::SessionState* sessions = GetSessionState(name, tag);
+					provider = new mbedTLSIOHookProvider(this, profileconfig, sessions);
 				}
 				catch (CoreException& ex)
 				{
 					throw ModuleException("Error while initializing TLS (SSL) profile \"" + name + "\" at " + tag->getTagLocation() + " - " + ex.GetReason());
 				}
 
-				newprofiles.push_back(prov);
+				newprofiles.push_back(provider);
 			}
 		}
 
@@ -924,14 +1145,38 @@ class ModuleSSLmbedTLS : public Module
 		// Old profiles are deleted when their refcount drops to zero
 		for (ProfileList::iterator i = profiles.begin(); i != profiles.end(); ++i)
 		{
-			mbedTLSIOHookProvider& prov = **i;
-			ServerInstance->Modules.DelService(prov);
+			mbedTLSIOHookProvider& provider = **i;
+			ServerInstance->Modules.DelService(provider);
 		}
 
 		profiles.swap(newprofiles);
+
+		// Forget the sessions of profiles which no longer exist.
+		for (SessionStateMap::iterator i = sessionstates.begin(); i != sessionstates.end(); )
+		{
+			bool found = false;
+			for (ProfileList::const_iterator j = profiles.begin(); j != profiles.end(); ++j)
+			{
+				if ((*j)->GetProfile().GetName() == i->first)
+				{
+					found = true;
+					break;
+				}
+			}
+
+			if (found)
+				++i;
+			else
+				sessionstates.erase(i++);
+		}
 	}
 
  public:
+	ModuleSSLmbedTLS()
+		: Stats::EventListener(this)
+	{
+	}
+
 	void init() CXX11_OVERRIDE
 	{
 		char verbuf[16]; // Should be at least 9 bytes in size
@@ -987,6 +1232,28 @@ class ModuleSSLmbedTLS : public Module
 		return MOD_RES_PASSTHRU;
 	}
 
+	ModResult OnStats(Stats::Context& stats) CXX11_OVERRIDE
+	{
+		if (stats.GetSymbol() != 't')
+			return MOD_RES_PASSTHRU;
+
+		for (ProfileList::const_iterator i = profiles.begin(); i != profiles.end(); ++i)
+		{
+			mbedTLS::Profile& profile = (*i)->GetProfile();
+			const mbedTLS::SessionState& sessions = profile.GetSessions();
+#ifdef INSPIRCD_MBEDTLS_CAN_COUNT_SESSIONS
+			stats.AddRow(249, InspIRCd::Format("TLSSESSIONS \"%s\" (mbedTLS) had %lu hits and %lu misses and has %lu cached sessions",
+				profile.GetName().c_str(), sessions.GetHits(), sessions.GetMisses(), (unsigned long)sessions.GetSize()));
+#else
+			stats.AddRow(249, InspIRCd::Format("TLSSESSIONS \"%s\" (mbedTLS) had %lu hits and %lu misses",
+				profile.GetName().c_str(), sessions.GetHits(), sessions.GetMisses()));
+#endif
+		}
+
+		// Other TLS (SSL) modules may have profiles too.
+		return MOD_RES_PASSTHRU;
+	}
+
 	Version GetVersion() CXX11_OVERRIDE
 	{
 		return Version("Allows TLS (SSL) encrypted connections using the mbedTLS library.", VF_VENDOR);
@@ -42,6 +42,7 @@
 #include "inspircd.h"
 #include "iohook.h"
 #include "modules/ssl.h"
+#include "modules/stats.h"
 
 #ifdef __GNUC__
 # pragma GCC diagnostic push
@@ -69,6 +70,11 @@
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 #include <openssl/dh.h>
+#include <openssl/rand.h>
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+# include <openssl/core_names.h>
+#endif
 
 #ifdef __GNUC__
 # pragma GCC diagnostic pop
@@ -94,17 +100,26 @@
 # define OPENSSL_init_ssl(OPTIONS, SETTINGS) \
 	SSL_library_init(); \
 	SSL_load_error_strings();
+# define SSL_is_server(SSL) (SSL)->server
+
+// The session id given to the session lookup callback is const in OpenSSL 1.1.
+typedef unsigned char SessionIdType;
 
 // These macros have been renamed in OpenSSL 1.1.
 # define OPENSSL_VERSION SSLEAY_VERSION
 
 #else
 # define INSPIRCD_OPENSSL_OPAQUE_BIO
+typedef const unsigned char SessionIdType;
+#endif
+
+// Kernel TLS is only available in OpenSSL 3.0 and newer when it has been built with support for it.
+#if defined SSL_OP_ENABLE_KTLS && !defined OPENSSL_NO_KTLS
+# define INSPIRCD_OPENSSL_HAS_KTLS
 #endif
 
 enum issl_status { ISSL_NONE, ISSL_HANDSHAKING, ISSL_OPEN };
 
-static bool SelfSigned = false;
 static int exdataindex;
 
 char* get_error()
@@ -114,6 +129,14 @@ char* get_error()
 
 static int OnVerify(int preverify_ok, X509_STORE_CTX* ctx);
 static void StaticSSLInfoCallback(const SSL* ssl, int where, int rc);
+static int OnNewSession(SSL* ssl, SSL_SESSION* sess);
+static SSL_SESSION* OnGetSession(SSL* ssl, SessionIdType* id, int idlen, int* copy);
+static void OnRemoveSession(SSL_CTX* ctx, SSL_SESSION* sess);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+static int OnTicketKey(SSL* ssl, unsigned char* keyname, unsigned char* iv, EVP_CIPHER_CTX* cipherctx, EVP_MAC_CTX* macctx, int enc);
+#else
+static int OnTicketKey(SSL* ssl, unsigned char* keyname, unsigned char* iv, EVP_CIPHER_CTX* cipherctx, HMAC_CTX* macctx, int enc);
+#endif
 
 namespace OpenSSL
 {
@@ -153,6 +176,148 @@ namespace OpenSSL
 		}
 	};
 
+	/** Session resumption state for a profile which is kept across rehashes. */
+	class SessionState : public SSLSessionCache
+	{
+	 public:
+		/** A key which session tickets are encrypted with. */
+		struct TicketKey
+		{
+			/** The name which identifies the key in tickets. */
+			unsigned char name[16];
+
+			/** The key used to encrypt tickets. */
+			unsigned char aeskey[32];
+
+			/** The key used to authenticate tickets. */
+			unsigned char hmackey[32];
+
+			/** The time at which the key was created. */
+			time_t created;
+		};
+
+	 private:
+		typedef std::deque<TicketKey> TicketKeyList;
+
+		/** The keys which tickets can be decrypted with, newest first. The newest one is used to encrypt new tickets. */
+		TicketKeyList ticketkeys;
+
+		/** Serialises access to the sessions and keys as handshakes may be done by worker threads. */
+		mutable Mutex mutex;
+
+		/** A digest of the settings which decided whether peer certificates were trusted when the sessions were established. */
+		const std::string trust;
+
+		/** Remove the keys which no ticket which can still be resumed was encrypted with. */
+		void ExpireTicketKeys()
+		{
+			// A key is used to encrypt tickets for one lifetime and the last of those are valid for one more.
+			while ((!ticketkeys.empty()) && (ticketkeys.back().created + time_t(GetLifetime() * 2) <= ServerInstance->Time()))
+				ticketkeys.pop_back();
+		}
+
+		bool CreateEncryptionKey()
+		{
+			TicketKey key;
+			if ((RAND_bytes(key.name, sizeof(key.name)) <= 0) || (RAND_bytes(key.aeskey, sizeof(key.aeskey)) <= 0) || (RAND_bytes(key.hmackey, sizeof(key.hmackey)) <= 0))
+				return false;
+
+			key.created = ServerInstance->Time();
+			ticketkeys.push_front(key);
+			return true;
+		}
+
+	 public:
+		SessionState(const std::string& trustdigest)
+			: trust(trustdigest)
+		{
+		}
+
+		/** Retrieves the digest of the settings which decided whether peer certificates were trusted. */
+		const std::string& GetTrust() const { return trust; }
+
+		/** Retrieves the key which new tickets should be encrypted with, creating a new one if the current one is too old.
+		 * @param key The location to copy the key to.
+		 * @return True if a key was copied or false if a new key could not be created.
+		 */
+		bool GetEncryptionKey(TicketKey& key)
+		{
+			mutex.Lock();
+			ExpireTicketKeys();
+			bool found = ((!ticketkeys.empty()) && (ticketkeys.front().created + time_t(GetLifetime()) > ServerInstance->Time()));
+			if (!found)
+				found = CreateEncryptionKey();
+			if (found)
+				key = ticketkeys.front();
+			mutex.Unlock();
+			return found;
+		}
+
+		/** Finds the key which a ticket was encrypted with.
+		 * @param name The name of the key from the ticket.
+		 * @param key The location to copy the key to.
+		 * @param renew Set to true if the ticket should be replaced with one encrypted with a newer key.
+		 * @return True if a key was copied or false if the key is no longer known.
+		 */
+		bool FindDecryptionKey(const unsigned char* name, TicketKey& key, bool& renew)
+		{
+			mutex.Lock();
+			ExpireTicketKeys();
+			bool found = false;
+			for (TicketKeyList::const_iterator i = ticketkeys.begin(); i != ticketkeys.end(); ++i)
+			{
+				if (!memcmp(i->name, name, sizeof(i->name)))
+				{
+					renew = (i != ticketkeys.begin());
+					key = *i;
+					found = true;
+					break;
+				}
+			}
+			mutex.Unlock();
+			return found;
+		}
+
+		// These hide the methods of SSLSessionCache so that the cache is only used with the mutex held.
+
+		void SetLimits(size_t max, unsigned long life)
+		{
+			mutex.Lock();
+			SSLSessionCache::SetLimits(max, life);
+			mutex.Unlock();
+		}
+
+		size_t GetSize() const
+		{
+			mutex.Lock();
+			size_t size = SSLSessionCache::GetSize();
+			mutex.Unlock();
+			return size;
+		}
+
+		void Store(const std::string& id, const std::string& data)
+		{
+			mutex.Lock();
+			SSLSessionCache::Store(id, data);
+			mutex.Unlock();
+		}
+
+		bool Retrieve(const std::string& id, std::string& data) const
+		{
+			mutex.Lock();
+			bool found = SSLSessionCache::Retrieve(id, data);
+			mutex.Unlock();
+			return found;
+		}
+
+		void Remove(const std::string& id)
+		{
+			mutex.Lock();
+			SSLSessionCache::Remove(id);
+			mutex.Unlock();
+		}
+	};
+
 	class Context
 	{
 		SSL_CTX* const ctx;
@@ -308,6 +473,43 @@ namespace OpenSSL
 			SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER | SSL_VERIFY_CLIENT_ONCE, OnVerify);
 		}
 
+#ifdef INSPIRCD_OPENSSL_HAS_KTLS
+		void EnableKernelTLS()
+		{
+			ctx_options = SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+		}
+#endif
+
+		void EnableSessionResumption(SessionState* state, const std::string& idcontext, bool tickets)
+		{
+			// Sessions can only be resumed in a context with the same id. This must be set when
+			// client certificates are requested or OpenSSL will refuse to resume sessions.
+			ERR_clear_error();
+			const unsigned int idlen = std::min<size_t>(idcontext.length(), SSL_MAX_SID_CTX_LENGTH);
+			if (!SSL_CTX_set_session_id_context(ctx, reinterpret_cast<const unsigned char*>(idcontext.data()), idlen))
+				throw Exception("Couldn't set session id context");
+
+			// Sessions are kept in a cache which outlives this context instead of the internal one.
+			SSL_CTX_set_app_data(ctx, state);
+			SSL_CTX_set_timeout(ctx, state->GetLifetime());
+			SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_NO_INTERNAL | SSL_SESS_CACHE_NO_AUTO_CLEAR);
+			SSL_CTX_sess_set_new_cb(ctx, OnNewSession);
+			SSL_CTX_sess_set_get_cb(ctx, OnGetSession);
+			SSL_CTX_sess_set_remove_cb(ctx, OnRemoveSession);
+
+#ifdef SSL_OP_NO_TICKET
+			if (!tickets)
+				return;
+
+			ctx_options = SSL_CTX_clear_options(ctx, SSL_OP_NO_TICKET);
+# if OPENSSL_VERSION_NUMBER >= 0x30000000L
+			SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, OnTicketKey);
+# else
+			SSL_CTX_set_tlsext_ticket_key_cb(ctx, OnTicketKey);
+# endif
+#endif
+		}
+
 		SSL* CreateServerSession()
 		{
 			SSL* sess = SSL_new(ctx);
@@ -354,6 +556,14 @@ namespace OpenSSL
 		 */
 		const unsigned int outrecsize;
 
+		/** Sessions which clients can resume
+		 */
+		reference<SessionState> sessions;
+
+		/** True if the keys of sessions should be given to the kernel so it can encrypt and decrypt data, false if not
+		 */
+		bool ktls;
+
 		static int error_callback(const char* str, size_t len, void* u)
 		{
 			Profile* profile = reinterpret_cast<Profile*>(u);
@@ -402,13 +612,15 @@ namespace OpenSSL
 		}
 
 	 public:
-		Profile(const std::string& profilename, ConfigTag* tag)
+		Profile(const std::string& profilename, ConfigTag* tag, SessionState* sessionstate)
 			: name(profilename)
 			, dh(ServerInstance->Config->Paths.PrependConfig(tag->getString("dhfile", "dhparams.pem", 1)))
 			, ctx(SSL_CTX_new(SSLv23_server_method()))
 			, clientctx(SSL_CTX_new(SSLv23_client_method()))
 			, allowrenego(tag->getBool("renegotiation")) // Disallow by default
 			, outrecsize(tag->getUInt("outrecsize", 2048, 512, 16384))
+			, sessions(sessionstate)
+			, ktls(tag->getBool("ktls"))
 		{
 			if ((!ctx.SetDH(dh)) || (!clientctx.SetDH(dh)))
 				throw Exception("Couldn't set DH parameters");
@@ -448,6 +660,22 @@ namespace OpenSSL
 				ctx.SetECDH(curvename);
 #endif
 
+			// Allow clients to resume their sessions instead of doing a full handshake every time they connect.
+			sessions->SetLimits(tag->getUInt("sessioncachesize", 1000), tag->getDuration("sessionlifetime", 3600, 60, 604800));
+			ctx.EnableSessionResumption(sessions, name, tag->getBool("tickets", true));
+
+			if (ktls)
+			{
+#ifdef INSPIRCD_OPENSSL_HAS_KTLS
+				// OpenSSL falls back to encrypting data itself if the kernel does not support the negotiated cipher.
+				ctx.EnableKernelTLS();
+				clientctx.EnableKernelTLS();
+#else
+				ServerInstance->Logs->Log(MODNAME, LOG_DEFAULT, "You have enabled <sslprofile:ktls> for the %s profile but your version of OpenSSL does not support kernel TLS", name.c_str());
+				ktls = false;
+#endif
+			}
+
 			SetContextOptions("server", tag, ctx);
 			SetContextOptions("client", tag, clientctx);
 
@@ -493,6 +721,8 @@ namespace OpenSSL
 		const EVP_MD* GetDigest() { return digest; }
 		bool AllowRenegotiation() const { return allowrenego; }
 		unsigned int GetOutgoingRecordSize() const { return outrecsize; }
+		SessionState& GetSessions() { return *sessions; }
+		bool UseKernelTLS() const { return ktls; }
 	};
 
 	namespace BIOMethod
@@ -556,20 +786,15 @@ static BIO_METHOD biomethods =
 static BIO_METHOD* biomethods;
 #endif
 
-static int OnVerify(int preverify_ok, X509_STORE_CTX *ctx)
+namespace OpenSSL
 {
-	/* XXX: This will allow self signed certificates.
-	 * In the future if we want an option to not allow this,
-	 * we can just return preverify_ok here, and openssl
-	 * will boot off self-signed and invalid peer certs.
-	 */
-	int ve = X509_STORE_CTX_get_error(ctx);
-
-	SelfSigned = (ve == X509_V_ERR_DEPTH_ZERO_SELF_SIGNED_CERT);
-
-	return 1;
+	class HandshakeWorker;
+	class HandshakePool;
 }
 
+/** The threads which handshakes are done on or NULL if they are done on the main thread. */
+static OpenSSL::HandshakePool* handshakepool = NULL;
+
 class OpenSSLIOHook : public SSLIOHook
 {
  private:
@@ -577,14 +802,80 @@ class OpenSSLIOHook : public SSLIOHook
 	issl_status status;
 	bool data_to_write;
 
+	/** True if the handshake is done by worker threads and the session is using the socket directly until it is finished. */
+	const bool offloaded;
+
+	/** The worker thread which the next part of the handshake has been given to or NULL if there is none. */
+	OpenSSL::HandshakeWorker* worker;
+
+	/** True if a part of the handshake has been done but its result has not been handled yet. */
+	bool stepdone;
+
+	/** The return value of the last call to SSL_do_handshake(). */
+	int stepresult;
+
+	/** The error of the last call to SSL_do_handshake(). */
+	int steperror;
+
+	/** The first error OpenSSL queued during the last call to SSL_do_handshake() or 0 if there was none. This is
+	 * kept because the error queue is per thread so the queue of a worker thread can't be read by the main thread.
+	 */
+	unsigned long steperrcode;
+
+	/** Whether the peer certificate is self signed. Set by OnVerify(). */
+	bool selfsigned;
+
+	// Does the next part of the handshake. This may be called on a worker thread.
+	void DoHandshakeStep()
+	{
+		ERR_clear_error();
+		stepresult = SSL_do_handshake(sess);
+		steperror = (stepresult < 0 ? SSL_get_error(sess, stepresult) : SSL_ERROR_NONE);
+		steperrcode = (stepresult <= 0 ? ERR_peek_error() : 0);
+	}
+
+	// Gives the next part of the handshake to a worker thread
+	void QueueHandshake(StreamSocket* user);
+
+	// Waits for the worker thread to stop using the session
+	void CancelHandshake();
+
+	void SetBIO(StreamSocket* sock)
+	{
+		// Create BIO instance and store a pointer to the socket in it which will be used by the read and write functions
+#ifdef INSPIRCD_OPENSSL_OPAQUE_BIO
+		BIO* bio = BIO_new(biomethods);
+#else
+		BIO* bio = BIO_new(&biomethods);
+#endif
+		BIO_set_data(bio, sock);
+		SSL_set_bio(sess, bio, bio);
+	}
+
 	// Returns 1 if handshake succeeded, 0 if it is still in progress, -1 if it failed
 	int Handshake(StreamSocket* user)
 	{
-		ERR_clear_error();
-		int ret = SSL_do_handshake(sess);
+		if (worker)
+		{
+			// A worker thread is still busy with the handshake.
+			return 0;
+		}
+
+		if (!stepdone)
+		{
+			if (offloaded && handshakepool)
+			{
+				QueueHandshake(user);
+				return 0;
+			}
+			DoHandshakeStep();
+		}
+
+		stepdone = false;
+		int ret = stepresult;
 		if (ret < 0)
 		{
-			int err = SSL_get_error(sess, ret);
+			int err = steperror;
 
 			if (err == SSL_ERROR_WANT_READ)
 			{
@@ -600,6 +891,7 @@ class OpenSSLIOHook : public SSLIOHook
 			}
 			else
 			{
+				SetHandshakeError(user);
 				CloseSession();
 				return -1;
 			}
@@ -607,6 +899,21 @@ class OpenSSLIOHook : public SSLIOHook
 		else if (ret > 0)
 		{
 			// Handshake complete.
+			if (SSL_is_server(sess))
+				GetProfile().GetSessions().CountHandshake(SSL_session_reused(sess));
+
+			// Our BIO can be used now that the session is only used from the main thread.
+			if (offloaded && !GetProfile().UseKernelTLS())
+				SetBIO(user);
+
+#ifdef INSPIRCD_OPENSSL_HAS_KTLS
+			if (GetProfile().UseKernelTLS())
+			{
+				ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "Session %p is using kernel TLS for sending: %s receiving: %s", (void*)sess,
+					BIO_get_ktls_send(SSL_get_wbio(sess)) ? "yes" : "no", BIO_get_ktls_recv(SSL_get_rbio(sess)) ? "yes" : "no");
+			}
+#endif
+
 			VerifyCertificate();
 
 			status = ISSL_OPEN;
@@ -617,13 +924,28 @@ class OpenSSLIOHook : public SSLIOHook
 		}
 		else if (ret == 0)
 		{
+			SetHandshakeError(user);
 			CloseSession();
 		}
 		return -1;
 	}
 
+	// Sets the error of a socket whose handshake failed to the reason OpenSSL gave
+	void SetHandshakeError(StreamSocket* user)
+	{
+		if (!steperrcode)
+			return;
+
+		char error[256];
+		ERR_error_string_n(steperrcode, error, sizeof(error));
+		user->SetError("Handshake Failed - " + std::string(error));
+	}
+
 	void CloseSession()
 	{
+		if (worker)
+			CancelHandshake();
+
 		if (sess)
 		{
 			SSL_shutdown(sess);
@@ -652,7 +974,11 @@ class OpenSSLIOHook : public SSLIOHook
 
 		certinfo->invalid = (SSL_get_verify_result(sess) != X509_V_OK);
 
-		if (!SelfSigned)
+		// The certificate is not verified again when a session is resumed.
+		if (SSL_session_reused(sess))
+			selfsigned = (SSL_get_verify_result(sess) == X509_V_ERR_DEPTH_ZERO_SELF_SIGNED_CERT);
+
+		if (!selfsigned)
 		{
 			certinfo->unknownsigner = false;
 			certinfo->trusted = true;
@@ -702,6 +1028,12 @@ class OpenSSLIOHook : public SSLIOHook
 			// The other side is trying to renegotiate, kill the connection and change status
 			// to ISSL_NONE so CheckRenego() closes the session
 			status = ISSL_NONE;
+			if (GetProfile().UseKernelTLS())
+			{
+				SocketEngine::Shutdown(SSL_get_fd(sess), 2);
+				return;
+			}
+
 			BIO* bio = SSL_get_rbio(sess);
 			EventHandler* eh = static_cast<StreamSocket*>(BIO_get_data(bio));
 			SocketEngine::Shutdown(eh, 2);
@@ -737,21 +1069,42 @@ class OpenSSLIOHook : public SSLIOHook
 	// Calls our private SSLInfoCallback()
 	friend void StaticSSLInfoCallback(const SSL* ssl, int where, int rc);
 
+	// Sets selfsigned
+	friend int OnVerify(int preverify_ok, X509_STORE_CTX* ctx);
+
+	// Calls DoHandshakeStep() and OnHandshakeStepDone()
+	friend class OpenSSL::HandshakeWorker;
+
+	// Called on the main thread when a worker thread has done the next part of the handshake
+	void OnHandshakeStepDone(StreamSocket* user)
+	{
+		worker = NULL;
+		stepdone = true;
+
+		// Handle the result the next time the socket engine gets to this socket.
+		SocketEngine::ChangeEventMask(user, FD_ADD_TRIAL_READ);
+	}
+
  public:
 	OpenSSLIOHook(IOHookProvider* hookprov, StreamSocket* sock, SSL* session)
 		: SSLIOHook(hookprov)
 		, sess(session)
 		, status(ISSL_NONE)
 		, data_to_write(false)
+		, offloaded(handshakepool != NULL)
+		, worker(NULL)
+		, stepdone(false)
+		, stepresult(0)
+		, steperror(SSL_ERROR_NONE)
+		, steperrcode(0)
+		, selfsigned(false)
 	{
-		// Create BIO instance and store a pointer to the socket in it which will be used by the read and write functions
-#ifdef INSPIRCD_OPENSSL_OPAQUE_BIO
-		BIO* bio = BIO_new(biomethods);
-#else
-		BIO* bio = BIO_new(&biomethods);
-#endif
-		BIO_set_data(bio, sock);
-		SSL_set_bio(sess, bio, bio);
+		// OpenSSL can only give the keys of a session to the kernel when it is using the socket directly. Our BIO
+		// can't be used by worker threads so the socket is also used directly until an offloaded handshake is done.
+		if (GetProfile().UseKernelTLS() || offloaded)
+			SSL_set_fd(sess, sock->GetFd());
+		else
+			SetBIO(sock);
 
 		SSL_set_ex_data(sess, exdataindex, this);
 		sock->AddIOHook(this);
@@ -908,12 +1261,127 @@ class OpenSSLIOHook : public SSLIOHook
 	OpenSSL::Profile& GetProfile();
 };
 
+static int OnVerify(int preverify_ok, X509_STORE_CTX* ctx)
+{
+	/* XXX: This will allow self signed certificates.
+	 * In the future if we want an option to not allow this,
+	 * we can just return preverify_ok here, and openssl
+	 * will boot off self-signed and invalid peer certs.
+	 */
+	int ve = X509_STORE_CTX_get_error(ctx);
+
+	// This can be called on a worker thread so the result is stored in the hook of the session.
+	SSL* ssl = static_cast<SSL*>(X509_STORE_CTX_get_ex_data(ctx, SSL_get_ex_data_X509_STORE_CTX_idx()));
+	OpenSSLIOHook* hook = static_cast<OpenSSLIOHook*>(SSL_get_ex_data(ssl, exdataindex));
+	hook->selfsigned = (ve == X509_V_ERR_DEPTH_ZERO_SELF_SIGNED_CERT);
+
+	return 1;
+}
+
 static void StaticSSLInfoCallback(const SSL* ssl, int where, int rc)
 {
 	OpenSSLIOHook* hook = static_cast<OpenSSLIOHook*>(SSL_get_ex_data(ssl, exdataindex));
 	hook->SSLInfoCallback(where, rc);
 }
 
+static OpenSSL::SessionState* GetSessionState(SSL_CTX* ctx)
+{
+	return static_cast<OpenSSL::SessionState*>(SSL_CTX_get_app_data(ctx));
+}
+
+static std::string GetSessionId(const SSL_SESSION* sess)
+{
+	unsigned int idlen;
+	const unsigned char* id = SSL_SESSION_get_id(sess, &idlen);
+	return std::string(reinterpret_cast<const char*>(id), idlen);
+}
+
+static int OnNewSession(SSL* ssl, SSL_SESSION* sess)
+{
+	int size = i2d_SSL_SESSION(sess, NULL);
+	if (size <= 0)
+		return 0;
+
+	std::string data(size, '\0');
+	unsigned char* ptr = reinterpret_cast<unsigned char*>(&data[0]);
+	if (i2d_SSL_SESSION(sess, &ptr) != size)
+		return 0;
+
+	GetSessionState(SSL_get_SSL_CTX(ssl))->Store(GetSessionId(sess), data);
+
+	// We have stored a copy so OpenSSL can free the session whenever it wants to.
+	return 0;
+}
+
+static SSL_SESSION* OnGetSession(SSL* ssl, SessionIdType* id, int idlen, int* copy)
+{
+	std::string data;
+	*copy = 0;
+	if (!GetSessionState(SSL_get_SSL_CTX(ssl))->Retrieve(std::string(reinterpret_cast<const char*>(id), idlen), data))
+		return NULL;
+
+	const unsigned char* ptr = reinterpret_cast<const unsigned char*>(data.data());
+	return d2i_SSL_SESSION(NULL, &ptr, data.length());
+}
+
+static void OnRemoveSession(SSL_CTX* ctx, SSL_SESSION* sess)
+{
+	GetSessionState(ctx)->Remove(GetSessionId(sess));
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+static bool SetTicketMACKey(EVP_MAC_CTX* macctx, const OpenSSL::SessionState::TicketKey* key)
+{
+	OSSL_PARAM params[3];
+	params[0] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, const_cast<unsigned char*>(key->hmackey), sizeof(key->hmackey));
+	params[1] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, const_cast<char*>("sha256"), 0);
+	params[2] = OSSL_PARAM_construct_end();
+	return EVP_MAC_CTX_set_params(macctx, params);
+}
+
+static int OnTicketKey(SSL* ssl, unsigned char* keyname, unsigned char* iv, EVP_CIPHER_CTX* cipherctx, EVP_MAC_CTX* macctx, int enc)
+#else
+static bool SetTicketMACKey(HMAC_CTX* macctx, const OpenSSL::SessionState::TicketKey* key)
+{
+	return HMAC_Init_ex(macctx, key->hmackey, sizeof(key->hmackey), EVP_sha256(), NULL);
+}
+
+static int OnTicketKey(SSL* ssl, unsigned char* keyname, unsigned char* iv, EVP_CIPHER_CTX* cipherctx, HMAC_CTX* macctx, int enc)
+#endif
+{
+	OpenSSL::SessionState* state = GetSessionState(SSL_get_SSL_CTX(ssl));
+	OpenSSL::SessionState::TicketKey key;
+	int ret;
+	if (enc)
+	{
+		// Returning 0 makes OpenSSL continue the handshake without sending a ticket.
+		if (!state->GetEncryptionKey(key) || RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) <= 0)
+			ret = 0;
+		else if (!EVP_EncryptInit_ex(cipherctx, EVP_aes_256_cbc(), NULL, key.aeskey, iv) || !SetTicketMACKey(macctx, &key))
+			ret = -1;
+		else
+		{
+			memcpy(keyname, key.name, sizeof(key.name));
+			ret = 1;
+		}
+	}
+	else
+	{
+		// Returning 0 makes OpenSSL do a full handshake and returning 2 makes it send a new ticket.
+		bool renew = false;
+		if (!state->FindDecryptionKey(keyname, key, renew))
+			ret = 0;
+		else if (!EVP_DecryptInit_ex(cipherctx, EVP_aes_256_cbc(), NULL, key.aeskey, iv) || !SetTicketMACKey(macctx, &key))
+			ret = -1;
+		else
+			ret = renew ? 2 : 1;
+	}
+
+	// The key was copied out of the session state so don't leave it lying around.
+	OPENSSL_cleanse(&key, sizeof(key));
+	return ret;
+}
+
 static int OpenSSL::BIOMethod::write(BIO* bio, const char* buffer, int size)
 {
 	BIO_clear_retry_flags(bio);
@@ -965,9 +1433,9 @@ class OpenSSLIOHookProvider : public SSLIOHookProvider
 	OpenSSL::Profile profile;
 
  public:
-	OpenSSLIOHookProvider(Module* mod, const std::string& profilename, ConfigTag* tag)
+	OpenSSLIOHookProvider(Module* mod, const std::string& profilename, ConfigTag* tag, OpenSSL::SessionState* sessions)
 		: SSLIOHookProvider(mod, profilename)
-		, profile(profilename, tag)
+		, profile(profilename, tag, sessions)
 	{
 		ServerInstance->Modules->AddService(*this);
 	}
@@ -996,12 +1464,235 @@ OpenSSL::Profile& OpenSSLIOHook::GetProfile()
 	return static_cast<OpenSSLIOHookProvider*>(hookprov)->GetProfile();
 }
 
-class ModuleSSLOpenSSL : public Module
+/** Does the handshakes of sessions so that the main thread doesn't have to. */
+class OpenSSL::HandshakeWorker : public SocketThread
+{
+	/** A part of a handshake which has been given to a worker. */
+	struct Job
+	{
+		/** The hook of the session. */
+		OpenSSLIOHook* hook;
+
+		/** The socket which the session is using. */
+		StreamSocket* sock;
+
+		Job(OpenSSLIOHook* h, StreamSocket* s)
+			: hook(h)
+			, sock(s)
+		{
+		}
+	};
+
+	typedef std::deque<Job> JobQueue;
+
+	/** The jobs which are waiting for this worker. */
+	JobQueue queue;
+
+	/** The jobs which this worker has done but which the main thread has not handled yet. */
+	JobQueue done;
+
+	/** The hook of the job which is being done or NULL if this worker is idle. */
+	OpenSSLIOHook* current;
+
+	static void RemoveJobs(JobQueue& jobs, OpenSSLIOHook* hook)
+	{
+		for (JobQueue::iterator i = jobs.begin(); i != jobs.end(); )
+		{
+			if (i->hook == hook)
+				i = jobs.erase(i);
+			else
+				++i;
+		}
+	}
+
+ public:
+	HandshakeWorker()
+		: current(NULL)
+	{
+	}
+
+	/** Give the next part of a handshake to this worker.
+	 * @param hook The hook of the session.
+	 * @param sock The socket which the session is using.
+	 */
+	void Queue(OpenSSLIOHook* hook, StreamSocket* sock)
+	{
+		LockQueue();
+		queue.push_back(Job(hook, sock));
+		UnlockQueueWakeup();
+	}
+
+	/** Forget about the handshake of a session, waiting for this worker if it is using the session right now.
+	 * @param hook The hook of the session.
+	 */
+	void Cancel(OpenSSLIOHook* hook)
+	{
+		LockQueue();
+		RemoveJobs(queue, hook);
+
+		// The worker wakes us up when it has finished a job. It never waits itself while it is busy.
+		while (current == hook)
+			WaitForQueue();
+
+		RemoveJobs(done, hook);
+		UnlockQueue();
+	}
+
+	/** Do the jobs which were still waiting when this worker was stopped on the main thread. */
+	void Drain()
+	{
+		for (JobQueue::const_iterator i = queue.begin(); i != queue.end(); ++i)
+		{
+			i->hook->DoHandshakeStep();
+			done.push_back(*i);
+		}
+		queue.clear();
+		OnNotify();
+	}
+
+	void Run() CXX11_OVERRIDE
+	{
+		LockQueue();
+		while (true)
+		{
+			while (queue.empty() && !GetExitFlag())
+				WaitForQueue();
+
+			if (GetExitFlag())
+				break;
+
+			Job job = queue.front();
+			queue.pop_front();
+			current = job.hook;
+			UnlockQueue();
+
+			job.hook->DoHandshakeStep();
+
+			LockQueue();
+			current = NULL;
+			done.push_back(job);
+			UnlockQueueWakeup();
+			NotifyParent();
+			LockQueue();
+		}
+		UnlockQueue();
+	}
+
+	void OnNotify() CXX11_OVERRIDE
+	{
+		// Jobs are taken one at a time as handling one can cancel another.
+		while (true)
+		{
+			LockQueue();
+			if (done.empty())
+			{
+				UnlockQueue();
+				break;
+			}
+
+			Job job = done.front();
+			done.pop_front();
+			UnlockQueue();
+
+			job.hook->OnHandshakeStepDone(job.sock);
+		}
+	}
+};
+
+/** The threads which handshakes are given to. */
+class OpenSSL::HandshakePool
+{
+	/** The worker threads. */
+	std::vector<HandshakeWorker*> workers;
+
+	/** The index of the worker which the next handshake will be given to. */
+	size_t next;
+
+ public:
+	/** Start the worker threads.
+	 * @param threads The number of worker threads to start.
+	 */
+	HandshakePool(unsigned int threads)
+		: next(0)
+	{
+		for (unsigned int i = 0; i < threads; ++i)
+		{
+			HandshakeWorker* worker = new HandshakeWorker;
+			ServerInstance->Threads.Start(worker);
+			workers.push_back(worker);
+		}
+	}
+
+	/** Stop the worker threads, finishing any work given to them on the main thread. */
+	~HandshakePool()
+	{
+		for (std::vector<HandshakeWorker*>::const_iterator i = workers.begin(); i != workers.end(); ++i)
+		{
+			HandshakeWorker* worker = *i;
+			worker->join();
+			worker->Drain();
+			delete worker;
+		}
+	}
+
+	/** Retrieves the number of worker threads. */
+	size_t GetThreadCount() const { return workers.size(); }
+
+	/** Give the next part of a handshake to a worker thread.
+	 * @param hook The hook of the session.
+	 * @param sock The socket which the session is using.
+	 * @return The worker which the handshake was given to.
+	 */
+	HandshakeWorker* Queue(OpenSSLIOHook* hook, StreamSocket* sock)
+	{
+		HandshakeWorker* worker = workers[next++ % workers.size()];
+		worker->Queue(hook, sock);
+		return worker;
+	}
+};
+
+void OpenSSLIOHook::QueueHandshake(StreamSocket* user)
+{
+	// The socket is left alone until the worker is done with it.
+	this->status = ISSL_HANDSHAKING;
+	SocketEngine::ChangeEventMask(user, FD_WANT_NO_READ | FD_WANT_NO_WRITE);
+	worker = handshakepool->Queue(this, user);
+}
+
+void OpenSSLIOHook::CancelHandshake()
+{
+	worker->Cancel(this);
+	worker = NULL;
+}
+
+class ModuleSSLOpenSSL
+	: public Module
+	, public Stats::EventListener
 {
 	typedef std::vector<reference<OpenSSLIOHookProvider> > ProfileList;
+	typedef std::map<std::string, reference<OpenSSL::SessionState> > SessionStateMap;
 
 	ProfileList profiles;
 
+	/** Session resumption state for each profile, by name. This is kept here so that it survives a rehash. */
+	SessionStateMap sessionstates;
+
+	OpenSSL::SessionState* GetSessionState(const std::string& name, ConfigTag* tag)
+	{
+		// Sessions and the keys their tickets were encrypted with are forgotten when the settings which decide
+		// whether a peer certificate is trusted change as resuming a session skips verifying the certificate.
+		const std::string settings = SSLSessionCache::ReadTrustSettings(tag);
+		unsigned char md[EVP_MAX_MD_SIZE];
+		unsigned int mdlen = 0;
+		EVP_Digest(settings.data(), settings.length(), md, &mdlen, EVP_sha256(), NULL);
+		const std::string trust(reinterpret_cast<const char*>(md), mdlen);
+
+		reference<OpenSSL::SessionState>& state = sessionstates[name];
+		if (!state || state->GetTrust() != trust)
+			state = new OpenSSL::SessionState(trust);
+		return state;
+	}
+
 	void ReadProfiles()
 	{
 		ProfileList newprofiles;
@@ -1015,7 +1706,8 @@ class ModuleSSLOpenSSL : public Module
 
 			try
 			{
-				newprofiles.push_back(new OpenSSLIOHookProvider(this, defname, tag));
+				OpenSSL::SessionState* sessions = GetSessionState(defname, tag);
+				newprofiles.push_back(new OpenSSLIOHookProvider(this, defname, tag, sessions));
 			}
 			catch (OpenSSL::Exception& ex)
 			{
@@ -1041,40 +1733,65 @@ class ModuleSSLOpenSSL : public Module
 					continue;
 				}
 
-				reference<OpenSSLIOHookProvider> prov;
+				reference<OpenSSLIOHookProvider> provider;
 				try
 				{
-					prov = new OpenSSLIOHookProvider(this, name, tag);
+					OpenSSL::SessionState* sessions = GetSessionState(name, tag);
+					provider = new OpenSSLIOHookProvider(this, name, tag, sessions);
 				}
 				catch (CoreException& ex)
 				{
 					throw ModuleException("Error while initializing TLS (SSL) profile \"" + name + "\" at " + tag->getTagLocation() + " - " + ex.GetReason());
 				}
 
-				newprofiles.push_back(prov);
+				newprofiles.push_back(provider);
 			}
 		}
 
 		for (ProfileList::iterator i = profiles.begin(); i != profiles.end(); ++i)
 		{
-			OpenSSLIOHookProvider& prov = **i;
-			ServerInstance->Modules.DelService(prov);
+			OpenSSLIOHookProvider& provider = **i;
+			ServerInstance->Modules.DelService(provider);
 		}
 
 		profiles.swap(newprofiles);
+
+		// Forget the sessions of profiles which no longer exist.
+		for (SessionStateMap::iterator i = sessionstates.begin(); i != sessionstates.end(); )
+		{
+			bool found = false;
+			for (ProfileList::const_iterator j = profiles.begin(); j != profiles.end(); ++j)
+			{
+				if ((*j)->GetProfile().GetName() == i->first)
+				{
+					found = true;
+					break;
+				}
+			}
+
+			if (found)
+				++i;
+			else
+				sessionstates.erase(i++);
+		}
 	}
 
  public:
 	ModuleSSLOpenSSL()
+		: Stats::EventListener(this)
 	{
 		// Initialize OpenSSL
 		OPENSSL_init_ssl(0, NULL);
 #ifdef INSPIRCD_OPENSSL_OPAQUE_BIO
 		biomethods = OpenSSL::BIOMethod::alloc();
+#endif
 	}
 
 	~ModuleSSLOpenSSL()
 	{
+		delete handshakepool;
+		handshakepool = NULL;
+#ifdef INSPIRCD_OPENSSL_OPAQUE_BIO
 		BIO_meth_free(biomethods);
 #endif
 	}
@@ -1095,6 +1812,21 @@ class ModuleSSLOpenSSL : public Module
 		ConfigTag* tag = ServerInstance->Config->ConfValue("openssl");
 		if (status.initial || tag->getBool("onrehash"))
 			ReadProfiles();
+
+		unsigned int handshakethreads = tag->getUInt("handshakethreads", 0, 0, 64);
+#if OPENSSL_VERSION_NUMBER < 0x10100000L && !defined LIBRESSL_VERSION_NUMBER
+		// Versions before 1.1.0 need locking callbacks to be installed before they can be used from several threads.
+		if (handshakethreads)
+		{
+			ServerInstance->Logs->Log(MODNAME, LOG_DEFAULT, "WARNING: <openssl:handshakethreads> requires OpenSSL 1.1.0 or newer, handshakes will be done on the main thread.");
+			handshakethreads = 0;
+		}
+#endif
+		if ((handshakepool ? handshakepool->GetThreadCount() : 0) != handshakethreads)
+		{
+			delete handshakepool;
+			handshakepool = handshakethreads ? new OpenSSL::HandshakePool(handshakethreads) : NULL;
+		}
 	}
 
 	void OnModuleRehash(User* user, const std::string &param) CXX11_OVERRIDE
@@ -1136,6 +1868,23 @@ class ModuleSSLOpenSSL : public Module
 		return MOD_RES_PASSTHRU;
 	}
 
+	ModResult OnStats(Stats::Context& stats) CXX11_OVERRIDE
+	{
+		if (stats.GetSymbol() != 't')
+			return MOD_RES_PASSTHRU;
+
+		for (ProfileList::const_iterator i = profiles.begin(); i != profiles.end(); ++i)
+		{
+			OpenSSL::Profile& profile = (*i)->GetProfile();
+			const OpenSSL::SessionState& sessions = profile.GetSessions();
+			stats.AddRow(249, InspIRCd::Format("TLSSESSIONS \"%s\" (OpenSSL) had %lu hits and %lu misses and has %lu cached sessions",
+				profile.GetName().c_str(), sessions.GetHits(), sessions.GetMisses(), (unsigned long)sessions.GetSize()));
+		}
+
+		// Other TLS (SSL) modules may have profiles too.
+		return MOD_RES_PASSTHRU;
+	}
+
 	Version GetVersion() CXX11_OVERRIDE
 	{
 		return Version("Allows TLS (SSL) encrypted connections using the OpenSSL library.", VF_VENDOR);
@@ -169,6 +169,323 @@ class FilterResult
 	}
 };
 
+/** Finds the filters which might match a message without running every regex against it. For
+ * each filter a literal string which any message matching it has to contain is extracted from
+ * its pattern and the message is searched for all of these strings at once using the
+ * Aho-Corasick algorithm. Filters which no literal string could be extracted from always have
+ * to be checked.
+ */
+class FilterPrefilter
+{
+	/** The characters which can be part of a literal string. */
+	static const char* const LITERAL_CHARS;
+
+	/** The shortest literal string which is worth searching for. */
+	static const size_t MIN_LITERAL_LENGTH = 3;
+
+	/** Maps a character to its index in the alphabet or 0 if it can not be part of a literal string. */
+	unsigned char classes[UCHAR_MAX + 1];
+
+	/** The number of characters in the alphabet including the one used for all other characters. */
+	size_t alphabetsize;
+
+	/** The state to move to from each state for each character in the alphabet. */
+	std::vector<unsigned int> transitions;
+
+	/** The filters whose literal string has been found when the search reaches each state. */
+	std::vector<std::vector<size_t> > outputs;
+
+	/** The filters which have to be checked regardless of the message. */
+	std::vector<bool> always;
+
+	static bool IsLiteralChar(char chr)
+	{
+		return (chr >= 'a' && chr <= 'z') || (chr >= 'A' && chr <= 'Z') || (chr >= '0' && chr <= '9') || (chr && strchr(LITERAL_CHARS, chr));
+	}
+
+	static void KeepLongest(std::string& current, std::string& longest)
+	{
+		if (current.length() > longest.length())
+			longest.swap(current);
+		current.clear();
+	}
+
+	/** Extracts the longest literal string from a glob pattern. */
+	static std::string GetGlobLiteral(const std::string& pattern)
+	{
+		std::string current;
+		std::string longest;
+		for (std::string::const_iterator i = pattern.begin(); i != pattern.end(); ++i)
+		{
+			if (IsLiteralChar(*i))
+				current.push_back(*i);
+			else
+				KeepLongest(current, longest);
+		}
+		KeepLongest(current, longest);
+		return longest;
+	}
+
+	/** Skips over an escape sequence in a regular expression.
+	 * @param pattern The regular expression.
+	 * @param pos The position of the backslash which starts the escape sequence.
+	 * @return The position of the last character of the escape sequence.
+	 */
+	static size_t SkipEscape(const std::string& pattern, size_t pos)
+	{
+		size_t end = pos + 1;
+		if (end >= pattern.length())
+			return end;
+
+		const char chr = pattern[end];
+		if (chr >= '0' && chr <= '9')
+		{
+			// Back references and octal escapes.
+			while (end + 1 < pattern.length() && isdigit(pattern[end + 1]))
+				end++;
+		}
+		else if (chr == 'c')
+		{
+			// Control characters (e.g. \cA).
+			end++;
+		}
+		else if (chr && strchr("gkNoPpux", chr))
+		{
+			// Escapes which take an argument (e.g. \x41, \x{41}, \pL, \p{L} or \k<name>).
+			const char open = (end + 1 < pattern.length()) ? pattern[end + 1] : 0;
+			const char* close = (open == '{') ? "}" : (open == '<') ? ">" : (open == '\'') ? "'" : NULL;
+			if (close)
+			{
+				end = pattern.find(close, end + 2);
+				if (end == std::string::npos)
+					end = pattern.length();
+			}
+			else
+			{
+				for (size_t count = 0; count < 4 && end + 1 < pattern.length() && isalnum(pattern[end + 1]); ++count)
+					end++;
+			}
+		}
+		return end;
+	}
+
+	/** Extracts the longest literal string outside of any group from an extended regular expression. */
+	static std::string GetRegexLiteral(const std::string& pattern)
+	{
+		// Alternations, inline options (e.g. extended mode in PCRE) and quoting are too much
+		// hassle to handle correctly so filters using them are always checked.
+		if (pattern.find('|') != std::string::npos || pattern.find("(?") != std::string::npos || pattern.find("\\Q") != std::string::npos)
+			return std::string();
+
+		std::string current;
+		std::string longest;
+		size_t depth = 0;
+		for (size_t i = 0; i < pattern.length(); ++i)
+		{
+			const char chr = pattern[i];
+			if (!depth && IsLiteralChar(chr))
+			{
+				current.push_back(chr);
+				continue;
+			}
+
+			// These quantifiers make the character before them optional.
+			if ((chr == '?' || chr == '*' || chr == '{') && !current.empty())
+				current.erase(current.length() - 1);
+			KeepLongest(current, longest);
+
+			switch (chr)
+			{
+				case '\\':
+					i = SkipEscape(pattern, i);
+					break;
+
+				case '(':
+					depth++;
+					break;
+
+				case ')':
+					if (depth)
+						depth--;
+					break;
+
+				case '{':
+				{
+					// Skip the bounds of the quantifier so they are not mistaken for part of the message.
+					const size_t end = pattern.find('}', i + 1);
+					if (end != std::string::npos)
+						i = end;
+					break;
+				}
+
+				case '[':
+				{
+					// Skip the bracket expression. A closing bracket at the start is part of it.
+					size_t end = i + 1;
+					if (end < pattern.length() && pattern[end] == '^')
+						end++;
+					if (end < pattern.length() && pattern[end] == ']')
+						end++;
+
+					for (; end < pattern.length() && pattern[end] != ']'; ++end)
+					{
+						if (pattern[end] == '\\')
+						{
+							end++;
+						}
+						else if (pattern[end] == '[' && end + 1 < pattern.length() && strchr(":.=", pattern[end + 1]))
+						{
+							// Skip character classes like [:alpha:] which end with their own bracket.
+							end = pattern.find(std::string(1, pattern[end + 1]) + "]", end + 2);
+							if (end == std::string::npos)
+								return std::string();
+							end++;
+						}
+					}
+
+					if (end >= pattern.length())
+						return std::string();
+					i = end;
+					break;
+				}
+			}
+		}
+
+		KeepLongest(current, longest);
+		return longest;
+	}
+
+	/** Extracts a literal string which any message matching a pattern has to contain.
+	 * @param engine The name of the regex engine the pattern is for.
+	 * @param pattern The pattern to extract a literal string from.
+	 * @return The literal string in lower case or an empty string if none could be extracted.
+	 */
+	static std::string GetLiteral(const std::string& engine, const std::string& pattern)
+	{
+		std::string literal;
+		if (engine == "regex/glob")
+			literal = GetGlobLiteral(pattern);
+		else if (engine == "regex/pcre" || engine == "regex/re2" || engine == "regex/tre")
+			literal = GetRegexLiteral(pattern);
+
+		// The other engines can be configured to use syntaxes where the characters above
+		// have different meanings so their filters always have to be checked.
+		if (literal.length() < MIN_LITERAL_LENGTH)
+			return std::string();
+
+		std::transform(literal.begin(), literal.end(), literal.begin(), ::tolower);
+		return literal;
+	}
+
+ public:
+	FilterPrefilter()
+		: alphabetsize(1)
+		, transitions(1, 0)
+		, outputs(1)
+	{
+		memset(classes, 0, sizeof(classes));
+	}
+
+	/** Builds the automaton for a set of filters.
+	 * @param engine The name of the regex engine the filters are using.
+	 * @param filters The filters to build the automaton for.
+	 */
+	void Build(const std::string& engine, const std::vector<FilterResult>& filters)
+	{
+		// Upper and lower case letters share the same index so the search is case insensitive.
+		memset(classes, 0, sizeof(classes));
+		alphabetsize = 1;
+		for (unsigned int chr = 1; chr <= UCHAR_MAX; ++chr)
+		{
+			if (IsLiteralChar(chr) && !(chr >= 'A' && chr <= 'Z'))
+				classes[chr] = alphabetsize++;
+		}
+		for (unsigned int chr = 'A'; chr <= 'Z'; ++chr)
+			classes[chr] = classes[chr - 'A' + 'a'];
+
+		// Build a trie of the literal strings. Zero means there is no transition yet as
+		// nothing can move back to the root state while building the trie.
+		transitions.assign(alphabetsize, 0);
+		outputs.assign(1, std::vector<size_t>());
+		always.assign(filters.size(), false);
+		for (size_t filter = 0; filter < filters.size(); ++filter)
+		{
+			const std::string literal = GetLiteral(engine, filters[filter].freeform);
+			if (literal.empty())
+			{
+				always[filter] = true;
+				continue;
+			}
+
+			unsigned int state = 0;
+			for (std::string::const_iterator chr = literal.begin(); chr != literal.end(); ++chr)
+			{
+				unsigned int& next = transitions[state * alphabetsize + classes[static_cast<unsigned char>(*chr)]];
+				if (!next)
+				{
+					next = outputs.size();
+					outputs.push_back(std::vector<size_t>());
+					transitions.resize(transitions.size() + alphabetsize, 0);
+				}
+				state = transitions[state * alphabetsize + classes[static_cast<unsigned char>(*chr)]];
+			}
+			outputs[state].push_back(filter);
+		}
+
+		// Add the failure transitions breadth first so the state each state falls back to
+		// is always complete when it is needed.
+		std::vector<unsigned int> fallback(outputs.size(), 0);
+		std::deque<unsigned int> queue;
+		for (size_t chr = 1; chr < alphabetsize; ++chr)
+		{
+			if (transitions[chr])
+				queue.push_back(transitions[chr]);
+		}
+
+		while (!queue.empty())
+		{
+			const unsigned int state = queue.front();
+			queue.pop_front();
+
+			for (size_t chr = 1; chr < alphabetsize; ++chr)
+			{
+				unsigned int& next = transitions[state * alphabetsize + chr];
+				const unsigned int fallbacknext = transitions[fallback[state] * alphabetsize + chr];
+				if (!next)
+				{
+					next = fallbacknext;
+					continue;
+				}
+
+				fallback[next] = fallbacknext;
+				outputs[next].insert(outputs[next].end(), outputs[fallbacknext].begin(), outputs[fallbacknext].end());
+				queue.push_back(next);
+			}
+		}
+	}
+
+	/** Finds the filters which might match a message.
+	 * @param text The message to search.
+	 * @param candidates Set to true for each filter which might match the message.
+	 */
+	void Search(const std::string& text, std::vector<bool>& candidates) const
+	{
+		candidates = always;
+
+		unsigned int state = 0;
+		for (std::string::const_iterator chr = text.begin(); chr != text.end(); ++chr)
+		{
+			state = transitions[state * alphabetsize + classes[static_cast<unsigned char>(*chr)]];
+
+			const std::vector<size_t>& found = outputs[state];
+			for (std::vector<size_t>::const_iterator filter = found.begin(); filter != found.end(); ++filter)
+				candidates[*filter] = true;
+		}
+	}
+};
+
+const char* const FilterPrefilter::LITERAL_CHARS = " !\"#%&',-/:;<=>@_";
+
 class CommandFilter : public Command
 {
  public:
@@ -198,6 +515,8 @@ class ModuleFilter
 	bool notifyuser;
 	bool warnonselfmsg;
 	bool dirty;
+	bool prefilterdirty;
+	FilterPrefilter prefilter;
 	std::string filterconf;
 	RegexFactory* factory;
 	void FreeFilters();
@@ -357,6 +676,7 @@ ModuleFilter::ModuleFilter()
 	, Timer(0, true)
 	, initing(true)
 	, dirty(false)
+	, prefilterdirty(true)
 	, filtcommand(this)
 	, RegexEngine(this, "regex")
 {
@@ -380,6 +700,7 @@ void ModuleFilter::FreeFilters()
 
 	filters.clear();
 	dirty = true;
+	prefilterdirty = true;
 }
 
 ModResult ModuleFilter::OnUserPreMessage(User* user, const MessageTarget& msgtarget, MessageDetails& details)
@@ -763,9 +1084,21 @@ FilterResult* ModuleFilter::FilterMatch(User* user, const std::string &text, int
 	static std::string stripped_text;
 	stripped_text.clear();
 
-	for (std::vector<FilterResult>::iterator i = filters.begin(); i != filters.end(); ++i)
+	if (prefilterdirty)
 	{
-		FilterResult* filter = &*i;
+		prefilter.Build(RegexEngine ? RegexEngine->name : "", filters);
+		prefilterdirty = false;
+	}
+
+	// Only the filters which the prefilter finds might match have to be checked.
+	static std::vector<bool> candidates;
+	static std::vector<bool> stripped_candidates;
+	bool stripped_searched = false;
+	prefilter.Search(text, candidates);
+
+	for (size_t index = 0; index < filters.size(); ++index)
+	{
+		FilterResult* filter = &filters[index];
 
 		/* Skip ones that dont apply to us */
 		if (!AppliesToMe(user, filter, flgs))
@@ -777,6 +1110,20 @@ FilterResult* ModuleFilter::FilterMatch(User* user, const std::string &text, int
 			InspIRCd::StripColor(stripped_text);
 		}
 
+		if (filter->flag_strip_color)
+		{
+			if (!stripped_searched)
+			{
+				prefilter.Search(stripped_text, stripped_candidates);
+				stripped_searched = true;
+			}
+
+			if (!stripped_candidates[index])
+				continue;
+		}
+		else if (!candidates[index])
+			continue;
+
 		if (filter->regex->Matches(filter->flag_strip_color ? stripped_text : text))
 			return filter;
 	}
@@ -793,6 +1140,7 @@ bool ModuleFilter::DeleteFilter(const std::string& freeform, std::string& reason
 			delete i->regex;
 			filters.erase(i);
 			dirty = true;
+			prefilterdirty = true;
 			return true;
 		}
 	}
@@ -813,6 +1161,7 @@ std::pair<bool, std::string> ModuleFilter::AddFilter(const std::string& freeform
 	{
 		filters.push_back(FilterResult(RegexEngine, freeform, reason, type, duration, flgs, config));
 		dirty = true;
+		prefilterdirty = true;
 	}
 	catch (ModuleException &e)
 	{
@@ -872,6 +1221,7 @@ void ModuleFilter::ReadFilters()
 			removedfilters.insert(filter->freeform);
 			delete filter->regex;
 			filter = filters.erase(filter);
+			prefilterdirty = true;
 			continue;
 		}
 
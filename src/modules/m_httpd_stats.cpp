@@ -275,6 +275,31 @@ namespace Stats
 // This is currently not implemented, so, commented out.
 //					data << "<opercount>" << b->opercount << "</opercount>";
 			data << "<lagmillisecs>" << b->latencyms << "</lagmillisecs>";
+			data << "<linespersec>" << b->linespersec << "</linespersec>";
+			data << "<bytesperflush>" << b->bytesperflush << "</bytesperflush>";
+			data << "<sendqpeak>" << b->sendqpeak << "</sendqpeak>";
+			data << "<burstsendmillisecs>" << b->burstsendtime << "</burstsendmillisecs>";
+			data << "<burstrecvmillisecs>" << b->burstrecvtime << "</burstrecvmillisecs>";
+			if (!b->commands.empty())
+			{
+				data << "<linkcommands>";
+				for (ProtocolInterface::CommandStatsMap::const_iterator c = b->commands.begin(); c != b->commands.end(); ++c)
+				{
+					const ProtocolInterface::CommandStats& stats = c->second;
+					data << "<command><name>" << Sanitize(c->first) << "</name>";
+					data << "<received>" << stats.received << "</received>";
+					data << "<bytesin>" << stats.bytesin << "</bytesin>";
+					data << "<sent>" << stats.sent << "</sent>";
+					data << "<bytesout>" << stats.bytesout << "</bytesout>";
+					data << "<handleusecs>" << stats.handletime << "</handleusecs>";
+					data << "<maxhandleusecs>" << stats.maxhandletime << "</maxhandleusecs>";
+					data << "<histogram>";
+					for (size_t i = 0; i < ProtocolInterface::CommandStats::HISTOGRAM_BUCKETS; ++i)
+						data << "<bucket>" << stats.histogram[i] << "</bucket>";
+					data << "</histogram></command>";
+				}
+				data << "</linkcommands>";
+			}
 			data << "</server>";
 		}
 
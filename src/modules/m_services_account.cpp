@@ -123,6 +123,7 @@ class AccountExtItemImpl : public AccountExtItem
 		StringExtItem::FromNetwork(container, value);
 
 		User* user = static_cast<User*>(container);
+		user->InvalidateBanCache();
 		if (IS_LOCAL(user))
 		{
 			if (value.empty())
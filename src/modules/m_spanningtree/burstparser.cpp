@@ -0,0 +1,158 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "inspircd.h"
+
+#include "burstparser.h"
+#include "treesocket.h"
+
+/** Lines are split on the calling thread if there are fewer than this many of them. */
+static const size_t MinParallelLines = 64;
+
+class BurstParser::Worker CXX11_FINAL : public QueuedThread
+{
+	BurstParser* const parent;
+
+	/** The lines which are being split or NULL if the worker is idle. */
+	LineList* lines;
+
+	/** The index of the first line to split. */
+	size_t first;
+
+	/** The index after the last line to split. */
+	size_t last;
+
+ public:
+	Worker(BurstParser* p)
+		: parent(p)
+		, lines(NULL)
+		, first(0)
+		, last(0)
+	{
+	}
+
+	/** Give lines to this worker to split.
+	 * @param list The list of lines.
+	 * @param begin The index of the first line to split.
+	 * @param end The index after the last line to split.
+	 */
+	void Queue(LineList& list, size_t begin, size_t end)
+	{
+		LockQueue();
+		lines = &list;
+		first = begin;
+		last = end;
+		UnlockQueueWakeup();
+	}
+
+	void Run() CXX11_OVERRIDE
+	{
+		LockQueue();
+		while (true)
+		{
+			while (!lines && !GetExitFlag())
+				WaitForQueue();
+
+			if (GetExitFlag())
+				break;
+
+			UnlockQueue();
+			BurstParser::Split(*lines, first, last);
+			LockQueue();
+
+			lines = NULL;
+			parent->FinishWorker();
+		}
+		UnlockQueue();
+	}
+};
+
+BurstParser::BurstParser(unsigned int threads)
+	: pending(0)
+{
+	for (unsigned int i = 0; i < threads; ++i)
+	{
+		Worker* worker = new Worker(this);
+		ServerInstance->Threads.Start(worker);
+		workers.push_back(worker);
+	}
+}
+
+BurstParser::~BurstParser()
+{
+	for (std::vector<Worker*>::const_iterator i = workers.begin(); i != workers.end(); ++i)
+	{
+		Worker* worker = *i;
+		worker->join();
+		delete worker;
+	}
+}
+
+void BurstParser::FinishWorker()
+{
+	done.Lock();
+	if (!--pending)
+		done.Wakeup();
+	done.Unlock();
+}
+
+void BurstParser::Split(LineList& lines, size_t first, size_t last)
+{
+	for (size_t i = first; i < last; ++i)
+	{
+		Line& line = lines[i];
+		line.compact = TreeSocket::IsCompactLine(line.line);
+		if (line.compact)
+			TreeSocket::DecodeCompactLine(line.line, line.params, line.error);
+		else
+			TreeSocket::Split(line.line, line.tags, line.prefix, line.command, line.params, line.error);
+	}
+}
+
+void BurstParser::Split(LineList& lines)
+{
+	if (workers.empty() || lines.size() < MinParallelLines)
+	{
+		Split(lines, 0, lines.size());
+		return;
+	}
+
+	// The lines are divided evenly between the workers and this thread, which takes the first part.
+	const size_t parts = workers.size() + 1;
+	const size_t partsize = (lines.size() + parts - 1) / parts;
+
+	size_t used = 0;
+	while ((used < workers.size()) && ((used + 1) * partsize < lines.size()))
+		used++;
+
+	done.Lock();
+	pending = used;
+	done.Unlock();
+
+	for (size_t i = 0; i < used; ++i)
+	{
+		const size_t first = (i + 1) * partsize;
+		workers[i]->Queue(lines, first, std::min(first + partsize, lines.size()));
+	}
+
+	Split(lines, 0, std::min(partsize, lines.size()));
+
+	done.Lock();
+	while (pending)
+		done.Wait();
+	done.Unlock();
+}
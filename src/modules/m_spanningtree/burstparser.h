@@ -0,0 +1,96 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "threadengine.h"
+
+/** Splits lines received from a bursting server on worker threads.
+ * Only the splitting is done on the workers; the lines are always handled
+ * on the main thread in the order they were received.
+ */
+class BurstParser
+{
+ public:
+	/** A line which has been split into its parts. */
+	struct Line
+	{
+		/** The line as it was received. */
+		std::string line;
+
+		/** The message tags of the line. */
+		std::string tags;
+
+		/** The prefix of the line. */
+		std::string prefix;
+
+		/** The command of the line. Empty if the line was malformed or is a compact line. */
+		std::string command;
+
+		/** The parameters of the line, or the decoded fields if it is a compact line. */
+		CommandBase::Params params;
+
+		/** If non-empty then the reason the line is malformed. */
+		std::string error;
+
+		/** Whether the line uses the compact burst encoding and was decoded instead of split. */
+		bool compact;
+
+		Line() : compact(false) { }
+	};
+
+	typedef std::vector<Line> LineList;
+
+ private:
+	class Worker;
+
+	/** The threads which split lines. */
+	std::vector<Worker*> workers;
+
+	/** Signalled by workers when they have finished their part of the lines. */
+	ThreadQueueData done;
+
+	/** The number of workers which have not finished their part of the lines yet. */
+	size_t pending;
+
+	/** Called by a worker when it has finished its part of the lines. */
+	void FinishWorker();
+
+	/** Split lines from first to last.
+	 * @param lines The list of lines.
+	 * @param first The index of the first line to split.
+	 * @param last The index after the last line to split.
+	 */
+	static void Split(LineList& lines, size_t first, size_t last);
+
+ public:
+	/** Start the worker threads.
+	 * @param threads The number of worker threads to start.
+	 */
+	BurstParser(unsigned int threads);
+
+	/** Stop the worker threads. */
+	~BurstParser();
+
+	/** Retrieves the number of worker threads. */
+	size_t GetThreadCount() const { return workers.size(); }
+
+	/** Split lines using the worker threads and the calling thread. Returns once all of the lines have been split.
+	 * @param lines The lines to split.
+	 */
+	void Split(LineList& lines);
+};
@@ -31,6 +31,7 @@
 #include "utils.h"
 #include "link.h"
 #include "main.h"
+#include "modules/compress.h"
 
 struct CompatMod
 {
@@ -207,6 +208,16 @@ void TreeSocket::SendCapabilities(int phase)
 	if (eiter != tokens.end())
 		extra.append(" EXTBANS=" + eiter->second);
 
+	const CompressionIOHook* const compresshook = CompressionIOHook::Find(this);
+	if (compresshook)
+		extra.append(" COMPRESSION=" + compresshook->GetAlgorithm());
+
+	// We can always receive users and channels in the compact encoding.
+	extra.append(" COMPACTBURST=1 COMPACTMETA=1");
+
+	// Lets a server which relinks to us tell whether it has restarted since it split.
+	extra.append(" JOURNAL=" + ConvToStr(ServerInstance->startup_time));
+
 	this->WriteLine("CAPAB CAPABILITIES " /* Preprocessor does this one. */
 			":NICKMAX="+ConvToStr(ServerInstance->Config->Limits.NickMax)+
 			" CHANMAX="+ConvToStr(ServerInstance->Config->Limits.ChanMax)+
@@ -232,6 +243,20 @@ void TreeSocket::SendCapabilities(int phase)
 	this->WriteLine("CAPAB END");
 }
 
+void TreeSocket::SendXLineResync(const std::string& remotename)
+{
+	// Servers without a journal are always sent every X-line.
+	std::map<std::string, std::string>::const_iterator journal = capab->CapKeys.find("JOURNAL");
+	if (journal == capab->CapKeys.end())
+		return;
+
+	// Only the X-line changes missed by each side are sent if both sides can do so.
+	// Otherwise both send every X-line as the removals sent by one side would not
+	// be matched by the full burst of the other.
+	capab->xlinesince = Utils->Journal.GetResyncSequence(remotename, journal->second);
+	this->WriteLine("CAPAB CAPABILITIES :JOURNALRESYNC=" + ConvToStr(capab->xlinesince));
+}
+
 /* Isolate and return the elements that are different between two comma separated lists */
 void TreeSocket::ListDifference(const std::string &one, const std::string &two, char sep,
 		std::string& mleft, std::string& mright)
@@ -425,6 +450,7 @@ bool TreeSocket::Capab(const CommandBase::Params& params)
 			if (!this->GetTheirChallenge().empty() && (this->LinkState == CONNECTING))
 			{
 				this->SendCapabilities(2);
+				this->SendXLineResync(capab->link->Name);
 				this->WriteLine("SERVER "+ServerInstance->Config->ServerName+" "+this->MakePass(capab->link->SendPass, capab->theirchallenge)+" 0 "+ServerInstance->Config->GetSID()+" :"+ServerInstance->Config->ServerDesc);
 			}
 		}
@@ -434,6 +460,7 @@ bool TreeSocket::Capab(const CommandBase::Params& params)
 			if (this->LinkState == CONNECTING)
 			{
 				this->SendCapabilities(2);
+				this->SendXLineResync(capab->link->Name);
 				this->WriteLine("SERVER "+ServerInstance->Config->ServerName+" "+capab->link->SendPass+" 0 "+ServerInstance->Config->GetSID()+" :"+ServerInstance->Config->ServerDesc);
 			}
 		}
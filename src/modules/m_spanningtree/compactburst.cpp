@@ -0,0 +1,463 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "inspircd.h"
+
+#include "main.h"
+#include "utils.h"
+#include "treeserver.h"
+#include "treesocket.h"
+#include "commands.h"
+
+/* Compact burst encoding
+ *
+ * Servers which advertise COMPACTBURST=1 in CAPAB CAPABILITIES accept users and
+ * channel memberships in a compact form which can be parsed without tokenizing:
+ *
+ * :<sid> CUID <fields>
+ * :<sid> CFJOIN <fields>
+ * :<sid> CMETA <fields>
+ *
+ * Each field is encoded as <length>:<data> where <length> is the length of the
+ * data in decimal. Fields follow each other without a separator. The fields are
+ * the same as the parameters of UID and FJOIN with the following exceptions:
+ * - The modes and their parameters are one field with the parameters separated by spaces.
+ * - The displayed host in CUID is empty if it is the same as the real host.
+ *
+ * Servers which also advertise COMPACTMETA=1 accept all of the metadata of a user
+ * in one CMETA line. Its fields are the UUID of the user followed by pairs of keys
+ * and values. Each key and value starts with a marker:
+ * - '-' The rest of the field is the data.
+ * - '+' The rest of the field is the data which is also added to the dictionary.
+ * - '*' The rest of the field is the index of an entry in the dictionary.
+ * The dictionary lets keys and values which are common to many users, such as
+ * account names and certificate fingerprints, be sent only once. It starts out
+ * empty for each burst and is discarded when the burst ends.
+ *
+ * Compact lines never have tags and are handled as if the equivalent UID, FJOIN
+ * or METADATA had been received, including routing them onwards in the normal form.
+ * A CFJOIN can hold far more members than fit in one line so it is never routed
+ * onwards as it is; the FJOIN handler forwards the channel itself in FJOINs which
+ * are split to the normal line length limit.
+ */
+
+/** The largest key or value which is added to the dictionary. */
+static const std::string::size_type MaxInternLength = 256;
+
+/** The maximum number of entries in the dictionary. */
+static const size_t MaxDictionarySize = 4096;
+
+/** The maximum number of keys and values which are remembered as having been sent
+ * once whilst deciding which ones to add to the dictionary.
+ */
+static const size_t MaxSeenValues = 262144;
+
+namespace
+{
+	/** Append a field to a compact line.
+	 * @param line The line to append to.
+	 * @param field The data of the field.
+	 */
+	void AppendField(std::string& line, const std::string& field)
+	{
+		line.append(ConvToStr(field.length())).push_back(':');
+		line.append(field);
+	}
+
+	/** Append a numeric field to a compact line.
+	 * @param line The line to append to.
+	 * @param field The value of the field.
+	 */
+	template <typename T>
+	void AppendField(std::string& line, T field)
+	{
+		AppendField(line, ConvToStr(field));
+	}
+
+	/** Read the next field from a compact line.
+	 * @param line The line to read from.
+	 * @param pos The position of the field in the line. Advanced past the field on success.
+	 * @param out The string to store the data of the field in.
+	 * @return True if a field was read, false if the line is malformed.
+	 */
+	bool ReadField(const std::string& line, std::string::size_type& pos, std::string& out)
+	{
+		std::string::size_type length = 0;
+		const std::string::size_type start = pos;
+		for (; pos < line.length() && line[pos] >= '0' && line[pos] <= '9'; pos++)
+		{
+			length = (length * 10) + (line[pos] - '0');
+			if (length > line.length())
+				return false;
+		}
+
+		if ((pos == start) || (pos >= line.length()) || (line[pos] != ':'))
+			return false;
+
+		pos++;
+		if (line.length() - pos < length)
+			return false;
+
+		out.assign(line, pos, length);
+		pos += length;
+		return true;
+	}
+
+	/** Store the next parameter of a compact line, reusing the string already at that index if there is one.
+	 * @param params The parameter list to store the parameter in.
+	 * @param count The number of parameters stored so far. Incremented by one.
+	 * @return The string to store the parameter in.
+	 */
+	std::string& NextParam(CommandBase::Params& params, size_t& count)
+	{
+		if (params.size() <= count)
+			params.resize(count + 1);
+		return params[count++];
+	}
+
+	/** Read a field containing modes and their parameters and split it into separate parameters.
+	 * @param line The line to read from.
+	 * @param pos The position of the field in the line.
+	 * @param params The parameter list to store the parameters in.
+	 * @param count The number of parameters stored so far.
+	 * @return True if the field was read, false if the line is malformed.
+	 */
+	bool ReadModeField(const std::string& line, std::string::size_type& pos, CommandBase::Params& params, size_t& count)
+	{
+		const size_t modeindex = count;
+		if (!ReadField(line, pos, NextParam(params, count)))
+			return false;
+
+		const std::string::size_type space = params[modeindex].find(' ');
+		if (space == std::string::npos)
+			return true;
+
+		// The parameters are copied straight out of the line and then removed from the mode string.
+		const std::string::size_type fieldend = pos;
+		std::string::size_type parampos = fieldend - params[modeindex].length() + space;
+		while (parampos < fieldend)
+		{
+			const std::string::size_type paramstart = parampos + 1;
+			std::string::size_type paramend = line.find(' ', paramstart);
+			if ((paramend == std::string::npos) || (paramend > fieldend))
+				paramend = fieldend;
+			NextParam(params, count).assign(line, paramstart, paramend - paramstart);
+			parampos = paramend;
+		}
+
+		params[modeindex].erase(space);
+		return true;
+	}
+
+	/** Append a metadata key or value to a CMETA line. The field is added to the
+	 * dictionary the second time it is sent and referred to by its index after that.
+	 * @param line The line to append to.
+	 * @param field The key or value.
+	 * @param dictionary The keys and values which have been sent so far.
+	 * @param dictsize The number of entries in the dictionary of the remote server.
+	 */
+	void AppendInternedField(std::string& line, const std::string& field, TR1NS::unordered_map<std::string, unsigned long>& dictionary, size_t& dictsize)
+	{
+		if (field.length() <= MaxInternLength)
+		{
+			TR1NS::unordered_map<std::string, unsigned long>::iterator it = dictionary.find(field);
+			if (it == dictionary.end())
+			{
+				if (dictionary.size() < MaxSeenValues)
+					dictionary.insert(std::make_pair(field, 0));
+			}
+			else if (it->second)
+			{
+				AppendField(line, "*" + ConvToStr(it->second - 1));
+				return;
+			}
+			else if (dictsize < MaxDictionarySize)
+			{
+				it->second = ++dictsize;
+				AppendField(line, "+" + field);
+				return;
+			}
+		}
+
+		AppendField(line, "-" + field);
+	}
+}
+
+const char* TreeSocket::GetCompactCommand(const std::string& line)
+{
+	switch (line[6])
+	{
+		case 'U':
+			return "CUID";
+		case 'F':
+			return "CFJOIN";
+		default:
+			return "CMETA";
+	}
+}
+
+bool TreeSocket::IsCompactLine(const std::string& line)
+{
+	// :<sid> CUID ..., :<sid> CFJOIN ... or :<sid> CMETA ...
+	if ((line.length() < 10) || (line[0] != ':') || (line[4] != ' ') || (line[5] != 'C'))
+		return false;
+
+	return ((!line.compare(6, 4, "UID ")) || (!line.compare(6, 6, "FJOIN ")) || (!line.compare(6, 5, "META ")));
+}
+
+std::string TreeSocket::MakeCompactUID(User* user)
+{
+	std::string line;
+	line.reserve(200);
+	line.push_back(':');
+	line.append(TreeServer::Get(user)->GetId());
+	line.append(" CUID ");
+
+	AppendField(line, user->uuid);
+	AppendField(line, user->age);
+	AppendField(line, user->nick);
+	AppendField(line, user->GetRealHost());
+	AppendField(line, user->GetDisplayedHost() == user->GetRealHost() ? std::string() : user->GetDisplayedHost());
+	AppendField(line, user->ident);
+	AppendField(line, user->GetIPString());
+	AppendField(line, user->signon);
+	AppendField(line, user->GetModeLetters(true));
+	AppendField(line, user->GetRealName());
+	return line;
+}
+
+bool TreeSocket::MakeCompactMetadata(User* user, CompactDictionary& dictionary, std::string& line)
+{
+	line.assign(1, ':');
+	line.append(TreeServer::Get(user)->GetId());
+	line.append(" CMETA ");
+	AppendField(line, user->uuid);
+
+	bool found = false;
+	const Extensible::ExtensibleStore& exts = user->GetExtList();
+	for (Extensible::ExtensibleStore::const_iterator i = exts.begin(); i != exts.end(); ++i)
+	{
+		ExtensionItem* item = i->first;
+		const std::string value = item->ToNetwork(user, i->second);
+		if (value.empty())
+			continue;
+
+		AppendInternedField(line, item->name, dictionary.values, dictionary.size);
+		AppendInternedField(line, value, dictionary.values, dictionary.size);
+		found = true;
+	}
+	return found;
+}
+
+void TreeSocket::SendCompactFJoins(Channel* chan)
+{
+	std::string header(1, ':');
+	header.append(ServerInstance->Config->GetSID());
+	header.append(" CFJOIN ");
+	AppendField(header, chan->name);
+	AppendField(header, chan->age);
+	AppendField(header, std::string("+") + chan->ChanModes(true));
+
+	// Members are sent in the same format as in FJOIN. Lines are split at a size which
+	// keeps them from holding up the rest of the burst for too long.
+	static const std::string::size_type maxmembers = 32768;
+	std::string members;
+	const Channel::MemberMap& ulist = chan->GetUsers();
+	for (Channel::MemberMap::const_iterator i = ulist.begin(); i != ulist.end(); ++i)
+	{
+		Membership* memb = i->second;
+		if (members.length() >= maxmembers)
+		{
+			std::string line(header);
+			AppendField(line, members);
+			this->WriteLine(line);
+			members.clear();
+		}
+
+		if (!members.empty())
+			members.push_back(' ');
+		members.append(memb->modes).push_back(',');
+		members.append(memb->user->uuid).push_back(':');
+		members.append(ConvToStr(memb->id));
+	}
+
+	AppendField(header, members);
+	this->WriteLine(header);
+}
+
+bool TreeSocket::DecodeCompactLine(const std::string& line, CommandBase::Params& params, std::string& decodeerror)
+{
+	const char* const command = GetCompactCommand(line);
+	std::string::size_type pos = 6 + strlen(command);
+	size_t count = 0;
+	bool valid = true;
+	if (line[6] == 'U')
+	{
+		// uuid age nick host dhost ident ip signon +modes [modeparams] real
+		for (size_t i = 0; valid && i < 8; i++)
+			valid = ReadField(line, pos, NextParam(params, count));
+
+		// The displayed host is left out if it is the same as the real host.
+		if ((valid) && (params[4].empty()))
+			params[4].assign(params[3]);
+
+		valid = valid && ReadModeField(line, pos, params, count) && ReadField(line, pos, NextParam(params, count));
+	}
+	else if (line[6] == 'F')
+	{
+		// chan ts +modes [modeparams] members
+		for (size_t i = 0; valid && i < 2; i++)
+			valid = ReadField(line, pos, NextParam(params, count));
+
+		valid = valid && ReadModeField(line, pos, params, count) && ReadField(line, pos, NextParam(params, count));
+	}
+	else
+	{
+		// uuid key value [key value]...
+		// References to the dictionary are resolved when the line is handled as they depend on the lines before it.
+		while (valid && pos < line.length())
+			valid = ReadField(line, pos, NextParam(params, count));
+
+		valid = valid && (count >= 3) && (count % 2);
+	}
+
+	if (!valid)
+	{
+		decodeerror = "Malformed " + std::string(command);
+		return false;
+	}
+
+	if (pos != line.length())
+	{
+		decodeerror = "Trailing data in compact line";
+		return false;
+	}
+
+	params.resize(count);
+	return true;
+}
+
+void TreeSocket::ProcessCompactLine(const std::string& line)
+{
+	// Parameters are decoded into strings which are kept between lines so that their
+	// storage is reused instead of being reallocated for every user and channel.
+	std::string decodeerror;
+	if (!DecodeCompactLine(line, compactparams, decodeerror))
+		throw ProtocolException(decodeerror);
+
+	ProcessCompactLine(line, compactparams);
+}
+
+void TreeSocket::ProcessCompactLine(const std::string& line, CommandBase::Params& params)
+{
+	TreeServer* const server = Utils->FindServerID(line.substr(1, 3));
+	if (!server)
+	{
+		ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "Compact line from unknown server '%s'! Dropping entire command.", line.substr(1, 3).c_str());
+		return;
+	}
+
+	if (server->GetSocket() != this)
+	{
+		ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "Protocol violation: Fake direction '%s' from connection '%s'", server->GetId().c_str(), linkID.c_str());
+		return;
+	}
+
+	// The command is the compact command without the leading C.
+	const std::string command(GetCompactCommand(line) + 1);
+	ServerCommand* const scmd = Utils->Creator->CmdManager.GetHandler(command == "META" ? "METADATA" : command);
+	if (!scmd)
+		throw ProtocolException("Unknown command: " + command);
+
+	if (command == "META")
+	{
+		ProcessCompactMetadata(server, scmd, params);
+		return;
+	}
+
+	if (params.size() < scmd->min_params)
+		throw ProtocolException("Insufficient parameters");
+
+	User* const who = server->ServerUser;
+	if (scmd->Handle(who, params) != CMD_SUCCESS)
+		return;
+
+	// CommandFJoin::Handle() has already forwarded the members in FJOINs which fit
+	// within the line length limit of servers which do not understand CFJOIN.
+	if (command == "FJOIN")
+		return;
+
+	Utils->RouteCommand(server->GetRoute(), scmd, params, who);
+}
+
+void TreeSocket::ResolveCompactField(std::string& field)
+{
+	if (field.empty())
+		throw ProtocolException("Empty field in CMETA");
+
+	if (field[0] == '-')
+	{
+		field.erase(0, 1);
+	}
+	else if (field[0] == '+')
+	{
+		if (compactdictionary.size() >= MaxDictionarySize)
+			throw ProtocolException("Too many dictionary entries in CMETA");
+
+		field.erase(0, 1);
+		compactdictionary.push_back(field);
+	}
+	else if (field[0] == '*')
+	{
+		size_t index = 0;
+		for (std::string::const_iterator i = field.begin() + 1; i != field.end(); ++i)
+		{
+			if (*i < '0' || *i > '9' || index >= compactdictionary.size())
+				throw ProtocolException("Invalid dictionary reference in CMETA");
+			index = (index * 10) + (*i - '0');
+		}
+
+		if (field.length() < 2 || index >= compactdictionary.size())
+			throw ProtocolException("Invalid dictionary reference in CMETA");
+
+		field = compactdictionary[index];
+	}
+	else
+	{
+		throw ProtocolException("Invalid field in CMETA");
+	}
+}
+
+void TreeSocket::ProcessCompactMetadata(TreeServer* server, ServerCommand* scmd, CommandBase::Params& params)
+{
+	// Every key and value is resolved before any of them are handled so that the
+	// dictionary stays in step with the remote server even if the user is gone.
+	for (CommandBase::Params::iterator i = params.begin() + 1; i != params.end(); ++i)
+		ResolveCompactField(*i);
+
+	User* const who = server->ServerUser;
+	CommandBase::Params metaparams;
+	metaparams.resize(3);
+	metaparams[0] = params[0];
+	for (size_t i = 1; i + 1 < params.size(); i += 2)
+	{
+		metaparams[1].swap(params[i]);
+		metaparams[2].swap(params[i + 1]);
+		if (scmd->Handle(who, metaparams) == CMD_SUCCESS)
+			Utils->RouteCommand(server->GetRoute(), scmd, metaparams, who);
+	}
+}
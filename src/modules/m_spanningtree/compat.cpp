@@ -27,17 +27,75 @@
 #include "treesocket.h"
 #include "treeserver.h"
 
-static std::string newline("\n");
+static const StreamSocket::SendQueue::Element newline("\n", 1);
 
 void TreeSocket::WriteLineNoCompat(const std::string& line)
 {
 	ServerInstance->Logs->Log(MODNAME, LOG_RAWIO, "S[%d] O %s", this->GetFd(), line.c_str());
 	this->WriteData(line);
 	this->WriteData(newline);
+	CountLine(line);
+}
+
+void TreeSocket::WriteLineNoCompat(const std::string& line, const SendQueue::Element& serialized)
+{
+	ServerInstance->Logs->Log(MODNAME, LOG_RAWIO, "S[%d] O %s", this->GetFd(), line.c_str());
+	this->WriteData(serialized);
+	CountLine(line);
+}
+
+StreamSocket::SendQueue::Element TreeSocket::SerializeLine(const std::string& line)
+{
+	std::string serialized;
+	serialized.reserve(line.length() + 1);
+	serialized.append(line).push_back('\n');
+	return SendQueue::Element(serialized);
+}
+
+void TreeSocket::CountLine(const std::string& line)
+{
+	linkstats.Sent(line, getSendQSize());
+
+	const time_t now = ServerInstance->Time();
+	if (linesecond != now)
+	{
+		lineslastsecond = (linesecond == now - 1) ? linesthissecond : 0;
+		linesthissecond = 0;
+		linesecond = now;
+	}
+	linesthissecond++;
+}
+
+unsigned long TreeSocket::GetLinesPerSecond() const
+{
+	const time_t now = ServerInstance->Time();
+	if (linesecond == now)
+		return lineslastsecond;
+	if (linesecond == now - 1)
+		return linesthissecond;
+	return 0;
+}
+
+void TreeSocket::WriteLine(const std::string& line, const SendQueue::Element& serialized)
+{
+	// Lines which have to be translated can't use the shared copy.
+	if ((LinkState == CONNECTED) && (proto_version != PROTO_NEWEST))
+	{
+		WriteLine(line);
+		return;
+	}
+
+	if (burst)
+		SendReferencedObjects(line);
+
+	WriteLineNoCompat(line, serialized);
 }
 
 void TreeSocket::WriteLine(const std::string& original_line)
 {
+	if (burst)
+		SendReferencedObjects(original_line);
+
 	if (LinkState == CONNECTED)
 	{
 		if (proto_version != PROTO_NEWEST)
@@ -364,7 +422,7 @@ bool TreeSocket::PreProcessOldProtocolMessage(User*& who, std::string& cmd, Comm
 		{
 			// If it's a PING with 1 parameter, reply with a PONG now, if it's a PONG with 1 parameter (weird), do nothing
 			if (cmd[1] == 'I')
-				this->WriteData(":" + ServerInstance->Config->GetSID() + " PONG " + params[0] + newline);
+				this->WriteData(":" + ServerInstance->Config->GetSID() + " PONG " + params[0] + "\n");
 
 			// Don't process this message further
 			return false;
@@ -180,13 +180,16 @@ CmdResult CommandFJoin::Handle(User* srcuser, Params& params)
 	// after applying theirs. If they lost, the prefix modes from their message are not forwarded.
 	FwdFJoinBuilder fwdfjoin(chan, sourceserver);
 
-	// Process every member in the message
-	irc::spacesepstream users(params.back());
-	std::string item;
+	// Process every member in the message. The members are read in place rather than being
+	// copied out one at a time as this is done for every member of every channel in a burst.
+	const std::string& users = params.back();
 	Modes::ChangeList* modechangelistptr = (apply_other_sides_modes ? &modechangelist : NULL);
-	while (users.GetToken(item))
+	for (std::string::const_iterator item = users.begin(); item != users.end(); )
 	{
-		ProcessModeUUIDPair(item, sourceserver, chan, modechangelistptr, fwdfjoin);
+		const std::string::const_iterator itemend = std::find(item, users.end(), ' ');
+		if (item != itemend)
+			ProcessModeUUIDPair(item, itemend, sourceserver, chan, modechangelistptr, fwdfjoin);
+		item = (itemend == users.end() ? itemend : itemend + 1);
 	}
 
 	fwdfjoin.finalize();
@@ -199,13 +202,13 @@ CmdResult CommandFJoin::Handle(User* srcuser, Params& params)
 	return CMD_SUCCESS;
 }
 
-void CommandFJoin::ProcessModeUUIDPair(const std::string& item, TreeServer* sourceserver, Channel* chan, Modes::ChangeList* modechangelist, FwdFJoinBuilder& fwdfjoin)
+void CommandFJoin::ProcessModeUUIDPair(std::string::const_iterator itembegin, std::string::const_iterator itemend, TreeServer* sourceserver, Channel* chan, Modes::ChangeList* modechangelist, FwdFJoinBuilder& fwdfjoin)
 {
-	std::string::size_type comma = item.find(',');
+	const std::string::const_iterator comma = std::find(itembegin, itemend, ',');
 
 	// Comma not required anymore if the user has no modes
-	const std::string::size_type ubegin = (comma == std::string::npos ? 0 : comma+1);
-	std::string uuid(item, ubegin, UIDGenerator::UUID_LENGTH);
+	const std::string::const_iterator ubegin = (comma == itemend ? itembegin : comma + 1);
+	const std::string uuid(ubegin, ubegin + std::min<std::string::size_type>(UIDGenerator::UUID_LENGTH, itemend - ubegin));
 	User* who = ServerInstance->FindUUID(uuid);
 	if (!who)
 	{
@@ -221,13 +224,13 @@ void CommandFJoin::ProcessModeUUIDPair(const std::string& item, TreeServer* sour
 		return;
 	}
 
-	std::string::const_iterator modeendit = item.begin(); // End of the "ov" mode string
+	std::string::const_iterator modeendit = itembegin; // End of the "ov" mode string
 	/* Check if the user received at least one mode */
-	if ((modechangelist) && (comma != std::string::npos))
+	if ((modechangelist) && (comma != itemend))
 	{
-		modeendit += comma;
+		modeendit = comma;
 		/* Iterate through the modes and see if they are valid here, if so, apply */
-		for (std::string::const_iterator i = item.begin(); i != modeendit; ++i)
+		for (std::string::const_iterator i = itembegin; i != modeendit; ++i)
 		{
 			ModeHandler* mh = ServerInstance->Modes->FindMode(*i, MODETYPE_CHANNEL);
 			if (!mh)
@@ -244,19 +247,19 @@ void CommandFJoin::ProcessModeUUIDPair(const std::string& item, TreeServer* sour
 		// User was already on the channel, forward because of the modes they potentially got
 		memb = chan->GetUser(who);
 		if (memb)
-			fwdfjoin.add(memb, item.begin(), modeendit);
+			fwdfjoin.add(memb, itembegin, modeendit);
 		return;
 	}
 
 	// Assign the id to the new Membership
 	Membership::Id membid = 0;
-	const std::string::size_type colon = item.rfind(':');
-	if (colon != std::string::npos)
-		membid = Membership::IdFromString(item.substr(colon+1));
+	const std::string::const_iterator colon = std::find(ubegin, itemend, ':');
+	if (colon != itemend)
+		membid = Membership::IdFromString(std::string(colon + 1, itemend));
 	memb->id = membid;
 
 	// Add member to fwdfjoin with prefix modes
-	fwdfjoin.add(memb, item.begin(), modeendit);
+	fwdfjoin.add(memb, itembegin, modeendit);
 }
 
 void CommandFJoin::RemoveStatus(Channel* c)
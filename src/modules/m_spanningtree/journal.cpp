@@ -0,0 +1,101 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "inspircd.h"
+#include "xline.h"
+
+#include "journal.h"
+
+XLineJournal::XLineJournal()
+	: nextseq(1)
+	, maxentries(1000)
+{
+}
+
+void XLineJournal::SetMaxEntries(size_t max)
+{
+	maxentries = max;
+	while (entries.size() > maxentries)
+		entries.pop_front();
+}
+
+void XLineJournal::Record(XLine* x, bool added)
+{
+	// The sequence number is advanced even if nothing is kept so that servers which
+	// have missed a change are never mistaken for ones which have not.
+	const unsigned long seq = nextseq++;
+	if (!maxentries)
+		return;
+
+	if (entries.size() >= maxentries)
+		entries.pop_front();
+
+	Entry entry;
+	entry.seq = seq;
+	entry.added = added;
+	entry.type = x->type;
+	entry.mask = x->Displayable();
+	entries.push_back(entry);
+}
+
+void XLineJournal::SetPeer(const std::string& name, const std::string& epoch, unsigned long seq)
+{
+	Peer& peer = peers[name];
+	peer.epoch = epoch;
+	peer.seq = seq;
+}
+
+unsigned long XLineJournal::GetResyncSequence(const std::string& name, const std::string& epoch)
+{
+	PeerMap::iterator it = peers.find(name);
+	if (it == peers.end())
+		return 0;
+
+	// What we remember is only valid for the next link.
+	const Peer peer = it->second;
+	peers.erase(it);
+
+	// If the server has restarted it has lost every X-line we sent it.
+	if (epoch.empty() || peer.epoch != epoch || peer.seq > nextseq)
+		return 0;
+
+	// Nothing has changed since the server split.
+	if (peer.seq == nextseq)
+		return peer.seq;
+
+	// Otherwise every change since it split must still be in the journal.
+	if (entries.empty() || entries.front().seq > peer.seq)
+		return 0;
+
+	return peer.seq;
+}
+
+bool XLineJournal::GetChangesSince(unsigned long since, EntryList& out) const
+{
+	if (since == nextseq)
+		return true;
+
+	if (entries.empty() || entries.front().seq > since)
+		return false;
+
+	for (EntryList::const_iterator i = entries.begin(); i != entries.end(); ++i)
+	{
+		if (i->seq >= since)
+			out.push_back(*i);
+	}
+	return true;
+}
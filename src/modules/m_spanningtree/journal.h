@@ -0,0 +1,123 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <deque>
+
+class XLine;
+
+/** Keeps a bounded record of recent X-line changes so that a server which relinks
+ * shortly after a split only has to be sent the changes it missed instead of every
+ * X-line we know about.
+ *
+ * Every change is given a sequence number. When a server we are linked to answers a
+ * PING it has seen every change which was made before the PING was sent. When it
+ * splits, the last sequence number it is known to have seen is remembered together
+ * with its epoch, which changes whenever it restarts. If it relinks with the same
+ * epoch and the journal still holds every change made since then those changes
+ * are all that it is sent. Both servers advertise whether they can do this in CAPAB
+ * and it is only done if both of them can so that the removals sent by one of them
+ * are never undone by the other sending every X-line it has.
+ */
+class XLineJournal
+{
+ public:
+	/** A change to an X-line. */
+	struct Entry
+	{
+		/** The sequence number of the change. */
+		unsigned long seq;
+
+		/** True if the X-line was added, false if it was removed. */
+		bool added;
+
+		/** The type of the X-line. */
+		std::string type;
+
+		/** The displayable mask of the X-line. */
+		std::string mask;
+	};
+
+	typedef std::deque<Entry> EntryList;
+
+ private:
+	/** What we know about a server which has split from us. */
+	struct Peer
+	{
+		/** The epoch the server advertised. */
+		std::string epoch;
+
+		/** The sequence number of the first change the server has not seen. */
+		unsigned long seq;
+	};
+
+	typedef std::map<std::string, Peer, irc::insensitive_swo> PeerMap;
+
+	/** The most recent changes, oldest first. */
+	EntryList entries;
+
+	/** Servers which have split from us, by name. */
+	PeerMap peers;
+
+	/** The sequence number which will be given to the next change. */
+	unsigned long nextseq;
+
+	/** The maximum number of changes to keep. */
+	size_t maxentries;
+
+ public:
+	XLineJournal();
+
+	/** Set the maximum number of changes to keep, discarding the oldest ones if there are more.
+	 * @param max The maximum number of changes to keep.
+	 */
+	void SetMaxEntries(size_t max);
+
+	/** Retrieves the sequence number which will be given to the next change. */
+	unsigned long GetSequence() const { return nextseq; }
+
+	/** Retrieves the changes which are being kept, oldest first. */
+	const EntryList& GetEntries() const { return entries; }
+
+	/** Record a change to an X-line.
+	 * @param x The X-line which was changed.
+	 * @param added True if the X-line was added, false if it was removed.
+	 */
+	void Record(XLine* x, bool added);
+
+	/** Remember what a server which has just split from us has seen.
+	 * @param name The name of the server.
+	 * @param epoch The epoch the server advertised.
+	 * @param seq The sequence number of the first change the server has not seen.
+	 */
+	void SetPeer(const std::string& name, const std::string& epoch, unsigned long seq);
+
+	/** Find out whether a server which is linking can be sent only the changes it missed.
+	 * @param name The name of the server.
+	 * @param epoch The epoch the server advertised.
+	 * @return The sequence number of the first change to send or 0 if the server must be sent every X-line.
+	 */
+	unsigned long GetResyncSequence(const std::string& name, const std::string& epoch);
+
+	/** Copy the changes which have been made since a sequence number.
+	 * @param since The sequence number of the first change to copy.
+	 * @param out The list to append the changes to.
+	 * @return True if every change since then was copied, false if some of them have been discarded.
+	 */
+	bool GetChangesSince(unsigned long since, EntryList& out) const;
+};
@@ -42,6 +42,7 @@ class Link : public refcountbase
 	unsigned int Timeout;
 	std::string Bind;
 	bool Hidden;
+	bool Compress;
 	Link(ConfigTag* Tag) : tag(Tag) {}
 };
 
@@ -0,0 +1,82 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "inspircd.h"
+
+#include "linkstats.h"
+
+LinkStats::LinkStats()
+	: sendqpeak(0)
+	, burstsendtime(0)
+{
+}
+
+unsigned long long LinkStats::GetMicroseconds()
+{
+#if defined HAS_CLOCK_GETTIME
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000000ULL) + (ts.tv_nsec / 1000);
+#elif defined _WIN32
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	return (counter.QuadPart * 1000000ULL) / ServerInstance->stats.QPFrequency.QuadPart;
+#else
+	timeval tv;
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec * 1000000ULL) + tv.tv_usec;
+#endif
+}
+
+void LinkStats::Received(const std::string& command, size_t bytes, unsigned long long start)
+{
+	const unsigned long long now = GetMicroseconds();
+	const unsigned long elapsed = (now > start ? now - start : 0);
+
+	ProtocolInterface::CommandStats& stats = commands[command];
+	stats.received++;
+	stats.bytesin += bytes;
+	stats.handletime += elapsed;
+	if (elapsed > stats.maxhandletime)
+		stats.maxhandletime = elapsed;
+
+	size_t bucket = 0;
+	for (unsigned long limit = 10; bucket < ProtocolInterface::CommandStats::HISTOGRAM_BUCKETS - 1 && elapsed >= limit; limit *= 10)
+		bucket++;
+	stats.histogram[bucket]++;
+}
+
+void LinkStats::Sent(const std::string& line, size_t sendq)
+{
+	if (sendq > sendqpeak)
+		sendqpeak = sendq;
+
+	// Skip the tags and the prefix to get to the command.
+	std::string::size_type start = 0;
+	while (start < line.length() && (line[start] == '@' || line[start] == ':'))
+	{
+		start = line.find(' ', start);
+		if (start == std::string::npos)
+			return;
+		start++;
+	}
+
+	const std::string::size_type end = line.find(' ', start);
+	ProtocolInterface::CommandStats& stats = commands[line.substr(start, end == std::string::npos ? std::string::npos : end - start)];
+	stats.sent++;
+	stats.bytesout += line.length() + 1;
+}
@@ -0,0 +1,64 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+/** Collects statistics about the lines sent and received on a server link. */
+class LinkStats
+{
+	/** Statistics about each command, by command name. */
+	ProtocolInterface::CommandStatsMap commands;
+
+	/** The largest amount of data which has been queued on the link. */
+	size_t sendqpeak;
+
+	/** How long the last burst sent on the link took in milliseconds. */
+	unsigned long burstsendtime;
+
+ public:
+	LinkStats();
+
+	/** Retrieves the current time in microseconds from a clock which is only used for measuring durations. */
+	static unsigned long long GetMicroseconds();
+
+	/** Record a line which was received.
+	 * @param command The command of the line.
+	 * @param bytes The length of the line including the line ending.
+	 * @param start The time handling the line started at as returned by GetMicroseconds().
+	 */
+	void Received(const std::string& command, size_t bytes, unsigned long long start);
+
+	/** Record a line which was sent.
+	 * @param line The line without a line ending.
+	 * @param sendq The amount of data queued on the link after the line was queued.
+	 */
+	void Sent(const std::string& line, size_t sendq);
+
+	/** Record how long a burst sent on the link took.
+	 * @param ms The duration of the burst in milliseconds.
+	 */
+	void SetBurstSendTime(unsigned long ms) { burstsendtime = ms; }
+
+	/** Retrieves statistics about each command, by command name. */
+	const ProtocolInterface::CommandStatsMap& GetCommands() const { return commands; }
+
+	/** Retrieves the largest amount of data which has been queued on the link. */
+	size_t GetSendQPeak() const { return sendqpeak; }
+
+	/** Retrieves how long the last burst sent on the link took in milliseconds or 0 if none has finished. */
+	unsigned long GetBurstSendTime() const { return burstsendtime; }
+};
@@ -57,6 +57,7 @@ ModuleSpanningTree::ModuleSpanningTree()
 	, servicetag(this)
 	, DNS(this, "DNS")
 	, tagevprov(this)
+	, routemembers(this)
 	, loopCall(false)
 {
 }
@@ -498,6 +499,8 @@ void ModuleSpanningTree::OnUserConnect(LocalUser* user)
 
 void ModuleSpanningTree::OnUserJoin(Membership* memb, bool sync, bool created_by_local, CUList& excepts)
 {
+	routemembers.Add(memb);
+
 	// Only do this for local users
 	if (!IS_LOCAL(memb->user))
 		return;
@@ -553,6 +556,8 @@ void ModuleSpanningTree::OnChangeIdent(User* user, const std::string &ident)
 
 void ModuleSpanningTree::OnUserPart(Membership* memb, std::string &partmessage, CUList& excepts)
 {
+	routemembers.Remove(memb);
+
 	if (IS_LOCAL(memb->user))
 	{
 		CmdBuilder params(memb->user, "PART");
@@ -574,6 +579,10 @@ void ModuleSpanningTree::OnUserQuit(User* user, const std::string &reason, const
 	}
 	else
 	{
+		// The user is removed from their channels without a part or a kick.
+		for (User::ChanList::iterator i = user->chans.begin(); i != user->chans.end(); ++i)
+			routemembers.Remove(*i);
+
 		// Hide the message if one of the following is true:
 		// - User is being quit due to a netsplit and quietbursts is on
 		// - Server is a silent uline
@@ -608,6 +617,8 @@ void ModuleSpanningTree::OnUserPostNick(User* user, const std::string &oldnick)
 
 void ModuleSpanningTree::OnUserKick(User* source, Membership* memb, const std::string &reason, CUList& excepts)
 {
+	routemembers.Remove(memb);
+
 	if ((!IS_LOCAL(source)) && (source != ServerInstance->FakeClient))
 		return;
 
@@ -734,7 +745,12 @@ void ModuleSpanningTree::OnOper(User* user, const std::string &opertype)
 
 void ModuleSpanningTree::OnAddLine(User* user, XLine *x)
 {
-	if (!x->IsBurstable() || loopCall || (user && !IS_LOCAL(user)))
+	if (!x->IsBurstable())
+		return;
+
+	// Changes from every server are recorded as a server which relinks may have missed any of them.
+	Utils->Journal.Record(x, true);
+	if (loopCall || (user && !IS_LOCAL(user)))
 		return;
 
 	if (!user)
@@ -745,7 +761,12 @@ void ModuleSpanningTree::OnAddLine(User* user, XLine *x)
 
 void ModuleSpanningTree::OnDelLine(User* user, XLine *x)
 {
-	if (!x->IsBurstable() || loopCall || (user && !IS_LOCAL(user)))
+	if (!x->IsBurstable())
+		return;
+
+	// Changes from every server are recorded as a server which relinks may have missed any of them.
+	Utils->Journal.Record(x, false);
+	if (loopCall || (user && !IS_LOCAL(user)))
 		return;
 
 	if (!user)
@@ -39,6 +39,7 @@
 #include "commands.h"
 #include "protocolinterface.h"
 #include "tags.h"
+#include "routemembers.h"
 
 /** An enumeration of all known protocol versions.
  *
@@ -126,6 +127,9 @@ class ModuleSpanningTree
 
 	ServerCommandManager CmdManager;
 
+	/** Counts the remote members of each channel behind each server linked to us. */
+	RouteMembers routemembers;
+
 	/** Set to true if inside a spanningtree call, to prevent sending
 	 * xlines and other things back to their source
 	 */
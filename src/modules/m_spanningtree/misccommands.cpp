@@ -74,5 +74,7 @@ CmdResult CommandSNONotice::Handle(User* user, Params& params)
 CmdResult CommandEndBurst::HandleServer(TreeServer* server, Params& params)
 {
 	server->FinishBurst();
+	if (server->IsLocal())
+		server->GetSocket()->ClearCompactDictionary();
 	return CMD_SUCCESS;
 }
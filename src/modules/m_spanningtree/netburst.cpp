@@ -31,6 +31,7 @@
 #include "treeserver.h"
 #include "main.h"
 #include "commands.h"
+#include "modules/compress.h"
 
 /**
  * Creates FMODE messages, used only when syncing channels
@@ -95,14 +96,57 @@ class FModeBuilder : public CmdBuilder
 
 struct TreeSocket::BurstState
 {
+	enum Stage
+	{
+		STAGE_USERS,
+		STAGE_CHANNELS,
+		STAGE_DONE
+	};
+
 	SpanningTreeProtocolInterface::Server server;
-	BurstState(TreeSocket* sock) : server(sock) { }
+
+	/** The part of the burst which is currently being sent. */
+	Stage stage;
+
+	/** The UUIDs of the users which existed when the burst started and have not been sent yet. */
+	TR1NS::unordered_set<std::string> users;
+
+	/** The names of the channels which existed when the burst started and have not been sent yet. */
+	TR1NS::unordered_set<std::string, irc::insensitive, irc::StrHashComp> channels;
+
+	/** Whether lines written to the socket right now are part of the burst. */
+	bool generating;
+
+	/** Whether only the X-line changes in xlinechanges are sent instead of every X-line. */
+	bool xlineresync;
+
+	/** The X-line changes the other server missed whilst it was split from us. */
+	XLineJournal::EntryList xlinechanges;
+
+	/** When the burst started as returned by LinkStats::GetMicroseconds(). */
+	unsigned long long start;
+
+	/** The metadata keys and values which have been sent in CMETA lines. */
+	CompactDictionary dictionary;
+
+	BurstState(TreeSocket* sock)
+		: server(sock)
+		, stage(STAGE_DONE)
+		, generating(false)
+		, xlineresync(false)
+		, start(LinkStats::GetMicroseconds())
+	{
+	}
 };
 
 /** This function is called when we want to send a netburst to a local
  * server. There is a set order we must do this, because for example
  * users require their servers to exist, and channels require their
  * users to exist. You get the idea.
+ *
+ * Only the servers are sent here. The users and channels which exist
+ * right now are remembered and sent by ContinueBurst() a few at a time
+ * whenever the socket has room for more data.
  */
 void TreeSocket::DoBurst(TreeServer* s)
 {
@@ -110,27 +154,249 @@ void TreeSocket::DoBurst(TreeServer* s)
 		s->GetName().c_str(),
 		capab->auth_fingerprint ? "SSL certificate fingerprint and " : "",
 		capab->auth_challenge ? "challenge-response" : "plaintext password");
+
+	// If the other server offered the same compression algorithm as us then everything
+	// from the burst onwards is compressed.
+	const CompressionIOHook* const compresshook = CompressionIOHook::Find(this);
+	if (compresshook && capab->compress)
+	{
+		std::map<std::string, std::string>::const_iterator algorithm = capab->CapKeys.find("COMPRESSION");
+		if (algorithm != capab->CapKeys.end() && algorithm->second == compresshook->GetAlgorithm())
+			this->WriteLine(CompressionIOHook::GetStartLine(algorithm->second));
+	}
+
+	// If the other server understands the compact burst encoding then users and
+	// channel memberships are sent using it.
+	std::map<std::string, std::string>::const_iterator compact = capab->CapKeys.find("COMPACTBURST");
+	this->compactburst = (compact != capab->CapKeys.end() && compact->second == "1");
+
+	// If it also understands CMETA then all of the metadata of each user is sent in one line.
+	std::map<std::string, std::string>::const_iterator compactmetakey = capab->CapKeys.find("COMPACTMETA");
+	this->compactmeta = (compactburst && compactmetakey != capab->CapKeys.end() && compactmetakey->second == "1");
+
+	// If both servers have a journal and split from each other recently then each only
+	// needs the X-line changes it missed. Users and channels are always sent in full as
+	// they were removed from both sides of the split.
+	std::map<std::string, std::string>::const_iterator journal = capab->CapKeys.find("JOURNAL");
+	if (journal != capab->CapKeys.end())
+		this->journalepoch = journal->second;
+
+	// The changes are copied now so that the journal can not discard them whilst we are
+	// bursting. Changes made from now on are sent to the other server as they happen.
+	XLineJournal::EntryList xlinechanges;
+	std::map<std::string, std::string>::const_iterator resync = capab->CapKeys.find("JOURNALRESYNC");
+	const bool xlineresync = (capab->xlinesince && resync != capab->CapKeys.end() && ConvToNum<unsigned long>(resync->second));
+	if (xlineresync && !Utils->Journal.GetChangesSince(capab->xlinesince, xlinechanges))
+	{
+		// The other server is only going to send us its changes so we can not send it
+		// every X-line instead. Neither of us remembers the other any more so we will
+		// both send every X-line on the next attempt.
+		this->SendError("Too many X-line changes whilst linking, all X-lines will be sent on the next attempt");
+		return;
+	}
+
 	this->CleanNegotiationInfo();
 	this->WriteLine(CmdBuilder("BURST").push_int(ServerInstance->Time()));
 	// Introduce all servers behind us
 	this->SendServers(Utils->TreeRoot, s);
 
-	BurstState bs(this);
-	// Introduce all users
-	this->SendUsers(bs);
+	burst = new BurstState(this);
+	burst->stage = BurstState::STAGE_USERS;
+	burst->xlineresync = xlineresync;
+	burst->xlinechanges.swap(xlinechanges);
+
+	const user_hash& users = ServerInstance->Users->GetUsers();
+	for (user_hash::const_iterator i = users.begin(); i != users.end(); ++i)
+	{
+		if (i->second->registered == REG_ALL)
+			burst->users.insert(i->second->uuid);
+	}
 
-	// Sync all channels
 	const chan_hash& chans = ServerInstance->GetChans();
 	for (chan_hash::const_iterator i = chans.begin(); i != chans.end(); ++i)
-		SyncChannel(i->second, bs);
+		burst->channels.insert(i->first);
+
+	ContinueBurst();
+}
 
-	// Send all xlines
-	this->SendXLines();
-	FOREACH_MOD_CUSTOM(Utils->Creator->GetSyncEventProvider(), ServerProtocol::SyncEventListener, OnSyncNetwork, (bs.server));
+void TreeSocket::ContinueBurst()
+{
+	if (!burst || !HasFd() || !getError().empty())
+		return;
+
+	// Stop once the socket has enough data queued. We will be called again when some
+	// of it has been written.
+	burst->generating = true;
+	while (burst->stage != BurstState::STAGE_DONE && getSendQSize() < Utils->BurstSendQ && getError().empty())
+	{
+		// Users and channels which have already been sent because a line which was
+		// written whilst bursting referred to them are not in the snapshot any more.
+		if (burst->stage == BurstState::STAGE_USERS)
+		{
+			if (burst->users.empty())
+			{
+				burst->stage = BurstState::STAGE_CHANNELS;
+				continue;
+			}
+
+			const std::string uuid = *burst->users.begin();
+			SendPendingUser(uuid);
+		}
+		else
+		{
+			if (burst->channels.empty())
+			{
+				burst->stage = BurstState::STAGE_DONE;
+				break;
+			}
+
+			const std::string name = *burst->channels.begin();
+			SendPendingChannel(name);
+		}
+	}
+
+	if (burst->stage != BurstState::STAGE_DONE)
+	{
+		burst->generating = false;
+		return;
+	}
+
+	// Send all xlines or only the ones which changed whilst the other server was split from us
+	if (burst->xlineresync)
+		this->SendXLineChanges(burst->xlinechanges);
+	else
+		this->SendXLines();
+	FOREACH_MOD_CUSTOM(Utils->Creator->GetSyncEventProvider(), ServerProtocol::SyncEventListener, OnSyncNetwork, (burst->server));
 	this->WriteLine(CmdBuilder("ENDBURST"));
-	ServerInstance->SNO->WriteToSnoMask('l',"Finished bursting to \002"+ s->GetName()+"\002.");
+	ServerInstance->SNO->WriteToSnoMask('l',"Finished bursting to \002"+ MyRoot->GetName()+"\002.");
 
 	this->burstsent = true;
+	linkstats.SetBurstSendTime((LinkStats::GetMicroseconds() - burst->start) / 1000);
+	DeleteBurstState();
+}
+
+void TreeSocket::SendPendingUser(const std::string& uuid)
+{
+	if (!burst->users.erase(uuid))
+		return;
+
+	// Users which quit since the burst started are skipped and users which connected
+	// since then have already been introduced by their own UID.
+	User* user = ServerInstance->FindUUID(uuid);
+	if (user && user->registered == REG_ALL)
+		SendUser(user, *burst);
+}
+
+void TreeSocket::SendPendingChannel(const std::string& name)
+{
+	if (!burst->channels.erase(name))
+		return;
+
+	Channel* chan = ServerInstance->FindChan(name);
+	if (!chan)
+		return;
+
+	// The members of the channel have to be introduced before it is.
+	if (!burst->users.empty())
+	{
+		const Channel::MemberMap& members = chan->GetUsers();
+		for (Channel::MemberMap::const_iterator i = members.begin(); i != members.end(); ++i)
+			SendPendingUser(i->first->uuid);
+	}
+
+	SyncChannel(chan, *burst);
+}
+
+void TreeSocket::SendReferencedObjects(const std::string& line)
+{
+	if (burst->generating)
+		return;
+
+	// Changes to users and channels which have already been sent, and to ones which
+	// did not exist when the burst started, are sent straight away. Users and channels
+	// which the burst has not reached yet are sent first so the other server never sees
+	// a change to something it does not know about or an old state of something which
+	// has since changed. Nothing is held back so everything we have to send is in the
+	// send queue and counts towards the burstsendq limit.
+	burst->generating = true;
+
+	std::string::size_type start = 0;
+	if (!line.empty() && line[0] == '@')
+	{
+		// Skip the tags.
+		start = line.find(' ');
+		if (start == std::string::npos)
+			start = line.length();
+		start++;
+	}
+
+	bool first = true;
+	bool trailing = false;
+	while (start < line.length())
+	{
+		std::string::size_type end = line.find(' ', start);
+		if (end == std::string::npos)
+			end = line.length();
+
+		if (line[start] == ':')
+		{
+			// The first parameter which starts with a colon is the last one but the
+			// prefix starts with one too.
+			trailing = !first;
+			start++;
+		}
+		first = false;
+
+		// UUIDs can be anywhere including in the member list of an FJOIN where they
+		// are surrounded by the modes and membership id of the member.
+		for (std::string::size_type pos = start; pos < end && !burst->users.empty(); )
+		{
+			std::string::size_type next = line.find_first_of(",:", pos);
+			if (next == std::string::npos || next > end)
+				next = end;
+			if (next - pos == UIDGenerator::UUID_LENGTH)
+				SendPendingUser(line.substr(pos, next - pos));
+			pos = next + 1;
+		}
+
+		// Channel names in the text of a message are not references to the channel.
+		for (std::string::size_type pos = start; pos < end && !trailing && !burst->channels.empty(); )
+		{
+			std::string::size_type next = line.find(',', pos);
+			if (next == std::string::npos || next > end)
+				next = end;
+			// Skip any status prefix in front of the channel name.
+			std::string::size_type chanstart = line.find('#', pos);
+			if (chanstart < next)
+				SendPendingChannel(line.substr(chanstart, next - chanstart));
+			pos = next + 1;
+		}
+
+		start = end + 1;
+	}
+
+	burst->generating = false;
+}
+
+void TreeSocket::OnEventHandlerWrite()
+{
+	const size_t queued = getSendQSize();
+	BufferedSocket::OnEventHandlerWrite();
+
+	const size_t remaining = getSendQSize();
+	if (remaining < queued)
+	{
+		flushes++;
+		flushedbytes += queued - remaining;
+	}
+
+	ContinueBurst();
+}
+
+void TreeSocket::DeleteBurstState()
+{
+	delete burst;
+	burst = NULL;
 }
 
 void TreeSocket::SendServerInfo(TreeServer* from)
@@ -173,6 +439,12 @@ void TreeSocket::SendServers(TreeServer* Current, TreeServer* s)
  */
 void TreeSocket::SendFJoins(Channel* c)
 {
+	if (compactburst)
+	{
+		SendCompactFJoins(c);
+		return;
+	}
+
 	CommandFJoin::Builder fjoin(c);
 
 	const Channel::MemberMap& ulist = c->GetUsers();
@@ -217,6 +489,39 @@ void TreeSocket::SendXLines()
 	}
 }
 
+void TreeSocket::SendXLineChanges(const XLineJournal::EntryList& changes)
+{
+	ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "Sending %lu X-line changes to %s instead of all X-lines", static_cast<unsigned long>(changes.size()), MyRoot->GetName().c_str());
+
+	for (XLineJournal::EntryList::const_iterator i = changes.begin(); i != changes.end(); ++i)
+	{
+		const XLineJournal::Entry& entry = *i;
+
+		if (entry.added)
+		{
+			// Lines which have been removed again since are left to the later removal.
+			XLineLookup* lookup = ServerInstance->XLines->GetAll(entry.type);
+			if (!lookup)
+				continue;
+
+			LookupIter line = lookup->find(entry.mask);
+			if (line != lookup->end() && line->second->IsBurstable())
+				this->WriteLine(CommandAddLine::Builder(line->second));
+		}
+		else
+		{
+			this->WriteLine(CmdBuilder("DELLINE").push(entry.type).push(entry.mask));
+		}
+	}
+}
+
+void TreeSocket::OnPingSent()
+{
+	// The X-lines are only sent at the end of our burst so a PING sent whilst
+	// bursting does not acknowledge anything.
+	journalping = burst ? 0 : Utils->Journal.GetSequence();
+}
+
 void TreeSocket::SendListModes(Channel* chan)
 {
 	FModeBuilder fmode(chan);
@@ -278,33 +583,37 @@ void TreeSocket::SyncChannel(Channel* chan)
 	SyncChannel(chan, bs);
 }
 
-/** Send all users and their state, including oper and away status and global metadata */
-void TreeSocket::SendUsers(BurstState& bs)
+/** Send a user and their state, including oper and away status and global metadata */
+void TreeSocket::SendUser(User* user, BurstState& bs)
 {
-	const user_hash& users = ServerInstance->Users->GetUsers();
-	for (user_hash::const_iterator u = users.begin(); u != users.end(); ++u)
-	{
-		User* user = u->second;
-		if (user->registered != REG_ALL)
-			continue;
-
+	if (compactburst)
+		this->WriteLine(MakeCompactUID(user));
+	else
 		this->WriteLine(CommandUID::Builder(user));
 
-		if (user->IsOper())
-			this->WriteLine(CommandOpertype::Builder(user));
+	if (user->IsOper())
+		this->WriteLine(CommandOpertype::Builder(user));
 
-		if (user->IsAway())
-			this->WriteLine(CommandAway::Builder(user));
+	if (user->IsAway())
+		this->WriteLine(CommandAway::Builder(user));
 
+	if (compactmeta)
+	{
+		std::string line;
+		if (MakeCompactMetadata(user, bs.dictionary, line))
+			this->WriteLine(line);
+	}
+	else
+	{
 		const Extensible::ExtensibleStore& exts = user->GetExtList();
 		for (Extensible::ExtensibleStore::const_iterator i = exts.begin(); i != exts.end(); ++i)
 		{
 			ExtensionItem* item = i->first;
-			std::string value = item->ToNetwork(u->second, i->second);
+			std::string value = item->ToNetwork(user, i->second);
 			if (!value.empty())
 				this->WriteLine(CommandMetadata::Builder(user, item->name, value));
 		}
-
-		FOREACH_MOD_CUSTOM(Utils->Creator->GetSyncEventProvider(), ServerProtocol::SyncEventListener, OnSyncUser, (user, bs.server));
 	}
+
+	FOREACH_MOD_CUSTOM(Utils->Creator->GetSyncEventProvider(), ServerProtocol::SyncEventListener, OnSyncUser, (user, bs.server));
 }
@@ -25,6 +25,30 @@
 #include "main.h"
 #include "utils.h"
 #include "link.h"
+#include "treeserver.h"
+#include "treesocket.h"
+#include "modules/compress.h"
+
+namespace
+{
+	std::string FormatCounter(const CompressionIOHook::Counter& counter)
+	{
+		const double ratio = counter.plain ? 100.0 * counter.compressed / counter.plain : 100.0;
+		return InspIRCd::Format("%llu/%llu (%.1f%%)", counter.compressed, counter.plain, ratio);
+	}
+
+	std::string FormatHistogram(const ProtocolInterface::CommandStats& stats)
+	{
+		std::string histogram;
+		for (size_t i = 0; i < ProtocolInterface::CommandStats::HISTOGRAM_BUCKETS; ++i)
+		{
+			if (i)
+				histogram.push_back('/');
+			histogram.append(ConvToStr(stats.histogram[i]));
+		}
+		return histogram;
+	}
+}
 
 ModResult ModuleSpanningTree::OnStats(Stats::Context& stats)
 {
@@ -57,5 +81,46 @@ ModResult ModuleSpanningTree::OnStats(Stats::Context& stats)
 		}
 		return MOD_RES_DENY;
 	}
+	else if (stats.GetSymbol() == 'x')
+	{
+		stats.AddRow(249, "server algorithm compressed/plain(sent) compressed/plain(received)");
+		const TreeServer::ChildServers& children = Utils->TreeRoot->GetChildren();
+		for (TreeServer::ChildServers::const_iterator i = children.begin(); i != children.end(); ++i)
+		{
+			TreeServer* server = *i;
+			const CompressionIOHook* const compresshook = CompressionIOHook::Find(server->GetSocket());
+			if (!compresshook)
+				continue;
+
+			stats.AddRow(249, server->GetName() + " " + compresshook->GetAlgorithm()
+				+ " " + (compresshook->IsCompressing() ? FormatCounter(compresshook->sent) : "off")
+				+ " " + (compresshook->IsDecompressing() ? FormatCounter(compresshook->received) : "off"));
+		}
+		return MOD_RES_DENY;
+	}
+	else if (stats.GetSymbol() == 'b')
+	{
+		stats.AddRow(249, "server sendqpeak burstsent(ms) burstreceived(ms)");
+		stats.AddRow(249, "server command received/bytes sent/bytes avg/max(us) <10us/<100us/<1ms/<10ms/<100ms/more");
+		const TreeServer::ChildServers& children = Utils->TreeRoot->GetChildren();
+		for (TreeServer::ChildServers::const_iterator i = children.begin(); i != children.end(); ++i)
+		{
+			TreeServer* server = *i;
+			const LinkStats& linkstats = server->GetSocket()->GetLinkStats();
+			stats.AddRow(249, InspIRCd::Format("%s %lu %lu %lu", server->GetName().c_str(), static_cast<unsigned long>(linkstats.GetSendQPeak()),
+				linkstats.GetBurstSendTime(), server->LastBurstTime));
+
+			const ProtocolInterface::CommandStatsMap& cmdstats_map = linkstats.GetCommands();
+			for (ProtocolInterface::CommandStatsMap::const_iterator j = cmdstats_map.begin(); j != cmdstats_map.end(); ++j)
+			{
+				const ProtocolInterface::CommandStats& cmdstats = j->second;
+				stats.AddRow(249, InspIRCd::Format("%s %s %lu/%llu %lu/%llu %llu/%lu %s", server->GetName().c_str(), j->first.c_str(),
+					cmdstats.received, cmdstats.bytesin, cmdstats.sent, cmdstats.bytesout,
+					cmdstats.received ? cmdstats.handletime / cmdstats.received : 0, cmdstats.maxhandletime,
+					FormatHistogram(cmdstats).c_str()));
+			}
+		}
+		return MOD_RES_DENY;
+	}
 	return MOD_RES_PASSTHRU;
 }
@@ -46,6 +46,24 @@ void SpanningTreeProtocolInterface::GetServerList(ServerList& sl)
 		ps.opercount = tree->OperCount;
 		ps.description = tree->GetDesc();
 		ps.latencyms = tree->rtt;
+		ps.burstrecvtime = tree->LastBurstTime;
+		if (parent == Utils->TreeRoot)
+		{
+			TreeSocket* sock = tree->GetSocket();
+			const LinkStats& stats = sock->GetLinkStats();
+			ps.linespersec = sock->GetLinesPerSecond();
+			ps.bytesperflush = sock->GetBytesPerFlush();
+			ps.sendqpeak = stats.GetSendQPeak();
+			ps.burstsendtime = stats.GetBurstSendTime();
+			ps.commands = stats.GetCommands();
+		}
+		else
+		{
+			ps.linespersec = 0;
+			ps.bytesperflush = 0;
+			ps.sendqpeak = 0;
+			ps.burstsendtime = 0;
+		}
 		sl.push_back(ps);
 	}
 }
@@ -0,0 +1,62 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "inspircd.h"
+
+#include "routemembers.h"
+#include "treeserver.h"
+
+RouteMembers::RouteMembers(Module* mod)
+	: ext("routemembers", ExtensionItem::EXT_CHANNEL, mod)
+{
+}
+
+void RouteMembers::Add(Membership* memb)
+{
+	if (IS_LOCAL(memb->user))
+		return;
+
+	CountMap* counts = ext.get(memb->chan);
+	if (!counts)
+	{
+		counts = new CountMap;
+		ext.set(memb->chan, counts);
+	}
+
+	(*counts)[TreeServer::Get(memb->user)->GetRoute()]++;
+}
+
+void RouteMembers::Remove(Membership* memb)
+{
+	if (IS_LOCAL(memb->user))
+		return;
+
+	CountMap* counts = ext.get(memb->chan);
+	if (!counts)
+		return;
+
+	CountMap::iterator it = counts->find(TreeServer::Get(memb->user)->GetRoute());
+	if (it == counts->end())
+		return;
+
+	if (--it->second)
+		return;
+
+	counts->erase(it);
+	if (counts->empty())
+		ext.unset(memb->chan);
+}
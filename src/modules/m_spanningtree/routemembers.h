@@ -0,0 +1,57 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+class TreeServer;
+
+/** Keeps count of how many remote members of each channel are behind each of the
+ * servers linked to us so that channel messages can be routed without walking the
+ * member list. The counts are updated as remote users join and leave channels.
+ *
+ * There are never any remote users when the module is loaded so the counts do not
+ * have to be built for existing channels.
+ */
+class RouteMembers
+{
+ public:
+	/** Maps a server linked to us to the number of members of a channel behind it. */
+	typedef insp::flat_map<TreeServer*, unsigned int> CountMap;
+
+ private:
+	/** The counts of each channel which has remote members. */
+	SimpleExtItem<CountMap> ext;
+
+ public:
+	RouteMembers(Module* mod);
+
+	/** Count a membership of a remote user.
+	 * @param memb The membership which was created.
+	 */
+	void Add(Membership* memb);
+
+	/** Stop counting a membership of a remote user.
+	 * @param memb The membership which is being removed.
+	 */
+	void Remove(Membership* memb);
+
+	/** Retrieves the counts of a channel.
+	 * @param chan The channel to retrieve the counts of.
+	 * @return The counts of the channel or NULL if it has no remote members.
+	 */
+	const CountMap* Get(const Channel* chan) const { return ext.get(chan); }
+};
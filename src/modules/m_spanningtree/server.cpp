@@ -146,6 +146,7 @@ Link* TreeSocket::AuthRemote(const CommandBase::Params& params)
 			ServerInstance->SNO->WriteGlobalSno('l', "Server connection to %s is not using SSL (TLS). This is VERY INSECURE and will not be allowed in the next major version of InspIRCd.", x->Name.c_str());
 		}
 
+		capab->compress = x->Compress;
 		return x;
 	}
 
@@ -223,6 +224,7 @@ bool TreeSocket::Inbound_Server(CommandBase::Params& params)
 
 		// Send our details: Our server name and description and hopcount of 0,
 		// along with the sendpass from this block.
+		this->SendXLineResync(params[0]);
 		this->WriteLine("SERVER "+ServerInstance->Config->ServerName+" "+this->MakePass(x->SendPass, this->GetTheirChallenge())+" 0 "+ServerInstance->Config->GetSID()+" :"+ServerInstance->Config->ServerDesc);
 
 		// move to the next state, we are now waiting for THEM.
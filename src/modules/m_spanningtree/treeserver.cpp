@@ -51,6 +51,7 @@ TreeServer::TreeServer()
 	, OperCount(0)
 	, rtt(0)
 	, StartBurst(0)
+	, LastBurstTime(0)
 	, Hidden(false)
 {
 	AddHashEntry();
@@ -73,6 +74,7 @@ TreeServer::TreeServer(const std::string& Name, const std::string& Desc, const s
 	, OperCount(0)
 	, rtt(0)
 	, StartBurst(0)
+	, LastBurstTime(0)
 	, Hidden(Hide)
 {
 	ServerInstance->Logs->Log(MODNAME, LOG_DEBUG, "New server %s behind_bursting %u", GetName().c_str(), behind_bursting);
@@ -169,6 +171,7 @@ void TreeServer::FinishBurst()
 	ServerInstance->XLines->ApplyLines();
 	uint64_t ts = ServerInstance->Time() * 1000 + (ServerInstance->Time_ns() / 1000000);
 	unsigned long bursttime = ts - this->StartBurst;
+	LastBurstTime = bursttime;
 	ServerInstance->SNO->WriteToSnoMask(Parent == Utils->TreeRoot ? 'l' : 'L', "Received end of netburst from \002%s\002 (burst time: %lu %s)",
 		GetName().c_str(), (bursttime > 10000 ? bursttime / 1000 : bursttime), (bursttime > 10000 ? "secs" : "msecs"));
 	FOREACH_MOD_CUSTOM(Utils->Creator->GetLinkEventProvider(), ServerProtocol::LinkEventListener, OnServerBurst, (this));
@@ -163,6 +163,10 @@ class TreeServer : public Server
 	 */
 	uint64_t StartBurst;
 
+	/** How long the last burst received from this server took in milliseconds, or 0 if none has finished.
+	 */
+	unsigned long LastBurstTime;
+
 	/** True if this server is hidden
 	 */
 	bool Hidden;
@@ -30,6 +30,10 @@
 #include "inspircd.h"
 
 #include "utils.h"
+#include "burstparser.h"
+#include "linkstats.h"
+
+class ServerCommand;
 
 /*
  * The server list in InspIRCd is maintained as two structures
@@ -87,6 +91,12 @@ struct CapabData
 	std::string sid;
 	std::string name;
 	bool hidden;
+
+	// Whether we may compress the data we send to the other server
+	bool compress;
+
+	// The sequence number of the first X-line change we can resync the other server from or 0 if it needs every X-line
+	unsigned long xlinesince;
 };
 
 /** Every SERVER connection inbound or outbound is represented by an object of
@@ -97,6 +107,20 @@ class TreeSocket : public BufferedSocket
 {
 	struct BurstState;
 
+	/** The metadata keys and values which have been sent in CMETA lines during our burst. */
+	struct CompactDictionary
+	{
+		/** Maps each key and value which has been sent to 0 if it has only been sent once,
+		 * otherwise to one more than its index in the dictionary of the remote server.
+		 */
+		TR1NS::unordered_map<std::string, unsigned long> values;
+
+		/** The number of entries in the dictionary of the remote server. */
+		size_t size;
+
+		CompactDictionary() : size(0) { }
+	};
+
 	std::string linkID;			/* Description for this link */
 	ServerState LinkState;			/* Link state */
 	CapabData* capab;			/* Link setup data (held until burst is sent) */
@@ -109,6 +133,53 @@ class TreeSocket : public BufferedSocket
 	 */
 	bool burstsent;
 
+	/** The state of the burst we are sending or NULL if we are not sending one. */
+	BurstState* burst;
+
+	/** True if the remote server accepts users and channels in the compact burst encoding. */
+	bool compactburst;
+
+	/** True if the remote server accepts the metadata of users in CMETA lines. */
+	bool compactmeta;
+
+	/** Parameters of the last compact line which was received, kept to reuse their storage. */
+	CommandBase::Params compactparams;
+
+	/** The metadata keys and values which the remote server has added to the dictionary during its burst. */
+	std::vector<std::string> compactdictionary;
+
+	/** The number of lines sent in the current second. */
+	unsigned long linesthissecond;
+
+	/** The number of lines sent in the second before linesecond. */
+	unsigned long lineslastsecond;
+
+	/** The second linesthissecond is being counted for. */
+	time_t linesecond;
+
+	/** The number of times data has been written to the socket. */
+	unsigned long flushes;
+
+	/** The number of bytes which have been written to the socket. */
+	unsigned long long flushedbytes;
+
+	/** The journal epoch advertised by the remote server or empty if it does not have a journal. */
+	std::string journalepoch;
+
+	/** The journal sequence number when the last PING was sent or 0 if it was sent during our burst. */
+	unsigned long journalping;
+
+	/** The sequence number of the first X-line change the remote server is not known to have seen or 0 if it is not known. */
+	unsigned long journalacked;
+
+	/** Statistics about the lines sent and received on this link. */
+	LinkStats linkstats;
+
+	/** Update the line counters after a line has been queued on the socket.
+	 * @param line The line which was queued without a new line character at the end
+	 */
+	void CountLine(const std::string& line);
+
 	/** Checks if the given servername and sid are both free
 	 */
 	bool CheckDuplicate(const std::string& servername, const std::string& sid);
@@ -120,8 +191,30 @@ class TreeSocket : public BufferedSocket
 	/** Send all known information about a channel */
 	void SyncChannel(Channel* chan, BurstState& bs);
 
-	/** Send all users and their oper state, away state and metadata */
-	void SendUsers(BurstState& bs);
+	/** Send a user and their oper state, away state and metadata */
+	void SendUser(User* user, BurstState& bs);
+
+	/** Send more of the burst until the send queue is full or the burst is complete. */
+	void ContinueBurst();
+
+	/** Send a user from the snapshot taken at the start of our burst if it has not been sent yet.
+	 * @param uuid The UUID of the user.
+	 */
+	void SendPendingUser(const std::string& uuid);
+
+	/** Send a channel from the snapshot taken at the start of our burst if it has not been sent yet.
+	 * @param name The name of the channel.
+	 */
+	void SendPendingChannel(const std::string& name);
+
+	/** Send the users and channels which a line written whilst we are bursting refers to if the
+	 * burst has not reached them yet.
+	 * @param line The line which is about to be sent.
+	 */
+	void SendReferencedObjects(const std::string& line);
+
+	/** Free the state of the burst we are sending, if any. */
+	void DeleteBurstState();
 
 	/** Send all additional info about the given server to this server */
 	void SendServerInfo(TreeServer* from);
@@ -162,6 +255,12 @@ class TreeSocket : public BufferedSocket
 	 */
 	void WriteLineNoCompat(const std::string& line);
 
+	/** Write a line which has already been serialized on this socket, skipping all translation for old protocols
+	 * @param line Line to write without a new line character at the end
+	 * @param serialized The line with a new line character at the end
+	 */
+	void WriteLineNoCompat(const std::string& line, const SendQueue::Element& serialized);
+
  public:
 	const time_t age;
 
@@ -224,6 +323,11 @@ class TreeSocket : public BufferedSocket
 	 */
 	void OnConnected() CXX11_OVERRIDE;
 
+	/** Called when the socket can be written to. Sends more of the burst if we are
+	 * still sending one.
+	 */
+	void OnEventHandlerWrite() CXX11_OVERRIDE;
+
 	/** Handle socket error event
 	 */
 	void OnError(BufferedSocketError e) CXX11_OVERRIDE;
@@ -265,9 +369,78 @@ class TreeSocket : public BufferedSocket
 	 */
 	void SendFJoins(Channel* c);
 
+	/** Send one or more CFJOINs for a channel of users. */
+	void SendCompactFJoins(Channel* chan);
+
+	/** Build a CUID line introducing a user.
+	 * @param user The user to introduce.
+	 * @return The CUID line.
+	 */
+	static std::string MakeCompactUID(User* user);
+
+	/** Build a CMETA line containing the metadata of a user.
+	 * @param user The user whose metadata to send.
+	 * @param dictionary The keys and values which have been sent so far in this burst.
+	 * @param line The string to store the line in.
+	 * @return True if the user has any metadata, false if there is nothing to send.
+	 */
+	static bool MakeCompactMetadata(User* user, CompactDictionary& dictionary, std::string& line);
+
+	/** Check whether a line uses the compact burst encoding.
+	 * @param line The line to check.
+	 * @return True if the line is a CUID, CFJOIN or CMETA, false otherwise.
+	 */
+	static bool IsCompactLine(const std::string& line);
+
+	/** Get the command of a line which uses the compact burst encoding.
+	 * @param line The line to get the command of.
+	 * @return Either "CUID", "CFJOIN" or "CMETA".
+	 */
+	static const char* GetCompactCommand(const std::string& line);
+
+	/** Decode the fields of a line which uses the compact burst encoding. This does not
+	 * access any state and is safe to call from any thread.
+	 * @param line The line to decode.
+	 * @param params The parameter list to store the fields in. Existing strings in it are reused.
+	 * @param decodeerror Set to the reason the line is malformed if decoding fails.
+	 * @return True if the line was decoded, false if it is malformed.
+	 */
+	static bool DecodeCompactLine(const std::string& line, CommandBase::Params& params, std::string& decodeerror);
+
+	/** Process a line which uses the compact burst encoding. */
+	void ProcessCompactLine(const std::string& line);
+
+	/** Process a line which uses the compact burst encoding and has already been decoded.
+	 * @param line The line which was decoded.
+	 * @param params The decoded fields of the line.
+	 */
+	void ProcessCompactLine(const std::string& line, CommandBase::Params& params);
+
+	/** Replace a CMETA key or value with the data it represents, adding it to the dictionary if requested.
+	 * @param field The key or value including its marker.
+	 */
+	void ResolveCompactField(std::string& field);
+
+	/** Process a CMETA line which has been decoded by handling each key and value as a METADATA.
+	 * @param server The server the user is on.
+	 * @param scmd The handler of METADATA.
+	 * @param params The decoded fields of the line.
+	 */
+	void ProcessCompactMetadata(TreeServer* server, ServerCommand* scmd, CommandBase::Params& params);
+
 	/** Send G-, Q-, Z- and E-lines */
 	void SendXLines();
 
+	/** Tell the other server whether we can send it only the X-line changes it missed.
+	 * @param remotename The name of the other server.
+	 */
+	void SendXLineResync(const std::string& remotename);
+
+	/** Send the X-line changes recorded in the journal since a server split from us.
+	 * @param changes The changes to send, oldest first.
+	 */
+	void SendXLineChanges(const XLineJournal::EntryList& changes);
+
 	/** Send all known information about a channel */
 	void SyncChannel(Channel* chan);
 
@@ -275,6 +448,8 @@ class TreeSocket : public BufferedSocket
 	 * server. There is a set order we must do this, because for example
 	 * users require their servers to exist, and channels require their
 	 * users to exist. You get the idea.
+	 * The burst is sent a part at a time as the socket drains. Anything else
+	 * written to the socket in the meantime is held back until it is complete.
 	 */
 	void DoBurst(TreeServer* s);
 
@@ -287,6 +462,43 @@ class TreeSocket : public BufferedSocket
 	 */
 	void WriteLine(const std::string& line);
 
+	/** Send a line which is being sent to more than one server down the socket.
+	 * The serialized line is queued without copying it unless it has to be
+	 * translated for the protocol version of the remote server.
+	 * @param line Line to write without a new line character at the end
+	 * @param serialized The line with a new line character at the end as created by SerializeLine()
+	 */
+	void WriteLine(const std::string& line, const SendQueue::Element& serialized);
+
+	/** Create a send queue element containing a line and a new line character which
+	 * can be queued on any number of server sockets.
+	 * @param line Line to serialize without a new line character at the end
+	 * @return The serialized line
+	 */
+	static SendQueue::Element SerializeLine(const std::string& line);
+
+	/** Get the number of lines which were sent to this server in the last second.
+	 * @return The number of lines sent in the last full second
+	 */
+	unsigned long GetLinesPerSecond() const;
+
+	/** Get the average number of bytes written to this socket at once.
+	 * @return The average number of bytes written each time the send queue was flushed
+	 */
+	unsigned long GetBytesPerFlush() const { return flushes ? flushedbytes / flushes : 0; }
+
+	/** Get the statistics about the lines sent and received on this link. */
+	const LinkStats& GetLinkStats() const { return linkstats; }
+
+	/** Called when the remote server has finished bursting to discard the dictionary used by CMETA lines. */
+	void ClearCompactDictionary() { std::vector<std::string>().swap(compactdictionary); }
+
+	/** Called when a PING has been sent to this server. */
+	void OnPingSent();
+
+	/** Called when this server has answered the last PING sent to it. */
+	void OnPongReceived() { if (journalping) journalacked = journalping; }
+
 	/** Handle ERROR command */
 	void Error(CommandBase::Params& params);
 
@@ -298,14 +510,32 @@ class TreeSocket : public BufferedSocket
 	 */
 	bool Inbound_Server(CommandBase::Params& params);
 
-	/** Handle IRC line split
+	/** Handle IRC line split. This does not access any state and is safe to call from any thread.
+	 * @return True if the line was split, false if it is malformed in which case spliterror is set to the reason.
 	 */
-	void Split(const std::string& line, std::string& tags, std::string& prefix, std::string& command, CommandBase::Params& params);
+	static bool Split(const std::string& line, std::string& tags, std::string& prefix, std::string& command, CommandBase::Params& params, std::string& spliterror);
 
 	/** Process complete line from buffer
 	 */
 	void ProcessLine(std::string &line);
 
+	/** Process a line which was split by the burst parser. */
+	void ProcessParsedLine(BurstParser::Line& line);
+
+	/** Process a line which has been split into its parts. */
+	void ProcessSplitLine(std::string& tags, std::string& prefix, std::string& command, CommandBase::Params& params);
+
+	/** Read all complete lines from the receive queue, split them using the burst
+	 * parser and then process them in order.
+	 */
+	void ProcessBurstLines();
+
+	/** Report an error which occurred while processing a line.
+	 * @param line The line which was being processed.
+	 * @param ex The exception which was thrown.
+	 */
+	void OnLineError(const std::string& line, const CoreException& ex);
+
 	/** Process message tags received from a remote server. */
 	void ProcessTag(User* source, const std::string& tag, ClientProtocol::TagMap& tags);
 
@@ -33,6 +33,18 @@
 #include "treesocket.h"
 #include "commands.h"
 
+namespace
+{
+	/** Retrieves the provider of the hook used to compress server links or NULL if compression is unavailable. */
+	IOHookProvider* GetCompressionProvider()
+	{
+		if (Utils->LinkCompression.empty())
+			return NULL;
+
+		return static_cast<IOHookProvider*>(ServerInstance->Modules->FindService(SERVICE_IOHOOK, "compress/" + Utils->LinkCompression));
+	}
+}
+
 /** Constructor for outgoing connections.
  * Because most of the I/O gubbins are encapsulated within
  * BufferedSocket, we just call DoConnect() for most of the action,
@@ -44,6 +56,16 @@ TreeSocket::TreeSocket(Link* link, Autoconnect* myac, const irc::sockets::sockad
 	, MyRoot(NULL)
 	, proto_version(0)
 	, burstsent(false)
+	, burst(NULL)
+	, compactburst(false)
+	, compactmeta(false)
+	, linesthissecond(0)
+	, lineslastsecond(0)
+	, linesecond(0)
+	, flushes(0)
+	, flushedbytes(0)
+	, journalping(0)
+	, journalacked(0)
 	, age(ServerInstance->Time())
 {
 	capab = new CapabData;
@@ -51,6 +73,8 @@ TreeSocket::TreeSocket(Link* link, Autoconnect* myac, const irc::sockets::sockad
 	capab->ac = myac;
 	capab->capab_phase = 0;
 	capab->remotesa = dest;
+	capab->compress = false;
+	capab->xlinesince = 0;
 
 	irc::sockets::sockaddrs bind;
 	memset(&bind, 0, sizeof(bind));
@@ -72,6 +96,11 @@ TreeSocket::TreeSocket(Link* link, Autoconnect* myac, const irc::sockets::sockad
 		}
 	}
 
+	// The compression hook has to be closest to us so it is added before any SSL hook.
+	IOHookProvider* compressprov = GetCompressionProvider();
+	if (compressprov)
+		compressprov->OnConnect(this);
+
 	DoConnect(dest, bind, link->Timeout);
 	Utils->timeoutlist[this] = std::pair<std::string, unsigned int>(linkID, link->Timeout);
 	SendCapabilities(1);
@@ -86,11 +115,27 @@ TreeSocket::TreeSocket(int newfd, ListenSocket* via, irc::sockets::sockaddrs* cl
 	, MyRoot(NULL)
 	, proto_version(0)
 	, burstsent(false)
+	, burst(NULL)
+	, compactburst(false)
+	, compactmeta(false)
+	, linesthissecond(0)
+	, lineslastsecond(0)
+	, linesecond(0)
+	, flushes(0)
+	, flushedbytes(0)
+	, journalping(0)
+	, journalacked(0)
 	, age(ServerInstance->Time())
 {
 	capab = new CapabData;
 	capab->capab_phase = 0;
 	capab->remotesa = *client;
+	capab->compress = false;
+	capab->xlinesince = 0;
+
+	IOHookProvider* compressprov = GetCompressionProvider();
+	if (compressprov)
+		compressprov->OnAccept(this, client, server);
 
 	for (ListenSocket::IOHookProvList::iterator i = via->iohookprovs.begin(); i != via->iohookprovs.end(); ++i)
 	{
@@ -132,6 +177,7 @@ CullResult TreeSocket::cull()
 TreeSocket::~TreeSocket()
 {
 	delete capab;
+	DeleteBurstState();
 }
 
 /** When an outbound connection finishes connecting, we receive
@@ -210,6 +256,15 @@ CmdResult CommandSQuit::HandleServer(TreeServer* server, CommandBase::Params& pa
 void TreeSocket::OnDataReady()
 {
 	Utils->Creator->loopCall = true;
+
+	// Lines from a server which is bursting to us are split on the burst parser threads.
+	if ((Utils->BurstParse) && (LinkState == CONNECTED) && (MyRoot->IsBursting()))
+	{
+		ProcessBurstLines();
+		Utils->Creator->loopCall = false;
+		return;
+	}
+
 	std::string line;
 	while (GetNextLine(line))
 	{
@@ -228,9 +283,7 @@ void TreeSocket::OnDataReady()
 		}
 		catch (CoreException& ex)
 		{
-			ServerInstance->Logs->Log(MODNAME, LOG_DEFAULT, "Error while processing: " + line);
-			ServerInstance->Logs->Log(MODNAME, LOG_DEFAULT, ex.GetReason());
-			SendError(ex.GetReason() + " - check the log file for details");
+			OnLineError(line, ex);
 		}
 
 		if (!getError().empty())
@@ -240,3 +293,51 @@ void TreeSocket::OnDataReady()
 		SendError("RecvQ overrun (line too long)");
 	Utils->Creator->loopCall = false;
 }
+
+void TreeSocket::ProcessBurstLines()
+{
+	BurstParser::LineList lines;
+	bool nullchar = false;
+	std::string line;
+	while (GetNextLine(line))
+	{
+		std::string::size_type rline = line.find('\r');
+		if (rline != std::string::npos)
+			line.erase(rline);
+		if (line.find('\0') != std::string::npos)
+		{
+			nullchar = true;
+			break;
+		}
+
+		lines.push_back(BurstParser::Line());
+		lines.back().line.swap(line);
+	}
+
+	Utils->BurstParse->Split(lines);
+
+	for (BurstParser::LineList::iterator i = lines.begin(); i != lines.end(); ++i)
+	{
+		try
+		{
+			ProcessParsedLine(*i);
+		}
+		catch (CoreException& ex)
+		{
+			OnLineError(i->line, ex);
+		}
+
+		if (!getError().empty())
+			return;
+	}
+
+	if (nullchar)
+		SendError("Read null character from socket");
+}
+
+void TreeSocket::OnLineError(const std::string& line, const CoreException& ex)
+{
+	ServerInstance->Logs->Log(MODNAME, LOG_DEFAULT, "Error while processing: " + line);
+	ServerInstance->Logs->Log(MODNAME, LOG_DEFAULT, ex.GetReason());
+	SendError(ex.GetReason() + " - check the log file for details");
+}
@@ -41,27 +41,27 @@ void TreeSocket::Error(CommandBase::Params& params)
 	SetError("received ERROR " + msg);
 }
 
-void TreeSocket::Split(const std::string& line, std::string& tags, std::string& prefix, std::string& command, CommandBase::Params& params)
+bool TreeSocket::Split(const std::string& line, std::string& tags, std::string& prefix, std::string& command, CommandBase::Params& params, std::string& spliterror)
 {
 	std::string token;
 	irc::tokenstream tokens(line);
 
 	if (!tokens.GetMiddle(token))
-		return;
+		return true;
 
 	if (token[0] == '@')
 	{
 		if (token.length() <= 1)
 		{
-			this->SendError("BUG: Received a message with empty tags: " + line);
-			return;
+			spliterror = "BUG: Received a message with empty tags: " + line;
+			return false;
 		}
 
 		tags.assign(token, 1, std::string::npos);
 		if (!tokens.GetMiddle(token))
 		{
-			this->SendError("BUG: Received a message with no command: " + line);
-			return;
+			spliterror = "BUG: Received a message with no command: " + line;
+			return false;
 		}
 	}
 
@@ -69,21 +69,22 @@ void TreeSocket::Split(const std::string& line, std::string& tags, std::string&
 	{
 		if (token.length() <= 1)
 		{
-			this->SendError("BUG: Received a message with an empty prefix: " + line);
-			return;
+			spliterror = "BUG: Received a message with an empty prefix: " + line;
+			return false;
 		}
 
 		prefix.assign(token, 1, std::string::npos);
 		if (!tokens.GetMiddle(token))
 		{
-			this->SendError("BUG: Received a message with no command: " + line);
-			return;
+			spliterror = "BUG: Received a message with no command: " + line;
+			return false;
 		}
 	}
 
 	command.assign(token);
 	while (tokens.GetTrailing(token))
 		params.push_back(token);
+	return true;
 }
 
 void TreeSocket::ProcessLine(std::string &line)
@@ -95,8 +96,56 @@ void TreeSocket::ProcessLine(std::string &line)
 
 	ServerInstance->Logs->Log(MODNAME, LOG_RAWIO, "S[%d] I %s", this->GetFd(), line.c_str());
 
-	Split(line, tags, prefix, command, params);
+	const unsigned long long start = LinkStats::GetMicroseconds();
+	if ((this->LinkState == CONNECTED) && (IsCompactLine(line)))
+	{
+		ProcessCompactLine(line);
+		linkstats.Received(GetCompactCommand(line), line.length() + 1, start);
+		return;
+	}
+
+	std::string spliterror;
+	if (!Split(line, tags, prefix, command, params, spliterror))
+	{
+		this->SendError(spliterror);
+		return;
+	}
+
+	ProcessSplitLine(tags, prefix, command, params);
+	linkstats.Received(command, line.length() + 1, start);
+}
+
+void TreeSocket::ProcessParsedLine(BurstParser::Line& line)
+{
+	ServerInstance->Logs->Log(MODNAME, LOG_RAWIO, "S[%d] I %s", this->GetFd(), line.line.c_str());
+
+	if (line.compact)
+	{
+		if (!line.error.empty())
+			throw ProtocolException(line.error);
+
+		if (this->LinkState == CONNECTED)
+		{
+			const unsigned long long start = LinkStats::GetMicroseconds();
+			ProcessCompactLine(line.line, line.params);
+			linkstats.Received(GetCompactCommand(line.line), line.line.length() + 1, start);
+		}
+		return;
+	}
+
+	if (!line.error.empty())
+	{
+		this->SendError(line.error);
+		return;
+	}
+
+	const unsigned long long start = LinkStats::GetMicroseconds();
+	ProcessSplitLine(line.tags, line.prefix, line.command, line.params);
+	linkstats.Received(line.command, line.line.length() + 1, start);
+}
 
+void TreeSocket::ProcessSplitLine(std::string& tags, std::string& prefix, std::string& command, CommandBase::Params& params)
+{
 	if (command.empty())
 		return;
 
@@ -418,7 +467,12 @@ void TreeSocket::Close()
 	// If the connection is fully up (state CONNECTED)
 	// then propagate a netsplit to all peers.
 	if (MyRoot)
+	{
+		// Remember which X-line changes the server has seen in case it relinks soon.
+		if (journalacked && !journalepoch.empty())
+			Utils->Journal.SetPeer(MyRoot->GetName(), journalepoch, journalacked);
 		MyRoot->SQuit(getError(), true);
+	}
 
 	ServerInstance->SNO->WriteGlobalSno('l', "Connection to '\002%s\002' failed.", linkID.c_str());
 
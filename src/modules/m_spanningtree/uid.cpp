@@ -48,34 +48,44 @@ CmdResult CommandUID::HandleServer(TreeServer* remoteserver, CommandBase::Params
 	if (modestr[0] != '+')
 		throw ProtocolException("Invalid mode string");
 
-	// See if there is a nick collision
-	User* collideswith = ServerInstance->FindNickOnly(params[2]);
-	if ((collideswith) && (collideswith->registered != REG_ALL))
-	{
-		// User that the incoming user is colliding with is not fully registered, we force nick change the
-		// unregistered user to their uuid and tell them what happened
-		LocalUser* const localuser = static_cast<LocalUser*>(collideswith);
-		localuser->OverruleNick();
-	}
-	else if (collideswith)
+	/* For remote users, we pass the UUID they sent to the constructor.
+	 * If the UUID already exists User::User() throws an exception which causes this connection to be closed.
+	 */
+	RemoteUser* _new = new SpanningTree::RemoteUser(params[0], remoteserver);
+
+	// Claim the nick with a single lookup. During a netmerge most nicks are free so a
+	// collision only has to be looked into when the nick turns out to be taken.
+	user_hash& clientlist = ServerInstance->Users->clientlist;
+	std::pair<user_hash::iterator, bool> claim = clientlist.insert(std::make_pair(params[2], static_cast<User*>(_new)));
+	if (!claim.second)
 	{
-		// The user on this side is registered, handle the collision
-		bool they_change = Utils->DoCollision(collideswith, remoteserver, age_t, params[5], params[6], params[0], "UID");
-		if (they_change)
+		User* const collideswith = claim.first->second;
+		if (collideswith->registered != REG_ALL)
 		{
-			// The client being introduced needs to change nick to uuid, change the nick in the message before
-			// processing/forwarding it. Also change the nick TS to CommandSave::SavedTimestamp.
-			age_t = CommandSave::SavedTimestamp;
-			params[1] = ConvToStr(CommandSave::SavedTimestamp);
-			params[2] = params[0];
+			// User that the incoming user is colliding with is not fully registered, we force nick change the
+			// unregistered user to their uuid and tell them what happened
+			LocalUser* const localuser = static_cast<LocalUser*>(collideswith);
+			localuser->OverruleNick();
 		}
+		else
+		{
+			// The user on this side is registered, handle the collision
+			bool they_change = Utils->DoCollision(collideswith, remoteserver, age_t, params[5], params[6], params[0], "UID");
+			if (they_change)
+			{
+				// The client being introduced needs to change nick to uuid, change the nick in the message before
+				// processing/forwarding it. Also change the nick TS to CommandSave::SavedTimestamp.
+				age_t = CommandSave::SavedTimestamp;
+				params[1] = ConvToStr(CommandSave::SavedTimestamp);
+				params[2] = params[0];
+			}
+		}
+
+		// The user on this side has either moved to their uuid or kept the nick, in which case
+		// the incoming user is introduced with their uuid as their nick instead.
+		clientlist[params[2]] = _new;
 	}
 
-	/* For remote users, we pass the UUID they sent to the constructor.
-	 * If the UUID already exists User::User() throws an exception which causes this connection to be closed.
-	 */
-	RemoteUser* _new = new SpanningTree::RemoteUser(params[0], remoteserver);
-	ServerInstance->Users->clientlist[params[2]] = _new;
 	_new->nick = params[2];
 	_new->ChangeRealHost(params[3], false);
 	_new->ChangeDisplayedHost(params[4]);
@@ -33,6 +33,7 @@
 #include "treesocket.h"
 #include "resolvers.h"
 #include "commandbuilder.h"
+#include "burstparser.h"
 
 SpanningTreeUtilities* Utils = NULL;
 
@@ -108,7 +109,8 @@ TreeServer* SpanningTreeUtilities::FindRouteTarget(const std::string& target)
 }
 
 SpanningTreeUtilities::SpanningTreeUtilities(ModuleSpanningTree* C)
-	: Creator(C), TreeRoot(NULL)
+	: Creator(C), BurstParse(NULL)
+	, TreeRoot(NULL)
 	, PingFreq(60) // XXX: TreeServer constructor reads this and TreeRoot is created before the config is read, so init it to something (value doesn't matter) to avoid a valgrind warning in TimerManager on unload
 {
 	ServerInstance->Timers.AddTimer(&RefreshTimer);
@@ -136,6 +138,7 @@ CullResult SpanningTreeUtilities::cull()
 SpanningTreeUtilities::~SpanningTreeUtilities()
 {
 	delete TreeRoot;
+	delete BurstParse;
 }
 
 // Returns a list of DIRECT servers for a specific channel
@@ -149,31 +152,55 @@ void SpanningTreeUtilities::GetListOfServersForChannel(Channel* c, TreeSocketSet
 			minrank = mh->GetPrefixRank();
 	}
 
-	TreeServer::ChildServers children = TreeRoot->GetChildren();
-	const Channel::MemberMap& ulist = c->GetUsers();
-	for (Channel::MemberMap::const_iterator i = ulist.begin(); i != ulist.end(); ++i)
+	if (minrank)
 	{
-		if (IS_LOCAL(i->first))
-			continue;
+		// Only members with a high enough rank are wanted so the member list has to be walked.
+		const Channel::MemberMap& ulist = c->GetUsers();
+		for (Channel::MemberMap::const_iterator i = ulist.begin(); i != ulist.end(); ++i)
+		{
+			if (IS_LOCAL(i->first))
+				continue;
 
-		if (minrank && i->second->getRank() < minrank)
-			continue;
+			if (i->second->getRank() < minrank)
+				continue;
 
-		if (exempt_list.find(i->first) == exempt_list.end())
-		{
-			TreeServer* best = TreeServer::Get(i->first);
-			list.insert(best->GetSocket());
+			if (exempt_list.find(i->first) == exempt_list.end())
+				list.insert(TreeServer::Get(i->first)->GetSocket());
+		}
+	}
+	else if (const RouteMembers::CountMap* counts = Creator->routemembers.Get(c))
+	{
+		for (RouteMembers::CountMap::const_iterator i = counts->begin(); i != counts->end(); ++i)
+			list.insert(i->first->GetSocket());
 
-			TreeServer::ChildServers::iterator citer = std::find(children.begin(), children.end(), best);
-			if (citer != children.end())
-				children.erase(citer);
+		// An exempt member only keeps a server from getting the message if they are the
+		// only member behind it.
+		RouteMembers::CountMap remaining;
+		for (CUList::const_iterator i = exempt_list.begin(); i != exempt_list.end(); ++i)
+		{
+			User* exempt = *i;
+			if (IS_LOCAL(exempt) || !c->HasUser(exempt))
+				continue;
+
+			TreeServer* route = TreeServer::Get(exempt)->GetRoute();
+			RouteMembers::CountMap::const_iterator count = counts->find(route);
+			if (count == counts->end())
+				continue;
+
+			std::pair<RouteMembers::CountMap::iterator, bool> ret = remaining.insert(std::make_pair(route, count->second));
+			if (!--ret.first->second)
+				list.erase(route->GetSocket());
 		}
 	}
 
 	// Check whether the servers which do not have users in the channel might need this message. This
 	// is used to keep the chanhistory module synchronised between servers.
+	const TreeServer::ChildServers& children = TreeRoot->GetChildren();
 	for (TreeServer::ChildServers::const_iterator i = children.begin(); i != children.end(); ++i)
 	{
+		if (list.find((*i)->GetSocket()) != list.end())
+			continue;
+
 		ModResult result;
 		FIRST_MOD_RESULT_CUSTOM(Creator->GetBroadcastEventProvider(), ServerProtocol::BroadcastEventListener, OnBroadcastMessage, result, (c, *i));
 		if (result == MOD_RES_ALLOW)
@@ -185,6 +212,8 @@ void SpanningTreeUtilities::DoOneToAllButSender(const CmdBuilder& params, TreeSe
 {
 	const std::string& FullLine = params.str();
 
+	// The line is serialized once and the same copy is queued on every route.
+	StreamSocket::SendQueue::Element serialized;
 	const TreeServer::ChildServers& children = TreeRoot->GetChildren();
 	for (TreeServer::ChildServers::const_iterator i = children.begin(); i != children.end(); ++i)
 	{
@@ -192,7 +221,9 @@ void SpanningTreeUtilities::DoOneToAllButSender(const CmdBuilder& params, TreeSe
 		// Send the line if the route isn't the path to the one to be omitted
 		if (Route != omitroute)
 		{
-			Route->GetSocket()->WriteLine(FullLine);
+			if (serialized.empty())
+				serialized = TreeSocket::SerializeLine(FullLine);
+			Route->GetSocket()->WriteLine(FullLine, serialized);
 		}
 	}
 }
@@ -251,6 +282,16 @@ void SpanningTreeUtilities::ReadConfiguration()
 	quiet_bursts = ServerInstance->Config->ConfValue("performance")->getBool("quietbursts");
 	PingWarnTime = options->getDuration("pingwarning", 15);
 	PingFreq = options->getDuration("serverpingfreq", 60, 1);
+	LinkCompression = options->getString("linkcompression", "zlib");
+	BurstSendQ = options->getUInt("burstsendq", 262144, 4096);
+	Journal.SetMaxEntries(options->getUInt("journalsize", 1000, 0, 1000000));
+
+	const unsigned int burstthreads = options->getUInt("burstthreads", 0, 0, 64);
+	if ((BurstParse ? BurstParse->GetThreadCount() : 0) != burstthreads)
+	{
+		delete BurstParse;
+		BurstParse = burstthreads ? new BurstParser(burstthreads) : NULL;
+	}
 
 	if (PingWarnTime >= PingFreq)
 		PingWarnTime = 0;
@@ -278,6 +319,7 @@ void SpanningTreeUtilities::ReadConfiguration()
 		L->Hook = tag->getString("sslprofile", tag->getString("ssl"));
 		L->Bind = tag->getString("bind");
 		L->Hidden = tag->getBool("hidden");
+		L->Compress = tag->getBool("compress", true);
 
 		if (L->Name.empty())
 			throw ModuleException("Invalid configuration, found a link tag without a name!" + (!L->IPAddr.empty() ? " IP address: "+L->IPAddr : ""));
@@ -366,13 +408,18 @@ void SpanningTreeUtilities::SendChannelMessage(User* source, Channel* target, co
 	if (!text.empty())
 		msg.push_last(text);
 
+	StreamSocket::SendQueue::Element serialized;
 	TreeSocketSet list;
 	this->GetListOfServersForChannel(target, list, status, exempt_list);
 	for (TreeSocketSet::iterator i = list.begin(); i != list.end(); ++i)
 	{
 		TreeSocket* Sock = *i;
 		if (Sock != omit)
-			Sock->WriteLine(msg);
+		{
+			if (serialized.empty())
+				serialized = TreeSocket::SerializeLine(msg);
+			Sock->WriteLine(msg, serialized);
+		}
 	}
 }
 
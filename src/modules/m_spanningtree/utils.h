@@ -27,6 +27,7 @@
 
 #include "inspircd.h"
 #include "cachetimer.h"
+#include "journal.h"
 
 class TreeServer;
 class TreeSocket;
@@ -35,6 +36,7 @@ class Autoconnect;
 class ModuleSpanningTree;
 class SpanningTreeUtilities;
 class CmdBuilder;
+class BurstParser;
 
 extern SpanningTreeUtilities* Utils;
 
@@ -80,6 +82,22 @@ class SpanningTreeUtilities : public classbase
 	 */
 	bool quiet_bursts;
 
+	/** The name of the compression algorithm to offer on server links or empty to not offer any.
+	 */
+	std::string LinkCompression;
+
+	/** The amount of data which can be queued on a server link before we stop adding more of a burst to it.
+	 */
+	unsigned long BurstSendQ;
+
+	/** Splits lines received from bursting servers on worker threads or NULL if this is disabled.
+	 */
+	BurstParser* BurstParse;
+
+	/** Recent X-line changes which are sent to servers which relink shortly after a split.
+	 */
+	XLineJournal Journal;
+
 	/* Number of seconds that a server can go without ping
 	 * before opers are warned of high latency.
 	 */
@@ -161,7 +161,9 @@ void SocketEngine::DelFd(EventHandler* eh)
 
 int SocketEngine::DispatchEvents()
 {
-	int i = epoll_wait(EngineHandle, &events[0], events.size(), 1000);
+	// Don't wait for events if a handler asked for a trial read or write while the
+	// previous ones were being dispatched.
+	int i = epoll_wait(EngineHandle, &events[0], events.size(), trials.empty() ? 1000 : 0);
 	ServerInstance->UpdateTime();
 
 	stats.TotalEvents += i;
@@ -167,7 +167,9 @@ int SocketEngine::DispatchEvents()
 {
 	struct timespec ts;
 	ts.tv_nsec = 0;
-	ts.tv_sec = 1;
+	// Don't wait for events if a handler asked for a trial read or write while the
+	// previous ones were being dispatched.
+	ts.tv_sec = trials.empty() ? 1 : 0;
 
 	int i = kevent(EngineHandle, &changelist.front(), ChangePos, &ke_list.front(), ke_list.size(), &ts);
 	ChangePos = 0;
@@ -156,7 +156,9 @@ void SocketEngine::DelFd(EventHandler* eh)
 
 int SocketEngine::DispatchEvents()
 {
-	int i = poll(&events[0], CurrentSetSize, 1000);
+	// Don't wait for events if a handler asked for a trial read or write while the
+	// previous ones were being dispatched.
+	int i = poll(&events[0], CurrentSetSize, trials.empty() ? 1000 : 0);
 	int processed = 0;
 	ServerInstance->UpdateTime();
 
@@ -130,7 +130,9 @@ void SocketEngine::OnSetEvent(EventHandler* eh, int old_mask, int new_mask)
 int SocketEngine::DispatchEvents()
 {
 	timeval tval;
-	tval.tv_sec = 1;
+	// Don't wait for events if a handler asked for a trial read or write while the
+	// previous ones were being dispatched.
+	tval.tv_sec = trials.empty() ? 1 : 0;
 	tval.tv_usec = 0;
 
 	fd_set rfdset = ReadSet, wfdset = WriteSet, errfdset = ErrSet;
@@ -36,6 +36,7 @@ void Timer::SetInterval(unsigned int newinterval)
 
 Timer::Timer(unsigned int secs_from_now, bool repeating)
 	: trigger(ServerInstance->Time() + secs_from_now)
+	, bucket(NULL)
 	, secs(secs_from_now)
 	, repeat(repeating)
 {
@@ -46,42 +47,161 @@ Timer::~Timer()
 	ServerInstance->Timers.DelTimer(this);
 }
 
-void TimerManager::TickTimers(time_t TIME)
+namespace
 {
-	for (TimerMap::iterator i = Timers.begin(); i != Timers.end(); )
+	bool CompareTrigger(const Timer* first, const Timer* second)
 	{
-		Timer* t = i->second;
-		if (t->GetTrigger() > TIME)
-			break;
+		return first->GetTrigger() < second->GetTrigger();
+	}
 
-		Timers.erase(i++);
+	void Drain(insp::intrusive_list_tail<Timer>& bucket, std::vector<Timer*>& out)
+	{
+		while (!bucket.empty())
+		{
+			out.push_back(bucket.front());
+			bucket.pop_front();
+		}
+	}
+}
 
-		if (!t->Tick(TIME))
-			continue;
+TimerManager::TimerManager()
+	: nexttick(0)
+{
+}
+
+void TimerManager::Schedule(Timer* t)
+{
+	// Timers which should have triggered already go in the next bucket to be processed.
+	const time_t trigger = std::max(t->GetTrigger(), nexttick);
+	const uint64_t delta = trigger - nexttick;
 
-		if (t->GetRepeat())
+	TimerList* bucket;
+	if (delta < ROOT_SIZE)
+	{
+		bucket = &root[trigger & (ROOT_SIZE - 1)];
+	}
+	else
+	{
+		// Find the first level which covers the trigger time. Timers which are too far
+		// in the future for any level go in the last one and get moved back up there
+		// each time that level wraps around until they are in range.
+		unsigned int level = 0;
+		unsigned int shift = ROOT_BITS;
+		while (level < LEVEL_COUNT - 1 && delta >= (uint64_t(1) << (shift + LEVEL_BITS)))
 		{
-			t->SetTrigger(TIME + t->GetInterval());
-			AddTimer(t);
+			level++;
+			shift += LEVEL_BITS;
 		}
+
+		uint64_t slot = trigger;
+		if (delta >= (uint64_t(1) << (shift + LEVEL_BITS)))
+			slot = nexttick + (uint64_t(1) << (shift + LEVEL_BITS)) - 1;
+		bucket = &levels[level][(slot >> shift) & (LEVEL_SIZE - 1)];
 	}
+
+	bucket->push_back(t);
+	t->bucket = bucket;
 }
 
-void TimerManager::DelTimer(Timer* t)
+void TimerManager::Cascade(TimerList& bucket)
+{
+	while (!bucket.empty())
+	{
+		Timer* t = bucket.front();
+		bucket.pop_front();
+		Schedule(t);
+	}
+}
+
+void TimerManager::Rebuild(time_t TIME)
 {
-	std::pair<TimerMap::iterator, TimerMap::iterator> itpair = Timers.equal_range(t->GetTrigger());
+	std::vector<Timer*> pending;
+	for (size_t i = 0; i < ROOT_SIZE; ++i)
+		Drain(root[i], pending);
 
-	for (TimerMap::iterator i = itpair.first; i != itpair.second; ++i)
+	for (size_t i = 0; i < LEVEL_COUNT; ++i)
 	{
-		if (i->second == t)
+		for (size_t j = 0; j < LEVEL_SIZE; ++j)
+			Drain(levels[i][j], pending);
+	}
+
+	// Timers which were due while the clock jumped all end up in the same bucket
+	// so put them in there in the order in which they would have triggered.
+	std::stable_sort(pending.begin(), pending.end(), CompareTrigger);
+
+	nexttick = TIME;
+	for (std::vector<Timer*>::const_iterator i = pending.begin(); i != pending.end(); ++i)
+		Schedule(*i);
+}
+
+void TimerManager::TickTimers(time_t TIME)
+{
+	// If the clock went backwards or jumped too far forwards to process every second
+	// in between then put all timers into the right buckets for the new time first.
+	if ((TIME < nexttick - 1) || (TIME - nexttick >= static_cast<time_t>(ROOT_SIZE)))
+		Rebuild(TIME);
+
+	while (nexttick <= TIME)
+	{
+		// When the first level wraps around move the timers from the next bucket of
+		// the level above down and if that level has also wrapped around then do the
+		// same for the level above it.
+		const size_t index = nexttick & (ROOT_SIZE - 1);
+		if (!index)
+		{
+			unsigned int shift = ROOT_BITS;
+			for (size_t level = 0; level < LEVEL_COUNT; ++level)
+			{
+				const size_t slot = (nexttick >> shift) & (LEVEL_SIZE - 1);
+				Cascade(levels[level][slot]);
+				if (slot)
+					break;
+				shift += LEVEL_BITS;
+			}
+		}
+		nexttick++;
+
+		// Move the timers which are due out of the wheel so that any timer which gets
+		// scheduled while we are ticking them will be handled in a later bucket.
+		TimerList& bucket = root[index];
+		while (!bucket.empty())
+		{
+			Timer* t = bucket.front();
+			bucket.pop_front();
+			expired.push_back(t);
+			t->bucket = &expired;
+		}
+
+		while (!expired.empty())
 		{
-			Timers.erase(i);
-			break;
+			Timer* t = expired.front();
+			expired.pop_front();
+			t->bucket = NULL;
+
+			if (!t->Tick(TIME))
+				continue;
+
+			if (t->GetRepeat())
+			{
+				t->SetTrigger(TIME + t->GetInterval());
+				AddTimer(t);
+			}
 		}
 	}
 }
 
+void TimerManager::DelTimer(Timer* t)
+{
+	if (!t->bucket)
+		return;
+
+	t->bucket->erase(t);
+	t->bucket = NULL;
+}
+
 void TimerManager::AddTimer(Timer* t)
 {
-	Timers.insert(std::make_pair(t->GetTrigger(), t));
+	// Adding a timer which is already scheduled moves it to its new trigger time.
+	DelTimer(t);
+	Schedule(t);
 }
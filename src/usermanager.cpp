@@ -117,7 +117,10 @@ namespace
 }
 
 UserManager::UserManager()
-	: already_sent_id(0)
+	: bgnext(NULL)
+	, bgchecked(0)
+	, bgpass(0)
+	, already_sent_id(0)
 	, unregistered_count(0)
 {
 }
@@ -306,6 +309,8 @@ void UserManager::QuitUser(User* user, const std::string& quitmessage, const std
 
 		if (lu->registered == REG_ALL)
 			ServerInstance->SNO->WriteToSnoMask('q',"Client exiting: %s (%s) [%s]", user->GetFullRealHost().c_str(), user->GetIPString().c_str(), operquitmsg.c_str());
+		if (bgnext == lu)
+			bgnext = *(++LocalList::iterator(lu));
 		local_users.erase(lu);
 	}
 
@@ -379,18 +384,13 @@ void UserManager::ServerNoticeAll(const char* text, ...)
 	}
 }
 
-/**
- * This function is called once a second from the mainloop.
- * It is intended to do background checking on all the users, e.g. do
- * ping checks, registration timeouts, etc.
- */
-void UserManager::DoBackgroundUserStuff()
+void UserManager::CheckNextUsers(size_t count)
 {
-	for (LocalList::iterator i = local_users.begin(); i != local_users.end(); )
+	while (bgnext && count--)
 	{
-		// It's possible that we quit the user below due to ping timeout etc. and QuitUser() removes it from the list
-		LocalUser* curr = *i;
-		++i;
+		// It's possible that we quit the user below due to ping timeout etc. and QuitUser() moves bgnext past it
+		LocalUser* curr = bgnext;
+		bgnext = *(++LocalList::iterator(curr));
 
 		if (curr->CommandFloodPenalty || curr->eh.getSendQSize())
 		{
@@ -419,6 +419,36 @@ void UserManager::DoBackgroundUserStuff()
 	}
 }
 
+/**
+ * This function is called on every iteration of the mainloop.
+ * It is intended to do background checking on all the users, e.g. do
+ * ping checks, registration timeouts, etc.
+ *
+ * Every user is checked once a second but instead of checking all of them
+ * at the start of the second the checks are spread out over the second in
+ * proportion to how much of it has passed.
+ */
+void UserManager::DoBackgroundUserStuff()
+{
+	if (bgpass != ServerInstance->Time())
+	{
+		// Finish the pass from the previous second before starting a new one.
+		CheckNextUsers(local_users.size());
+
+		bgpass = ServerInstance->Time();
+		bgnext = local_users.front();
+		bgchecked = 0;
+	}
+
+	const uint64_t elapsed = ServerInstance->Time_ns() / 1000;
+	const size_t target = static_cast<size_t>(local_users.size() * elapsed / 1000000);
+	if (target <= bgchecked)
+		return;
+
+	CheckNextUsers(target - bgchecked);
+	bgchecked = target;
+}
+
 already_sent_t UserManager::NextAlreadySentId()
 {
 	if (++already_sent_id == 0)
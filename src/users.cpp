@@ -319,7 +319,7 @@ void UserIOHandler::OnDataReady()
 		ServerInstance->Users->QuitUser(user, "Excess Flood");
 }
 
-void UserIOHandler::AddWriteBuf(const std::string &data)
+void UserIOHandler::AddWriteBuf(const SendQueue::Element& data)
 {
 	if (user->quitting_sendq)
 		return;
@@ -396,6 +396,7 @@ void User::Oper(OperInfo* info)
 		this->SetMode(opermh, true);
 	}
 	this->oper = info;
+	InvalidateBanCache();
 
 	LocalUser* localuser = IS_LOCAL(this);
 	if (localuser)
@@ -484,6 +485,7 @@ void User::UnOper()
 	 * to call UnOper. -- w00t
 	 */
 	oper = NULL;
+	InvalidateBanCache();
 
 	// Remove the user from the oper list
 	stdalgo::vector::swaperase(ServerInstance->Users->all_opers, this);
@@ -625,6 +627,15 @@ void User::InvalidateCache()
 	cached_hostip.clear();
 	cached_makehost.clear();
 	cached_fullrealhost.clear();
+
+	// The nick, ident, hosts and IP address can all be matched by bans
+	InvalidateBanCache();
+}
+
+void User::InvalidateBanCache()
+{
+	for (ChanList::iterator i = chans.begin(); i != chans.end(); ++i)
+		(*i)->bancached = 0;
 }
 
 bool User::ChangeNick(const std::string& newnick, time_t newts)
@@ -815,11 +826,10 @@ void LocalUser::Write(const ClientProtocol::SerializedMessage& text)
 		if (text.empty())
 			return;
 
-		std::string::size_type nlpos = text.find_first_of("\r\n", 0, 2);
-		if (nlpos == std::string::npos)
-			nlpos = text.length(); // TODO is this ok, test it
+		static const char crlf[] = "\r\n";
+		const char* const eol = std::find_first_of(text.begin(), text.end(), crlf, crlf + 2);
 
-		ServerInstance->Logs->Log("USEROUTPUT", LOG_RAWIO, "C[%s] O %.*s", uuid.c_str(), (int) nlpos, text.c_str());
+		ServerInstance->Logs->Log("USEROUTPUT", LOG_RAWIO, "C[%s] O %.*s", uuid.c_str(), (int) (eol - text.begin()), text.data());
 	}
 
 	eh.AddWriteBuf(text);
@@ -1019,6 +1029,7 @@ bool User::ChangeRealName(const std::string& real)
 	}
 	FOREACH_MOD(OnChangeRealName, (this, real));
 	this->realname.assign(real, 0, ServerInstance->Config->Limits.MaxReal);
+	InvalidateBanCache();
 
 	return true;
 }
@@ -1220,6 +1231,7 @@ void LocalUser::SetClass(const std::string &explicit_name)
 	if (found)
 	{
 		MyClass = found;
+		InvalidateBanCache();
 	}
 }
 
@@ -74,6 +74,60 @@ static bool MatchInternal(const unsigned char* str, const unsigned char* mask, u
 	return !*wild;
 }
 
+// Matches part of a mask which does not contain '*' against a string of the same length
+static bool MatchFixed(const unsigned char* str, const unsigned char* mask, size_t len, unsigned const char* map)
+{
+	for (size_t i = 0; i < len; ++i)
+	{
+		if ((map[mask[i]] != map[str[i]]) && (mask[i] != '?'))
+			return false;
+	}
+	return true;
+}
+
+// Finds the parts of a mask before the first '*' and after the last '*'
+static void SplitMask(const char* mask, size_t masklen, size_t& prefixlen, size_t& suffixlen, bool& backtrack)
+{
+	const char* first = static_cast<const char*>(memchr(mask, '*', masklen));
+	if (!first)
+	{
+		prefixlen = std::string::npos;
+		suffixlen = 0;
+		backtrack = false;
+		return;
+	}
+
+	size_t last = masklen - 1;
+	while (mask[last] != '*')
+		last--;
+
+	prefixlen = first - mask;
+	suffixlen = masklen - last - 1;
+	backtrack = (last != prefixlen);
+}
+
+// Checks the parts of the mask which have to match the start and the end of the string before
+// doing a full match so most strings which don't match are rejected without backtracking
+static bool MatchSplit(const unsigned char* str, size_t len, const unsigned char* mask, size_t masklen, size_t prefixlen, size_t suffixlen, bool backtrack, unsigned const char* map)
+{
+	if (prefixlen == std::string::npos)
+		return (len == masklen) && MatchFixed(str, mask, len, map);
+
+	if (len < prefixlen + suffixlen)
+		return false;
+
+	if (!MatchFixed(str, mask, prefixlen, map))
+		return false;
+
+	if (!MatchFixed(str + len - suffixlen, mask + masklen - suffixlen, suffixlen, map))
+		return false;
+
+	if (!backtrack)
+		return true;
+
+	return MatchInternal(str, mask, map);
+}
+
 // Below here is all wrappers around MatchInternal
 
 bool InspIRCd::Match(const std::string& str, const std::string& mask, unsigned const char* map)
@@ -81,7 +135,10 @@ bool InspIRCd::Match(const std::string& str, const std::string& mask, unsigned c
 	if (!map)
 		map = national_case_insensitive_map;
 
-	return MatchInternal((const unsigned char*)str.c_str(), (const unsigned char*)mask.c_str(), map);
+	size_t prefixlen, suffixlen;
+	bool backtrack;
+	SplitMask(mask.c_str(), mask.length(), prefixlen, suffixlen, backtrack);
+	return MatchSplit((const unsigned char*)str.c_str(), str.length(), (const unsigned char*)mask.c_str(), mask.length(), prefixlen, suffixlen, backtrack, map);
 }
 
 bool InspIRCd::Match(const char* str, const char* mask, unsigned const char* map)
@@ -89,12 +146,31 @@ bool InspIRCd::Match(const char* str, const char* mask, unsigned const char* map
 	if (!map)
 		map = national_case_insensitive_map;
 
-	return MatchInternal((const unsigned char*)str, (const unsigned char*)mask, map);
+	const size_t masklen = strlen(mask);
+	size_t prefixlen, suffixlen;
+	bool backtrack;
+	SplitMask(mask, masklen, prefixlen, suffixlen, backtrack);
+	return MatchSplit((const unsigned char*)str, strlen(str), (const unsigned char*)mask, masklen, prefixlen, suffixlen, backtrack, map);
+}
+
+irc::wildcard_mask::wildcard_mask(const std::string& pattern)
+	: mask(pattern)
+{
+	SplitMask(mask.c_str(), mask.length(), prefixlen, suffixlen, backtrack);
+}
+
+bool irc::wildcard_mask::Match(const std::string& str, unsigned const char* map) const
+{
+	if (!map)
+		map = national_case_insensitive_map;
+
+	return MatchSplit((const unsigned char*)str.c_str(), str.length(), (const unsigned char*)mask.c_str(), mask.length(), prefixlen, suffixlen, backtrack, map);
 }
 
 bool InspIRCd::MatchCIDR(const std::string& str, const std::string& mask, unsigned const char* map)
 {
-	if (irc::sockets::MatchCIDR(str, mask, true))
+	// A mask without a '/' can never be a CIDR mask so don't bother parsing it as one
+	if ((mask.find('/') != std::string::npos) && (irc::sockets::MatchCIDR(str, mask, true)))
 		return true;
 
 	// Fall back to regular match
@@ -103,7 +179,7 @@ bool InspIRCd::MatchCIDR(const std::string& str, const std::string& mask, unsign
 
 bool InspIRCd::MatchCIDR(const char* str, const char* mask, unsigned const char* map)
 {
-	if (irc::sockets::MatchCIDR(str, mask, true))
+	if ((strchr(mask, '/')) && (irc::sockets::MatchCIDR(str, mask, true)))
 		return true;
 
 	// Fall back to regular match
@@ -141,6 +141,177 @@ class ZLineFactory : public XLineFactory
  *  bans. :)
  */
 
+namespace
+{
+	enum MaskType
+	{
+		// The mask contains no wildcards and can only match a host or IP which is the same.
+		MASK_EXACT,
+
+		// The mask is a CIDR range.
+		MASK_CIDR,
+
+		// The mask has to be matched with wildcard matching.
+		MASK_WILD
+	};
+
+	MaskType GetMaskType(const std::string& mask, irc::sockets::cidr_mask& range)
+	{
+		if (mask.find_first_of("*?@") != std::string::npos)
+			return MASK_WILD;
+
+		const std::string::size_type per_pos = mask.rfind('/');
+		if (per_pos == std::string::npos)
+			return MASK_EXACT;
+
+		// This needs to accept the same masks as irc::sockets::MatchCIDR does.
+		if ((per_pos == mask.length() - 1)
+			|| (mask.find_first_not_of("0123456789", per_pos + 1) != std::string::npos)
+			|| (mask.find_first_not_of("0123456789abcdefABCDEF.:") < per_pos))
+			return MASK_WILD;
+
+		irc::sockets::sockaddrs sa;
+		if (!irc::sockets::aptosa(mask.substr(0, per_pos), 0, sa))
+			return MASK_WILD;
+
+		range = irc::sockets::cidr_mask(mask);
+		return MASK_CIDR;
+	}
+}
+
+const std::string* XLineIndex::GetMask(XLine* line)
+{
+	if (line->type == "G")
+		return &static_cast<GLine*>(line)->hostmask;
+	if (line->type == "K")
+		return &static_cast<KLine*>(line)->hostmask;
+	if (line->type == "E")
+		return &static_cast<ELine*>(line)->hostmask;
+	if (line->type == "Z")
+		return &static_cast<ZLine*>(line)->ipaddr;
+	return NULL;
+}
+
+void XLineIndex::Add(XLine* line)
+{
+	const std::string& mask = *GetMask(line);
+	irc::sockets::cidr_mask range;
+	switch (GetMaskType(mask, range))
+	{
+		case MASK_EXACT:
+			exact[mask].push_back(line);
+			break;
+
+		case MASK_CIDR:
+			cidr[range].push_back(line);
+			cidrlengths[std::make_pair(range.type, range.length)]++;
+			break;
+
+		case MASK_WILD:
+			wild.push_back(line);
+			break;
+	}
+}
+
+void XLineIndex::Remove(XLine* line)
+{
+	const std::string& mask = *GetMask(line);
+	irc::sockets::cidr_mask range;
+	switch (GetMaskType(mask, range))
+	{
+		case MASK_EXACT:
+		{
+			ExactMap::iterator iter = exact.find(mask);
+			if (iter == exact.end() || !stdalgo::vector::swaperase(iter->second, line))
+				return;
+
+			if (iter->second.empty())
+				exact.erase(iter);
+			break;
+		}
+
+		case MASK_CIDR:
+		{
+			CIDRMap::iterator iter = cidr.find(range);
+			if (iter == cidr.end() || !stdalgo::vector::swaperase(iter->second, line))
+				return;
+
+			if (iter->second.empty())
+				cidr.erase(iter);
+
+			CIDRLengthMap::iterator liter = cidrlengths.find(std::make_pair(range.type, range.length));
+			if (!--liter->second)
+				cidrlengths.erase(liter);
+			break;
+		}
+
+		case MASK_WILD:
+			stdalgo::vector::swaperase(wild, line);
+			break;
+	}
+}
+
+void XLineIndex::FindCIDR(const irc::sockets::sockaddrs& sa, LineList& out) const
+{
+	for (CIDRLengthMap::const_iterator i = cidrlengths.begin(); i != cidrlengths.end(); ++i)
+	{
+		if (i->first.first != sa.family())
+			continue;
+
+		CIDRMap::const_iterator iter = cidr.find(irc::sockets::cidr_mask(sa, i->first.second));
+		if (iter != cidr.end())
+			out.insert(out.end(), iter->second.begin(), iter->second.end());
+	}
+}
+
+void XLineIndex::Find(User* user, LineList& out) const
+{
+	const size_t first = out.size();
+	const std::string& host = user->GetRealHost();
+	const std::string& ip = user->GetIPString();
+
+	// Masks are matched against both the real host and the IP address of the user.
+	bool duplicates = false;
+	if (!exact.empty())
+	{
+		ExactMap::const_iterator iter = exact.find(host);
+		if (iter != exact.end())
+			out.insert(out.end(), iter->second.begin(), iter->second.end());
+
+		if (host != ip)
+		{
+			iter = exact.find(ip);
+			if (iter != exact.end())
+			{
+				out.insert(out.end(), iter->second.begin(), iter->second.end());
+				duplicates = true;
+			}
+		}
+	}
+
+	if (!cidr.empty())
+	{
+		FindCIDR(user->client_sa, out);
+
+		// The real host is only worth checking against CIDR masks if it is an IP address.
+		irc::sockets::sockaddrs sa;
+		if (host != ip && irc::sockets::aptosa(host, 0, sa))
+		{
+			FindCIDR(sa, out);
+			duplicates = true;
+		}
+	}
+
+	out.insert(out.end(), wild.begin(), wild.end());
+
+	// The same line must not be returned twice as the caller might expire it.
+	if (duplicates)
+	{
+		std::sort(out.begin() + first, out.end());
+		out.erase(std::unique(out.begin() + first, out.end()), out.end());
+	}
+}
+
 bool XLine::Matches(User *u)
 {
 	return false;
@@ -161,25 +332,25 @@ void XLineManager::CheckELines()
 	if (ELines.empty())
 		return;
 
+	const XLineIndex& index = line_index["E"];
+	XLineIndex::LineList elines;
+
 	const UserManager::LocalList& list = ServerInstance->Users.GetLocalUsers();
 	for (UserManager::LocalList::const_iterator u2 = list.begin(); u2 != list.end(); u2++)
 	{
 		LocalUser* u = *u2;
 		u->exempt = false;
 
-		/* This uses safe iteration to ensure that if a line expires here, it doesn't trash the iterator */
-		LookupIter safei;
-
-		for (LookupIter i = ELines.begin(); i != ELines.end(); )
+		elines.clear();
+		index.Find(u, elines);
+		for (XLineIndex::LineList::const_iterator i = elines.begin(); i != elines.end(); ++i)
 		{
-			safei = i;
-			safei++;
-
-			XLine *e = i->second;
+			XLine *e = *i;
 			if ((!e->duration || ServerInstance->Time() < e->expiry) && e->Matches(u))
+			{
 				u->exempt = true;
-
-			i = safei;
+				break;
+			}
 		}
 	}
 }
@@ -309,6 +480,8 @@ bool XLineManager::AddLine(XLine* line, User* user)
 		pending_lines.push_back(line);
 
 	lookup_lines[line->type][line->Displayable()] = line;
+	if (XLineIndex::GetMask(line))
+		line_index[line->type].Add(line);
 	line->OnAdd();
 
 	FOREACH_MOD(OnAddLine, (user, line));
@@ -342,6 +515,7 @@ bool XLineManager::DelLine(const char* hostmask, const std::string& type, std::s
 	y->second->Unset();
 
 	stdalgo::erase(pending_lines, y->second);
+	RemoveFromIndex(y->second);
 
 	delete y->second;
 	x->second.erase(y);
@@ -366,6 +540,27 @@ XLine* XLineManager::MatchesLine(const std::string &type, User* user)
 
 	const time_t current = ServerInstance->Time();
 
+	std::map<std::string, XLineIndex>::const_iterator index = line_index.find(type);
+	if (index != line_index.end())
+	{
+		// Only the lines which the index says might match need to be checked.
+		XLineIndex::LineList candidates;
+		index->second.Find(user, candidates);
+		for (XLineIndex::LineList::const_iterator i = candidates.begin(); i != candidates.end(); ++i)
+		{
+			XLine* xline = *i;
+			if (xline->duration && current > xline->expiry)
+			{
+				ExpireLine(x, x->second.find(xline->Displayable()));
+				continue;
+			}
+
+			if (xline->Matches(user))
+				return xline;
+		}
+		return NULL;
+	}
+
 	LookupIter safei;
 
 	for (LookupIter i = x->second.begin(); i != x->second.end(); )
@@ -441,15 +636,39 @@ void XLineManager::ExpireLine(ContainerIter container, LookupIter item, bool sil
 	 * -- Brain
 	 */
 	stdalgo::erase(pending_lines, item->second);
+	RemoveFromIndex(item->second);
 
 	delete item->second;
 	container->second.erase(item);
 }
 
 
+void XLineManager::RemoveFromIndex(XLine* line)
+{
+	std::map<std::string, XLineIndex>::iterator index = line_index.find(line->type);
+	if (index != line_index.end())
+		index->second.Remove(line);
+}
+
 // applies lines, removing clients and changing nicks etc as applicable
 void XLineManager::ApplyLines()
 {
+	if (pending_lines.empty())
+		return;
+
+	// Index the pending lines so each user is only checked against the ones which might match
+	// them instead of all of them. This matters when lots of lines are added at once.
+	XLineIndex index;
+	std::vector<XLine*> unindexed;
+	for (std::vector<XLine *>::iterator i = pending_lines.begin(); i != pending_lines.end(); i++)
+	{
+		if (XLineIndex::GetMask(*i))
+			index.Add(*i);
+		else
+			unindexed.push_back(*i);
+	}
+
+	XLineIndex::LineList candidates;
 	const UserManager::LocalList& list = ServerInstance->Users.GetLocalUsers();
 	for (UserManager::LocalList::const_iterator j = list.begin(); j != list.end(); )
 	{
@@ -459,7 +678,11 @@ void XLineManager::ApplyLines()
 		if (u->exempt)
 			continue;
 
-		for (std::vector<XLine *>::iterator i = pending_lines.begin(); i != pending_lines.end(); i++)
+		candidates.clear();
+		index.Find(u, candidates);
+		candidates.insert(candidates.end(), unindexed.begin(), unindexed.end());
+
+		for (XLineIndex::LineList::const_iterator i = candidates.begin(); i != candidates.end(); i++)
 		{
 			XLine *x = *i;
 			if (x->Matches(u))
@@ -0,0 +1,210 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/* Compares the multimap which TimerManager used to keep pending timers in with
+ * the hierarchical timing wheel in src/timer.cpp, which this is built against.
+ * Run this with tools/benchmark timers.
+ */
+
+/// $Sources: timer.cpp
+
+#include "inspircd.h"
+
+#include <chrono>
+#include <random>
+
+InspIRCd* ServerInstance;
+
+namespace
+{
+	/** The time which InspIRCd::Time() returns. */
+	time_t benchtime = 1600000000;
+
+	/** Storage for ServerInstance. Only the TimerManager in it is constructed as
+	 * that and the clock are the only parts of it which the timer code uses.
+	 */
+	insp::aligned_storage<InspIRCd> instance;
+
+	class BenchTimer CXX11_FINAL : public Timer
+	{
+	 public:
+		/** The seconds at which this timer ticked. */
+		std::vector<time_t> ticks;
+
+		BenchTimer(unsigned int interval, bool repeating)
+			: Timer(interval, repeating)
+		{
+		}
+
+		bool Tick(time_t TIME) CXX11_OVERRIDE
+		{
+			ticks.push_back(TIME);
+			return true;
+		}
+	};
+
+	/** The TimerManager from before the timing wheel. */
+	class MapTimerManager
+	{
+		typedef std::multimap<time_t, Timer*> TimerMap;
+		TimerMap Timers;
+
+	 public:
+		void TickTimers(time_t TIME)
+		{
+			for (TimerMap::iterator i = Timers.begin(); i != Timers.end(); )
+			{
+				Timer* t = i->second;
+				if (t->GetTrigger() > TIME)
+					break;
+
+				Timers.erase(i++);
+
+				if (!t->Tick(TIME))
+					continue;
+
+				if (t->GetRepeat())
+				{
+					t->SetTrigger(TIME + t->GetInterval());
+					AddTimer(t);
+				}
+			}
+		}
+
+		void DelTimer(Timer* t)
+		{
+			std::pair<TimerMap::iterator, TimerMap::iterator> itpair = Timers.equal_range(t->GetTrigger());
+
+			for (TimerMap::iterator i = itpair.first; i != itpair.second; ++i)
+			{
+				if (i->second == t)
+				{
+					Timers.erase(i);
+					break;
+				}
+			}
+		}
+
+		void AddTimer(Timer* t)
+		{
+			Timers.insert(std::make_pair(t->GetTrigger(), t));
+		}
+	};
+
+	struct Result
+	{
+		double insert;
+		double cancel;
+		double tick;
+		std::vector<BenchTimer*> timers;
+	};
+
+	template <typename F>
+	double Time(F f)
+	{
+		const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		f();
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// Runs the same workload against a timer manager. Most timers are like the ones
+	// the server creates per connection: registration timeouts and pings which are
+	// a few minutes apart. The rest are long running module timers.
+	template <typename Manager>
+	Result Run(Manager& manager, size_t count, size_t resets, time_t duration)
+	{
+		std::mt19937 rng(1234);
+		benchtime = 1600000000;
+		ServerInstance->UpdateTime();
+		manager.TickTimers(benchtime);
+
+		Result result;
+		result.insert = Time([&]() {
+			for (size_t i = 0; i < count; ++i)
+			{
+				const bool shortlived = (rng() % 10);
+				const unsigned int interval = shortlived ? 1 + rng() % 300 : 3600 + rng() % 86400;
+				result.timers.push_back(new BenchTimer(interval, rng() % 2));
+				manager.AddTimer(result.timers.back());
+			}
+		});
+
+		// Cancel timers and add them again with a new trigger time like a ping timer being
+		// reset when a client sends something.
+		result.cancel = Time([&]() {
+			for (size_t i = 0; i < resets; ++i)
+			{
+				Timer* t = result.timers[rng() % count];
+				manager.DelTimer(t);
+				t->SetTrigger(benchtime + 1 + rng() % 300);
+				manager.AddTimer(t);
+			}
+		});
+
+		result.tick = Time([&]() {
+			for (time_t end = benchtime + duration; benchtime < end; )
+			{
+				benchtime++;
+				ServerInstance->UpdateTime();
+				manager.TickTimers(benchtime);
+			}
+		});
+
+		for (std::vector<BenchTimer*>::const_iterator i = result.timers.begin(); i != result.timers.end(); ++i)
+			manager.DelTimer(*i);
+		return result;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const size_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+	const size_t resets = count * 2;
+	const time_t duration = 3600;
+
+	ServerInstance = instance;
+	new (&ServerInstance->Timers) TimerManager;
+
+	MapTimerManager multimap;
+	const Result map = Run(multimap, count, resets, duration);
+	const Result wheel = Run(ServerInstance->Timers, count, resets, duration);
+
+	// Both managers must tick every timer at exactly the same times.
+	size_t mismatches = 0;
+	size_t ticks = 0;
+	for (size_t i = 0; i < count; ++i)
+	{
+		ticks += map.timers[i]->ticks.size();
+		if (map.timers[i]->ticks != wheel.timers[i]->ticks)
+			mismatches++;
+		delete map.timers[i];
+		delete wheel.timers[i];
+	}
+
+	printf("%zu timers, %zu resets, %ld seconds ticked, %zu ticks, %zu timers ticked differently\n", count, resets, static_cast<long>(duration), ticks, mismatches);
+	printf("              multimap       wheel\n");
+	printf("  insert   %8.1f ms %8.1f ms\n", map.insert, wheel.insert);
+	printf("  cancel   %8.1f ms %8.1f ms\n", map.cancel, wheel.cancel);
+	printf("  tick     %8.1f ms %8.1f ms\n", map.tick, wheel.tick);
+	return mismatches ? 1 : 0;
+}
+
+void InspIRCd::UpdateTime()
+{
+	TIME.tv_sec = benchtime;
+	TIME.tv_nsec = 0;
+}
@@ -0,0 +1,329 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/* Compares the backtracking glob matcher which InspIRCd::Match() and
+ * InspIRCd::MatchCIDR() used to run on every mask with the ones in
+ * src/wildcard.cpp, which this is built against. Run this with
+ * tools/benchmark wildcard.
+ */
+
+/// $Sources: cidr.cpp hashcomp.cpp socket.cpp wildcard.cpp
+
+#include "inspircd.h"
+
+#include <chrono>
+#include <random>
+
+InspIRCd* ServerInstance;
+unsigned const char* national_case_insensitive_map = rfc_case_insensitive_map;
+
+namespace
+{
+	/** The old matcher. src/wildcard.cpp still uses this for the middle of masks
+	 * which contain more than one '*'.
+	 */
+	bool MatchInternal(const unsigned char* str, const unsigned char* mask, unsigned const char* map)
+	{
+		unsigned char* cp = NULL;
+		unsigned char* mp = NULL;
+		unsigned char* string = (unsigned char*)str;
+		unsigned char* wild = (unsigned char*)mask;
+
+		while ((*string) && (*wild != '*'))
+		{
+			if ((map[*wild] != map[*string]) && (*wild != '?'))
+			{
+				return 0;
+			}
+			wild++;
+			string++;
+		}
+
+		while (*string)
+		{
+			if (*wild == '*')
+			{
+				if (!*++wild)
+				{
+					return 1;
+				}
+				mp = wild;
+				cp = string+1;
+			}
+			else
+				if ((map[*wild] == map[*string]) || (*wild == '?'))
+				{
+					wild++;
+					string++;
+				}
+				else
+				{
+					wild = mp;
+					string = cp++;
+				}
+
+		}
+
+		while (*wild == '*')
+		{
+			wild++;
+		}
+
+		return !*wild;
+	}
+
+	/** The old InspIRCd::Match(). */
+	bool MatchOld(const std::string& str, const std::string& mask, unsigned const char* map)
+	{
+		return MatchInternal((const unsigned char*)str.c_str(), (const unsigned char*)mask.c_str(), map);
+	}
+
+	/** The old InspIRCd::MatchCIDR(). */
+	bool MatchCIDROld(const std::string& str, const std::string& mask, unsigned const char* map)
+	{
+		if (irc::sockets::MatchCIDR(str, mask, true))
+			return true;
+
+		return MatchOld(str, mask, map);
+	}
+
+	std::mt19937 rng(1234);
+
+	size_t Random(size_t max)
+	{
+		return std::uniform_int_distribution<size_t>(0, max - 1)(rng);
+	}
+
+	template <size_t N>
+	const char* Pick(const char* const (&items)[N])
+	{
+		return items[Random(N)];
+	}
+
+	const char* const nicks[] = { "Alice", "bob", "Carol_", "dave|away", "[Eve]", "frank`", "Grace", "heidi^", "Ivan", "judy", "Mallory", "oscar-", "Peggy", "trent", "Victor", "walter" };
+	const char* const idents[] = { "~alice", "bob", "~carol", "dave", "~eve", "frank", "~grace", "sid", "uid12345", "~u", "webchat", "znc" };
+	const char* const domains[] = { "dsl.example.net", "cable.example.com", "res.provider.example.org", "mobile.carrier.example", "users.example.chat", "ip.isp.example.de", "static.hosting.example.io", "pool.example.fr" };
+	const char* const cloaks[] = { "user/alice", "staff/bob", "unaffiliated/carol", "gateway/web/irccloud.com/x-abcdef", "Clk-1A2B3C4D", "ip6.Clk-9F8E7D6C" };
+
+	std::string RandomHost()
+	{
+		char buf[64];
+		switch (Random(4))
+		{
+			case 0:
+				snprintf(buf, sizeof(buf), "%zu.%zu.%zu.%zu", 1 + Random(223), Random(256), Random(256), 1 + Random(254));
+				return buf;
+			case 1:
+				snprintf(buf, sizeof(buf), "2001:db8:%zx:%zx::%zx", Random(65536), Random(65536), 1 + Random(65535));
+				return buf;
+			case 2:
+				return Pick(cloaks);
+			default:
+				snprintf(buf, sizeof(buf), "host-%zu-%zu-%zu.", Random(256), Random(256), Random(256));
+				return buf + std::string(Pick(domains));
+		}
+	}
+
+	std::string RandomUser()
+	{
+		return std::string(Pick(nicks)) + "!" + Pick(idents) + "@" + RandomHost();
+	}
+
+	// Ban masks of the sort found in the ban lists of busy channels and in X-lines.
+	std::string RandomBan()
+	{
+		const std::string host = RandomHost();
+		switch (Random(8))
+		{
+			case 0:
+				return "*!*@" + host;
+			case 1:
+				return std::string("*!") + Pick(idents) + "@" + host;
+			case 2:
+				return std::string(Pick(nicks)) + "!*@*";
+			case 3:
+				return std::string("*!*@*.") + Pick(domains);
+			case 4:
+				return "*!*@" + host.substr(0, host.find('.') + 1) + "*";
+			case 5:
+				return std::string("*") + Pick(nicks) + "*!*@*";
+			case 6:
+				return std::string("*!*") + Pick(idents) + "*@*" + Pick(domains);
+			default:
+				return std::string(Pick(nicks)) + "!" + Pick(idents) + "@" + host;
+		}
+	}
+
+	std::string RandomIP()
+	{
+		char buf[64];
+		if (Random(3))
+			snprintf(buf, sizeof(buf), "%zu.%zu.%zu.%zu", 1 + Random(223), Random(256), Random(256), 1 + Random(254));
+		else
+			snprintf(buf, sizeof(buf), "2001:db8:%zx:%zx::%zx", Random(65536), Random(65536), 1 + Random(65535));
+		return buf;
+	}
+
+	// IP masks of the sort used in Z-lines and connect classes.
+	std::string RandomIPBan()
+	{
+		const std::string ip = RandomIP();
+		char buf[64];
+		switch (Random(4))
+		{
+			case 0:
+				return ip;
+			case 1:
+				return ip.substr(0, ip.rfind(ip.find(':') == std::string::npos ? '.' : ':') + 1) + "*";
+			case 2:
+				snprintf(buf, sizeof(buf), "%zu.%zu.0.0/16", 1 + Random(223), Random(256));
+				return buf;
+			default:
+				snprintf(buf, sizeof(buf), "2001:db8:%zx::/48", Random(65536));
+				return buf;
+		}
+	}
+
+	// Short strings over a tiny alphabet so that masks match often and the matchers
+	// have to backtrack a lot.
+	std::string RandomString(bool mask)
+	{
+		static const char chars[] = "aAbB[{?*";
+		std::string str;
+		for (size_t i = Random(9); i; --i)
+			str.push_back(chars[Random(mask ? 8 : 6)]);
+		return str;
+	}
+
+	template <typename F>
+	double Time(F f)
+	{
+		const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		f();
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const size_t pairs = argc > 1 ? strtoul(argv[1], NULL, 10) : 3000000;
+	const size_t bancount = 500;
+	const size_t usercount = 20000;
+	unsigned const char* map = rfc_case_insensitive_map;
+
+	// Check that the old and new matchers agree on random masks and strings and on realistic ones.
+	size_t mismatches = 0;
+	for (size_t i = 0; i < pairs; ++i)
+	{
+		std::string mask;
+		std::string str;
+		bool expected;
+		bool actual;
+		switch (i % 4)
+		{
+			case 0:
+				mask = RandomBan();
+				str = RandomUser();
+				expected = MatchOld(str, mask, map);
+				actual = InspIRCd::Match(str, mask, map);
+				break;
+			case 1:
+				mask = RandomIPBan();
+				str = RandomIP();
+				expected = MatchCIDROld(str, mask, map);
+				actual = InspIRCd::MatchCIDR(str, mask, map);
+				break;
+			default:
+				mask = RandomString(true);
+				str = RandomString(false);
+				expected = MatchOld(str, mask, map);
+				actual = InspIRCd::Match(str, mask, map);
+				break;
+		}
+
+		// The other forms of the new matcher have to agree with it as well.
+		const bool consistent = (i % 4 == 1) || ((InspIRCd::Match(str.c_str(), mask.c_str(), map) == actual)
+			&& (irc::wildcard_mask(mask).Match(str, map) == actual));
+		if (actual != expected || !consistent)
+		{
+			if (++mismatches <= 10)
+				printf("MISMATCH: mask \"%s\" string \"%s\" old %d\n", mask.c_str(), str.c_str(), expected);
+		}
+	}
+	printf("equivalence: %zu pairs, %zu mismatches\n", pairs, mismatches);
+
+	// Match every user against a ban list like a channel join or X-line check does.
+	std::vector<std::string> bans;
+	std::vector<irc::wildcard_mask> compiled;
+	std::vector<std::string> ipbans;
+	for (size_t i = 0; i < bancount; ++i)
+	{
+		bans.push_back(RandomBan());
+		compiled.push_back(irc::wildcard_mask(bans.back()));
+		ipbans.push_back(RandomIPBan());
+	}
+
+	std::vector<std::string> users;
+	std::vector<std::string> ips;
+	for (size_t i = 0; i < usercount; ++i)
+	{
+		users.push_back(RandomUser());
+		ips.push_back(RandomIP());
+	}
+
+	size_t hits[5] = { 0, 0, 0, 0, 0 };
+	const double old = Time([&]() {
+		for (size_t u = 0; u < users.size(); ++u)
+			for (size_t b = 0; b < bans.size(); ++b)
+				hits[0] += MatchOld(users[u], bans[b], map);
+	});
+	const double match = Time([&]() {
+		for (size_t u = 0; u < users.size(); ++u)
+			for (size_t b = 0; b < bans.size(); ++b)
+				hits[1] += InspIRCd::Match(users[u], bans[b], map);
+	});
+	const double precompiled = Time([&]() {
+		for (size_t u = 0; u < users.size(); ++u)
+			for (size_t b = 0; b < compiled.size(); ++b)
+				hits[2] += compiled[b].Match(users[u], map);
+	});
+	const double oldcidr = Time([&]() {
+		for (size_t u = 0; u < ips.size(); ++u)
+			for (size_t b = 0; b < ipbans.size(); ++b)
+				hits[3] += MatchCIDROld(ips[u], ipbans[b], map);
+	});
+	const double cidr = Time([&]() {
+		for (size_t u = 0; u < ips.size(); ++u)
+			for (size_t b = 0; b < ipbans.size(); ++b)
+				hits[4] += InspIRCd::MatchCIDR(ips[u], ipbans[b], map);
+	});
+
+	printf("ban list: %zu users x %zu bans, %zu/%zu/%zu matches\n", usercount, bancount, hits[0], hits[1], hits[2]);
+	printf("  old Match()       %8.1f ms\n", old);
+	printf("  Match()           %8.1f ms (%.0f%% faster)\n", match, 100 * (1 - match / old));
+	printf("  wildcard_mask     %8.1f ms (%.0f%% faster)\n", precompiled, 100 * (1 - precompiled / old));
+	printf("IP ban list: %zu IPs x %zu bans, %zu/%zu matches\n", usercount, bancount, hits[3], hits[4]);
+	printf("  old MatchCIDR()   %8.1f ms\n", oldcidr);
+	printf("  MatchCIDR()       %8.1f ms (%.0f%% faster)\n", cidr, 100 * (1 - cidr / oldcidr));
+	return (mismatches || hits[0] != hits[1] || hits[0] != hits[2] || hits[3] != hits[4]) ? 1 : 0;
+}
+
+// The address code in socket.cpp only logs when it is given an address family it
+// does not know about which never happens here.
+void LogManager::Log(const std::string& type, LogLevel loglevel, const char* fmt, ...)
+{
+}